@@ -71,6 +71,7 @@ static int EGifPutWord(int Word, GifFileType * GifFile);
 static int EGifSetupCompress(GifFileType * GifFile);
 static int EGifCompressLine(GifFileType * GifFile, GifPixelType * Line,
                             int LineLen);
+static void EGifClearDictionary(GifFilePrivateType * Private, int EndCode);
 static int EGifCompressOutput(GifFileType * GifFile, int Code);
 static int EGifBufferedOutput(GifFileType * GifFile, GifByteType * Buf,
                               int c);
@@ -743,6 +744,8 @@ EGifCloseFile(GifFileType * GifFile) {
     }
     if (Private) {
         if (Private->HashTable) {
+            if (Private->HashTable->Direct)
+                free((char *) Private->HashTable->Direct);
             free((char *) Private->HashTable);
         }
 	    free((char *) Private);
@@ -813,6 +816,17 @@ EGifSetupCompress(GifFileType * GifFile) {
 
    /* Clear hash table and send Clear to make sure the decoder do the same. */
     _ClearHashTable(Private->HashTable);
+    if (BitsPerPixel <= HT_DIRECT_BITS) {
+        /* Small code sizes use the direct-indexed dictionary (cleared here */
+        /* since the previous image may have left entries in it).           */
+        if (Private->HashTable->Direct == NULL)
+            Private->HashTable->Direct = (unsigned short *)malloc(
+                ((LZ_MAX_CODE + 1) << HT_DIRECT_BITS) * sizeof(unsigned short));
+        if (Private->HashTable->Direct)
+            memset(Private->HashTable->Direct, 0,
+                   ((LZ_MAX_CODE + 1) << HT_DIRECT_BITS) * sizeof(unsigned short));
+    }
+    EGifClearDictionary(Private, 0);
 
     if (EGifCompressOutput(GifFile, Private->ClearCode) == GIF_ERROR) {
         _GifError = E_GIF_ERR_DISK_IS_FULL;
@@ -821,24 +835,91 @@ EGifSetupCompress(GifFileType * GifFile) {
     return GIF_OK;
 }
 
+/******************************************************************************
+ * Clear the compression dictionary, EndCode is the first code that was not
+ * used yet (only needed to clean up the direct-indexed dictionary).
+ *****************************************************************************/
+static void
+EGifClearDictionary(GifFilePrivateType * Private,
+                    int EndCode) {
+
+    GifHashTableType *HashTable = Private->HashTable;
+    int i;
+
+    if (Private->BitsPerPixel <= HT_DIRECT_BITS && HashTable->Direct) {
+        /* Only the entries that were added need clearing: */
+        for (i = Private->EOFCode + 1; i < EndCode; i++)
+            HashTable->Direct[(Private->Prefix[i] << HT_DIRECT_BITS) |
+                              Private->Suffix[i]] = 0;
+    } else if (EndCode > 0) {
+        _ClearHashTable(HashTable);
+    }
+
+    memset(HashTable->RunNext, 0, sizeof(HashTable->RunNext));
+    memset(HashTable->RunPixel, 0, sizeof(HashTable->RunPixel));
+    for (i = 0; i < Private->ClearCode; i++)
+        HashTable->RunPixel[i] = (unsigned short)(i + 1);
+}
+
+#ifdef _MSC_VER
+typedef unsigned __int64 GifShiftType;
+#else
+typedef unsigned long long GifShiftType;
+#endif
+
+/* Same as EGifCompressOutput() for a code, but buffered in locals: */
+#define LZ_OUTPUT(Code) do {                                              \
+    ShiftDWord |= ((GifShiftType)(Code)) << ShiftState;                   \
+    ShiftState += RunningBits;                                            \
+    if (ShiftState >= 32) {                                               \
+        LZ_OUTPUT_BYTE(ShiftDWord); LZ_OUTPUT_BYTE(ShiftDWord >> 8);      \
+        LZ_OUTPUT_BYTE(ShiftDWord >> 16); LZ_OUTPUT_BYTE(ShiftDWord >> 24);\
+        ShiftDWord >>= 32;                                                \
+        ShiftState -= 32;                                                 \
+    }                                                                     \
+    if (RunningCode >= MaxCode1)                                          \
+        MaxCode1 = 1 << ++RunningBits;                                    \
+} while (0)
+
+/* Same as EGifBufferedOutput() for a byte: */
+#define LZ_OUTPUT_BYTE(c) do {                                            \
+    if (Buf[0] == 255) {                                                  \
+        if (WRITE(GifFile, Buf, 256) != 256) WriteError = 1;              \
+        Buf[0] = 0;                                                       \
+    }                                                                     \
+    Buf[++Buf[0]] = (GifByteType)(c);                                     \
+} while (0)
+
 /******************************************************************************
  * The LZ compression routine:
  * This version compresses the given buffer Line of length LineLen.
  * This routine can be called a few times (one per scan line, for example), in
  * order to complete the whole image.
+ * The dictionary is looked up directly for small code sizes and through the
+ * hash table otherwise, and runs of one pixel value follow RunNext without
+ * any lookup. Codes are packed into a 64 bit accumulator and written out 32
+ * bits at a time. The output is identical to the straightforward version.
 ******************************************************************************/
 static int
 EGifCompressLine(GifFileType * GifFile,
                  GifPixelType * Line,
                  int LineLen) {
 
-    int i = 0, CrntCode, NewCode;
-    unsigned long NewKey;
-    GifPixelType Pixel;
-    GifHashTableType *HashTable;
+    int i = 0, CrntCode, NewCode, Pixel, HKey, WriteError = 0;
+    UINT32 NewKey, HTKey;
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
-
-    HashTable = Private->HashTable;
+    GifHashTableType *HashTable = Private->HashTable;
+    UINT32 *HTable = HashTable->HTable;
+    unsigned short *RunNext = HashTable->RunNext;
+    unsigned short *RunPixel = HashTable->RunPixel;
+    unsigned short *Direct = Private->BitsPerPixel <= HT_DIRECT_BITS ?
+                             HashTable->Direct : NULL;
+    GifByteType *Buf = Private->Buf;
+    int RunningCode = Private->RunningCode,
+        RunningBits = Private->RunningBits,
+        MaxCode1 = Private->MaxCode1;
+    GifShiftType ShiftDWord = Private->CrntShiftDWord;
+    int ShiftState = Private->CrntShiftState;
 
     if (Private->CrntCode == FIRST_CODE)    /* Its first time! */
         CrntCode = Line[i++];
@@ -847,50 +928,99 @@ EGifCompressLine(GifFileType * GifFile,
 
     while (i < LineLen) {   /* Decode LineLen items. */
         Pixel = Line[i++];  /* Get next pixel from stream. */
-        /* Form a new unique key to search hash table for the code combines 
-         * CrntCode as Prefix string with Pixel as postfix char.
-         */
-        NewKey = (((UINT32) CrntCode) << 8) + Pixel;
-        if ((NewCode = _ExistsHashTable(HashTable, NewKey)) >= 0) {
-            /* This Key is already there, or the string is old one, so
-             * simple take new code as our CrntCode:
-             */
-            CrntCode = NewCode;
+        HKey = -1;
+
+        if (RunPixel[CrntCode] == Pixel + 1) {
+            /* Extending a run: the longer run is either RunNext or new. */
+            if ((NewCode = RunNext[CrntCode]) != 0) {
+                CrntCode = NewCode;
+                continue;
+            }
+        } else if (Direct) {
+            if ((NewCode = Direct[(CrntCode << HT_DIRECT_BITS) | Pixel]) != 0) {
+                CrntCode = NewCode;
+                continue;
+            }
         } else {
-            /* Put it in hash table, output the prefix code, and make our
-             * CrntCode equal to Pixel.
+            /* Form a new unique key to search hash table for the code combines 
+             * CrntCode as Prefix string with Pixel as postfix char.
              */
-            if (EGifCompressOutput(GifFile, CrntCode) == GIF_ERROR) {
-                _GifError = E_GIF_ERR_DISK_IS_FULL;
-                return GIF_ERROR;
+            NewKey = (((UINT32) CrntCode) << 8) + Pixel;
+            HKey = ((NewKey >> 12) ^ NewKey) & HT_KEY_MASK;
+            while ((HTKey = HT_GET_KEY(HTable[HKey])) != 0xFFFFFL) {
+                if (HTKey == NewKey)
+                    break;
+                HKey = (HKey + 1) & HT_KEY_MASK;
+            }
+            if (HTKey == NewKey) {
+                /* This Key is already there, or the string is old one, so
+                 * simple take new code as our CrntCode:
+                 */
+                CrntCode = HT_GET_CODE(HTable[HKey]);
+                continue;
             }
-            CrntCode = Pixel;
+        }
 
-            /* If however the HashTable if full, we send a clear first and
-             * Clear the hash table.
-             */
-            if (Private->RunningCode >= LZ_MAX_CODE) {
-                /* Time to do some clearance: */
-                if (EGifCompressOutput(GifFile, Private->ClearCode)
-                        == GIF_ERROR) {
-                    _GifError = E_GIF_ERR_DISK_IS_FULL;
-                    return GIF_ERROR;
-                }
-                Private->RunningCode = Private->EOFCode + 1;
-                Private->RunningBits = Private->BitsPerPixel + 1;
-                Private->MaxCode1 = 1 << Private->RunningBits;
-                _ClearHashTable(HashTable);
+        /* Put it in the dictionary, output the prefix code, and make our
+         * CrntCode equal to Pixel.
+         */
+        LZ_OUTPUT(CrntCode);
+
+        /* If however the dictionary is full, we send a clear first and
+         * clear the dictionary.
+         */
+        if (RunningCode >= LZ_MAX_CODE) {
+            /* Time to do some clearance: */
+            LZ_OUTPUT(Private->ClearCode);
+            EGifClearDictionary(Private, RunningCode);
+            RunningCode = Private->EOFCode + 1;
+            RunningBits = Private->BitsPerPixel + 1;
+            MaxCode1 = 1 << RunningBits;
+        } else {
+            /* Put this unique key with its relative Code in the dictionary: */
+            if (RunPixel[CrntCode] == Pixel + 1) {
+                RunNext[CrntCode] = (unsigned short)RunningCode;
+                RunPixel[RunningCode] = (unsigned short)(Pixel + 1);
+            }
+            if (Direct) {
+                Direct[(CrntCode << HT_DIRECT_BITS) | Pixel] = (unsigned short)RunningCode;
+                Private->Prefix[RunningCode] = CrntCode;
+                Private->Suffix[RunningCode] = (GifByteType)Pixel;
             } else {
-                /* Put this unique key with its relative Code in hash table: */
-                _InsertHashTable(HashTable, NewKey, Private->RunningCode++);
+                /* HKey is the free slot the lookup above stopped at, unless */
+                /* the lookup was skipped for a run.                          */
+                NewKey = (((UINT32) CrntCode) << 8) + Pixel;
+                if (HKey < 0) {
+                    HKey = ((NewKey >> 12) ^ NewKey) & HT_KEY_MASK;
+                    while (HT_GET_KEY(HTable[HKey]) != 0xFFFFFL)
+                        HKey = (HKey + 1) & HT_KEY_MASK;
+                }
+                HTable[HKey] = HT_PUT_KEY(NewKey) | HT_PUT_CODE(RunningCode);
             }
+            RunningCode++;
         }
-
+        CrntCode = Pixel;
     }
 
-    /* Preserve the current state of the compression algorithm: */
+    /* Dump out full bytes and preserve the current state of the compression
+     * algorithm: */
+    while (ShiftState >= 8) {
+        LZ_OUTPUT_BYTE(ShiftDWord);
+        ShiftDWord >>= 8;
+        ShiftState -= 8;
+    }
+    Private->CrntShiftDWord = (unsigned long)ShiftDWord;
+    Private->CrntShiftState = ShiftState;
+    Private->RunningCode = RunningCode;
+    Private->RunningBits = RunningBits;
+    Private->MaxCode1 = MaxCode1;
     Private->CrntCode = CrntCode;
 
+    if (WriteError) {
+        _GifError = E_GIF_ERR_DISK_IS_FULL;
+        return GIF_ERROR;
+    }
+
     if (Private->PixelCount == 0) {
         /* We are done - output last Code and flush output buffers: */
         if (EGifCompressOutput(GifFile, CrntCode) == GIF_ERROR) {
@@ -910,6 +1040,9 @@ EGifCompressLine(GifFileType * GifFile,
     return GIF_OK;
 }
 
+#undef LZ_OUTPUT
+#undef LZ_OUTPUT_BYTE
+
 /******************************************************************************
  * The LZ compression output routine:
  * This routine is responsible for the compression of the bit stream into
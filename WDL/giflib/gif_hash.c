@@ -65,6 +65,7 @@ GifHashTableType *_InitHashTable(void)
 	return NULL;
 
     _ClearHashTable(HashTable);
+    HashTable -> Direct = NULL;
 
     return HashTable;
 }
@@ -40,8 +40,20 @@
 
 typedef struct GifHashTableType {
     UINT32 HTable[HT_SIZE];
+
+    /* Shortcut for solid spans: if the string of a code is a run of a single */
+    /* pixel value, RunPixel[code] is that value + 1 and RunNext[code] is the */
+    /* code of the run one pixel longer (0 if not in the dictionary yet).     */
+    unsigned short RunNext[HT_MAX_CODE + 1];
+    unsigned short RunPixel[HT_MAX_CODE + 1];
+
+    /* Direct-indexed dictionary used instead of HTable for small code sizes: */
+    /* Direct[(Prefix << HT_DIRECT_BITS) | Pixel] is the code, or 0 if none.  */
+    unsigned short *Direct;
 } GifHashTableType;
 
+#define HT_DIRECT_BITS		4	/* pixel bits covered by Direct (64K entries) */
+
 GifHashTableType *_InitHashTable(void);
 void _ClearHashTable(GifHashTableType *HashTable);
 void _InsertHashTable(GifHashTableType *HashTable, UINT32 Key, int Code);
@@ -2887,6 +2887,144 @@ void LICE_HalveBlitAA(LICE_IBitmap *dest, LICE_IBitmap *src)
 
 #endif // LICE_NO_MISC_SUPPORT
 
+// row scanners for LICE_BitmapCmpEx. the vector loops only skip over blocks of equal pixels,
+// the scalar loop that follows always finds the exact position, so results match the plain C version.
+#if defined(__AVX2__)
+  #include <immintrin.h>
+  #define LICE_CMP_AVX2
+#endif
+#if defined(__SSE2__) || _M_IX86_FP >= 2 || defined(_M_X64)
+  #include <emmintrin.h>
+  #define LICE_CMP_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define LICE_CMP_NEON
+#endif
+
+// returns the first x in [0,n) where the pixels differ, or n
+static int LICE_CmpRowFirst(const LICE_pixel *a, const LICE_pixel *b, int n, LICE_pixel mask)
+{
+  int x=0;
+#ifdef LICE_CMP_AVX2
+  const __m256i m8 = _mm256_set1_epi32((int)mask);
+  for (; x+8 <= n; x+=8)
+  {
+    const __m256i d = _mm256_and_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a+x)),
+                                                        _mm256_loadu_si256((const __m256i *)(b+x))),m8);
+    if (!_mm256_testz_si256(d,d)) break;
+  }
+#endif
+#if defined(LICE_CMP_SSE2)
+  const __m128i m4 = _mm_set1_epi32((int)mask), z = _mm_setzero_si128();
+  for (; x+4 <= n; x+=4)
+  {
+    const __m128i d = _mm_and_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(a+x)),
+                                                  _mm_loadu_si128((const __m128i *)(b+x))),m4);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(d,z)) != 0xffff) break;
+  }
+#elif defined(LICE_CMP_NEON)
+  const uint32x4_t m4 = vdupq_n_u32(mask);
+  for (; x+4 <= n; x+=4)
+  {
+    const uint32x4_t d = vandq_u32(veorq_u32(vld1q_u32((const uint32_t *)(a+x)),vld1q_u32((const uint32_t *)(b+x))),m4);
+    const uint32x2_t r = vorr_u32(vget_low_u32(d),vget_high_u32(d));
+    if (vget_lane_u32(vpmax_u32(r,r),0)) break;
+  }
+#endif
+  while (x < n && !((a[x]^b[x])&mask)) x++;
+  return x;
+}
+
+// returns the last x in (lo,n) where the pixels differ, or lo
+static int LICE_CmpRowLast(const LICE_pixel *a, const LICE_pixel *b, int lo, int n, LICE_pixel mask)
+{
+  int x=n; // [x,n) are known to match
+#ifdef LICE_CMP_AVX2
+  const __m256i m8 = _mm256_set1_epi32((int)mask);
+  for (; x-8 > lo; x-=8)
+  {
+    const __m256i d = _mm256_and_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a+x-8)),
+                                                        _mm256_loadu_si256((const __m256i *)(b+x-8))),m8);
+    if (!_mm256_testz_si256(d,d)) break;
+  }
+#endif
+#if defined(LICE_CMP_SSE2)
+  const __m128i m4 = _mm_set1_epi32((int)mask), z = _mm_setzero_si128();
+  for (; x-4 > lo; x-=4)
+  {
+    const __m128i d = _mm_and_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(a+x-4)),
+                                                  _mm_loadu_si128((const __m128i *)(b+x-4))),m4);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(d,z)) != 0xffff) break;
+  }
+#elif defined(LICE_CMP_NEON)
+  const uint32x4_t m4 = vdupq_n_u32(mask);
+  for (; x-4 > lo; x-=4)
+  {
+    const uint32x4_t d = vandq_u32(veorq_u32(vld1q_u32((const uint32_t *)(a+x-4)),vld1q_u32((const uint32_t *)(b+x-4))),m4);
+    const uint32x2_t r = vorr_u32(vget_low_u32(d),vget_high_u32(d));
+    if (vget_lane_u32(vpmax_u32(r,r),0)) break;
+  }
+#endif
+  while (--x > lo && !((a[x]^b[x])&mask));
+  return x;
+}
+
+// counts the pixels in [0,n) that differ, and sets *first/*last to the first/last of them (unchanged if none).
+// the vector loops only look at the lanes of blocks that have differences
+static int LICE_CmpRowCount(const LICE_pixel *a, const LICE_pixel *b, int n, LICE_pixel mask, int *first, int *last)
+{
+  // lowest/highest set bit and bit count of a nibble
+  static const signed char s_lo[16] = { -1,0,1,0,2,0,1,0,3,0,1,0,2,0,1,0 };
+  static const signed char s_hi[16] = { -1,0,1,1,2,2,2,2,3,3,3,3,3,3,3,3 };
+  static const unsigned char s_cnt[16] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
+  int x=0, cnt=0, lo=-1, hi=-1;
+#if defined(LICE_CMP_SSE2)
+  const __m128i m4 = _mm_set1_epi32((int)mask), z = _mm_setzero_si128();
+  for (; x+4 <= n; x+=4)
+  {
+    const __m128i d = _mm_and_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(a+x)),
+                                                  _mm_loadu_si128((const __m128i *)(b+x))),m4);
+    const int bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(d,z))) ^ 0xf;
+    if (bits)
+    {
+      cnt += s_cnt[bits];
+      if (lo < 0) lo = x + s_lo[bits];
+      hi = x + s_hi[bits];
+    }
+  }
+#elif defined(LICE_CMP_NEON)
+  const uint32x4_t m4 = vdupq_n_u32(mask);
+  for (; x+4 <= n; x+=4)
+  {
+    const uint32x4_t d = vandq_u32(veorq_u32(vld1q_u32((const uint32_t *)(a+x)),vld1q_u32((const uint32_t *)(b+x))),m4);
+    const uint32x2_t r = vorr_u32(vget_low_u32(d),vget_high_u32(d));
+    if (vget_lane_u32(vpmax_u32(r,r),0))
+    {
+      const int bits = (vgetq_lane_u32(d,0) ? 1 : 0) | (vgetq_lane_u32(d,1) ? 2 : 0) |
+                       (vgetq_lane_u32(d,2) ? 4 : 0) | (vgetq_lane_u32(d,3) ? 8 : 0);
+      cnt += s_cnt[bits];
+      if (lo < 0) lo = x + s_lo[bits];
+      hi = x + s_hi[bits];
+    }
+  }
+#endif
+  for (; x < n; x++)
+  {
+    if ((a[x]^b[x])&mask)
+    {
+      cnt++;
+      if (lo < 0) lo = x;
+      hi = x;
+    }
+  }
+  if (cnt)
+  {
+    *first = lo;
+    *last = hi;
+  }
+  return cnt;
+}
+
 int LICE_BitmapCmp(LICE_IBitmap* a, LICE_IBitmap* b, int *coordsOut)
 {
   return LICE_BitmapCmpEx(a,b,LICE_RGBA(255,255,255,255),coordsOut);
@@ -2935,10 +3073,7 @@ int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coo
     else
       for (y=0; y < ah; y ++)
       {
-        const LICE_pixel *ptr1 = px1, *ptr2 = px2;
-        int x=aw;
-        while (x--)
-          if ((*ptr1++ ^ *ptr2++) & mask) return true;
+        if (LICE_CmpRowFirst(px1,px2,aw,mask) < aw) return true;
         px1+=span1;
         px2+=span2;
       }
@@ -2951,7 +3086,7 @@ int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coo
     for (y=0; y < ah; y ++)
     {
       // check left side
-      for (x=0;x<aw && !((px1[x]^px2[x])&mask);x++);
+      x=LICE_CmpRowFirst(px1,px2,aw,mask);
       if (x < aw) break;
 
       px1+=span1;
@@ -2966,8 +3101,7 @@ int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coo
     int miny=y;
     int minx=x;
     // scan right edge of top differing row
-    for (x=aw-1;x>minx && !((px1[x]^px2[x])&mask);x--);
-    int maxx=x;
+    int maxx=LICE_CmpRowLast(px1,px2,minx,aw,mask);
 
     // find last row that differs
     px1+=span1 * (ah-1-y);
@@ -2975,7 +3109,7 @@ int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coo
     for (y = ah-1; y > miny; y --)
     {
       // check left side
-      for (x=0;x<aw && !((px1[x]^px2[x])&mask);x++);
+      x=LICE_CmpRowFirst(px1,px2,aw,mask);
       if (x < aw) 
       {
         if (x < minx) minx=x;
@@ -2989,8 +3123,7 @@ int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coo
     if (y > miny)
     {
       // scan right edge of bottom row that differs
-      for (x=aw-1;x>maxx && !((px1[x]^px2[x])&mask);x--);
-      maxx=x;
+      maxx=LICE_CmpRowLast(px1,px2,maxx,aw,mask);
     }
 
 
@@ -2999,10 +3132,8 @@ int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coo
     px2+=span2 * (miny+1-y);
     for (y=miny+1;y<maxy && (minx>0 || maxx<aw-1);y++) 
     {
-      for (x=0;x<minx && !((px1[x]^px2[x])&mask);x++);
-      minx=x;
-      for (x=aw-1;x>maxx && !((px1[x]^px2[x])&mask);x--);
-      maxx=x;
+      minx=LICE_CmpRowFirst(px1,px2,minx,mask);
+      maxx=LICE_CmpRowLast(px1,px2,maxx,aw,mask);
 
       px1+=span1;
       px2+=span2;
@@ -3019,6 +3150,58 @@ int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coo
   return 0;
 }
 
+int LICE_BitmapCmpCount(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coordsOut)
+{
+  if (!a || !b) return -1;
+  const int aw = a->getWidth(), ah = a->getHeight();
+  if (aw != b->getWidth() || ah != b->getHeight()) return -1;
+
+  const LICE_pixel *px1 = a->getBits();
+  const LICE_pixel *px2 = b->getBits();
+  int span1 = a->getRowSpan();
+  int span2 = b->getRowSpan();
+  if (a->isFlipped())
+  {
+    px1+=span1*(ah-1);
+    span1=-span1;
+  }
+  if (b->isFlipped())
+  {
+    px2+=span2*(ah-1);
+    span2=-span2;
+  }
+
+  int cnt=0, minx=aw, maxx=-1, miny=-1, maxy=-1;
+  for (int y=0; y < ah; y ++)
+  {
+    int first, last;
+    const int c = LICE_CmpRowCount(px1,px2,aw,mask,&first,&last);
+    if (c)
+    {
+      cnt += c;
+      if (miny < 0) miny=y;
+      maxy=y;
+      if (first < minx) minx=first;
+      if (last > maxx) maxx=last;
+    }
+    px1+=span1;
+    px2+=span2;
+  }
+
+  if (coordsOut)
+  {
+    if (!cnt) memset(coordsOut,0,4*sizeof(int));
+    else
+    {
+      coordsOut[0]=minx;
+      coordsOut[1]=miny;
+      coordsOut[2]=maxx-minx+1;
+      coordsOut[3]=maxy-miny+1;
+    }
+  }
+  return cnt;
+}
+
 unsigned short _LICE_RGB2HSV_invtab[256]={ // 65536/idx - 1
   0,      0xffff, 0x7fff, 0x5554, 0x3fff, 0x3332, 0x2aa9, 0x2491,
   0x1fff, 0x1c70, 0x1998, 0x1744, 0x1554, 0x13b0, 0x1248, 0x1110,
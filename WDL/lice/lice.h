@@ -389,6 +389,20 @@ bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, b
 unsigned int LICE_WriteGIFGetSize(void *handle); // gets current output size
 bool LICE_WriteGIFEnd(void *handle);
 int LICE_SetGIFColorMapFromOctree(void *wr, void *octree, int numcolors); // can use after LICE_WriteGIFBeginNoFrame and before LICE_WriteGIFFrame
+// sets the palette for following frames written with perImageColorMap=false, so they skip building one. if isGlobal, it is
+// the global color table (set it before the first frame, and on any memory handles used with this handle), otherwise
+// frames get it as a local color table. tab is from LICE_GeneratePaletteLookupTable(), or NULL to generate it here
+int LICE_SetGIFColorMap(void *wr, const LICE_pixel *palette, int numcolors, bool isGlobal=true, const unsigned char *tab=NULL);
+void LICE_WriteGIFSetThreads(void *wr, int nthreads); // default 1. if >1, large frames are split into bands that are encoded in parallel (output is valid but not byte-identical to 1). 0=number of CPUs
+void LICE_WriteGIFSetPaletteReuse(void *wr, double maxerr); // call before the first frame. if >0, perImageColorMap frames use the first frame's palette as a global color table, and only write a local table when the RMS error per channel of the pixels being written exceeds maxerr
+
+// parallel encoding: a memory handle encodes frames (from any one thread) without writing them, then
+// LICE_WriteGIFFrameFromMem() writes them to a file handle in order. frames written to a memory handle need
+// perImageColorMap=true (or the same LICE_SetGIFColorMap() on both handles), their delay is ignored.
+// close memory handles with LICE_WriteGIFEnd()
+void *LICE_WriteGIFBeginMem(int w, int h, int transparent_alpha=0, bool dither=true);
+void LICE_WriteGIFSetPrevFrame(void *memhandle, LICE_IBitmap *prev); // transparent_alpha=-1: the next frames' unchanged pixels are found against prev (not modified), or none if NULL
+bool LICE_WriteGIFFrameFromMem(void *handle, void *memhandle, int frame_delay=0, int nreps=0); // writes (and clears) the frames encoded by memhandle since the last call
 
 // animated GIF reading
 void *LICE_GIF_LoadEx(const char *filename);
@@ -572,6 +586,8 @@ void LICE_BorderedRect(LICE_IBitmap *dest, int x, int y, int w, int h, LICE_pixe
 // bitmap compare-by-value function
 int LICE_BitmapCmp(LICE_IBitmap* a, LICE_IBitmap* b, int *coordsOut=NULL);
 int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coordsOut=NULL);
+// returns the number of pixels that differ under mask (0 if equal) and their bounding box in coordsOut, in one pass. -1 if the sizes differ
+int LICE_BitmapCmpCount(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coordsOut=NULL);
 
 // colorspace functions
 void LICE_RGB2HSV(int r, int g, int b, int* h, int* s, int* v); // rgb, sv: [0,256), h: [0,384)
@@ -605,10 +621,36 @@ int LICE_BuildOctree(void* octree, LICE_IBitmap* bmp);
 int LICE_BuildOctreeForAlpha(void* octree, LICE_IBitmap* bmp, unsigned int minalpha);
 int LICE_BuildOctreeForDiff(void* octree, LICE_IBitmap* bmp, LICE_IBitmap* refbmp, LICE_pixel mask=LICE_RGBA(255,255,255,0));
 int LICE_FindInOctree(void* octree, LICE_pixel color);
+bool LICE_GenerateOctreeLookupTable(void* octree, unsigned char *tab); // tab[32][32][32] indexed by r>>3,g>>3,b>>3, same results as LICE_FindInOctree() but much faster than calling it per entry
 int LICE_ExtractOctreePalette(void* octree, LICE_pixel* palette);
 
 // wrapper
 int LICE_BuildPalette(LICE_IBitmap* bmp, LICE_pixel* palette, int maxcolors);
+
+// palette engines for LICE_BuildPaletteEx
+#define LICE_PALETTE_OCTREE 0     // same as LICE_BuildOctree*() + LICE_ExtractOctreePalette()
+#define LICE_PALETTE_MEDIANCUT 1  // 15-bit histogram, median cut
+#define LICE_PALETTE_KMEANS 2     // 15-bit histogram, median cut refined with a few k-means passes
+
+// builds up to maxcolors entries into palette, returns the number of entries.
+// if refbmp is set, only pixels that differ from it (under mask) are used, like LICE_BuildOctreeForDiff().
+// if minalpha is nonzero, only pixels with alpha >= minalpha are used, like LICE_BuildOctreeForAlpha().
+// pixcnt receives the number of pixels used. nthreads<=0 uses all CPUs for the histogram.
+int LICE_BuildPaletteEx(LICE_IBitmap* bmp, LICE_pixel* palette, int maxcolors, int mode,
+                        LICE_IBitmap* refbmp=NULL, LICE_pixel mask=LICE_RGBA(255,255,255,0),
+                        unsigned int minalpha=0, int *pixcnt=NULL, int nthreads=1);
+
+// histograms for building one palette from many images (or parts of images), such as all frames of an animation.
+// LICE_AddToPaletteHistogram() takes the same filters as LICE_BuildPaletteEx() and returns the number of pixels
+// counted. counts are scaled down as needed to avoid overflow. mode is LICE_PALETTE_MEDIANCUT or LICE_PALETTE_KMEANS
+void *LICE_CreatePaletteHistogram();
+void LICE_DestroyPaletteHistogram(void *hist);
+void LICE_ResetPaletteHistogram(void *hist);
+int LICE_AddToPaletteHistogram(void *hist, LICE_IBitmap* bmp, LICE_IBitmap* refbmp=NULL, LICE_pixel mask=LICE_RGBA(255,255,255,0),
+                               unsigned int minalpha=0, int nthreads=1);
+void LICE_MergePaletteHistogram(void *dest, void *src); // adds src to dest
+int LICE_BuildPaletteFromHistogram(void *hist, LICE_pixel* palette, int maxcolors, int mode);
+void LICE_GeneratePaletteLookupTable(const LICE_pixel* palette, int numcolors, unsigned char *tab); // tab[32][32][32] of nearest entries, like LICE_GenerateOctreeLookupTable()
 void LICE_TestPalette(LICE_IBitmap* bmp, LICE_pixel* palette, int numcolors);
 
 
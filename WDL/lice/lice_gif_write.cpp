@@ -11,6 +11,9 @@
 
 #include "../wdltypes.h"
 #include "../filewrite.h"
+#include "../heapbuf.h"
+#include "../queue.h"
+#include "lice_parallel.h"
 
 extern "C" {
 
@@ -23,21 +26,33 @@ struct liceGifWriteRec
 {
   GifFileType *f;
   WDL_FileWrite *fh;
+  WDL_Queue *membuf; // LICE_WriteGIFBeginMem(): encoded frames are kept here, fh is NULL
+  LICE_IBitmap *mem_prevframe; // LICE_WriteGIFSetPrevFrame(), not owned
+  int mem_trans_pix; // transparent index of the frames in membuf, -1 if none
   ColorMapObject *cmap;
   GifPixelType *linebuf;
   LICE_IBitmap *prevframe; // used when multiframe, transalpha<0
   void *last_octree;
   LICE_pixel last_palette[256];
+  int last_palette_sz;
   unsigned char from15to8bit[32][32][32];//r,g,b
 
+  // palette reuse (LICE_WriteGIFSetPaletteReuse)
+  double palette_reuse_err; // max mean squared error per channel, 0=disabled
+  LICE_pixel global_palette[256];
+  int global_palette_sz, global_cmap_bits;
+  unsigned char global_from15to8bit[32][32][32];
+  bool has_local_palette; // last_palette/from15to8bit/cmap hold a local palette that can be reused
+
   int transalpha;
   int w,h;
+  int encode_threads; // >1: large frames are split into bands that are quantized/compressed in parallel
   bool append;
   bool dither;
   bool has_had_frame;
   bool has_global_cmap; 
 
-  bool has_from15to8bit; // set when last_octree has been generated into from15to8bit
+  bool has_from15to8bit; // set when from15to8bit is valid for the current palette
 };
 
 static inline GifPixelType QuantPixel(LICE_pixel p, liceGifWriteRec *wr)
@@ -45,6 +60,338 @@ static inline GifPixelType QuantPixel(LICE_pixel p, liceGifWriteRec *wr)
   return wr->from15to8bit[LICE_GETR(p)>>3][LICE_GETG(p)>>3][LICE_GETB(p)>>3];
 }
 
+#define GIF_BAND_MINROWS 16
+#define GIF_BAND_MINPIXELS 32768
+
+// state carried from pixel to pixel (and row to row) while quantizing an image (or band)
+struct gifQuantState
+{
+  LICE_pixel last_pixel_rgb;
+  GifPixelType last_pixel_idx;
+  GifPixelType transparent_pix;
+  int pix_stats[256];
+
+  void init(const liceGifWriteRec *wr, GifPixelType trans_pix)
+  {
+    last_pixel_rgb=0;
+    last_pixel_idx=transparent_pix=trans_pix;
+    if (wr->transalpha&0x100) memset(pix_stats,0,sizeof(pix_stats));
+    pix_stats[trans_pix] = -8;
+  }
+};
+
+// quantizes row y of frame into linebuf. if prev is set, pixels that are unchanged from prev are made transparent
+static void QuantizeRow(liceGifWriteRec *wr, LICE_IBitmap *frame, LICE_IBitmap *prev, bool ignFr, int usew, int y,
+                        void *use_octree, gifQuantState *st, GifPixelType *linebuf)
+{
+  int rdy=y;
+  if (frame->isFlipped()) rdy = frame->getHeight()-1-y;
+  const LICE_pixel *in = frame->getBits() + rdy*frame->getRowSpan();
+  const GifPixelType transparent_pix = st->transparent_pix;
+  int x;
+
+  if (prev)
+  {
+    const int trans_chan_mask = wr->transalpha&0xff;
+    const LICE_pixel trans_mask = LICE_RGBA(trans_chan_mask,trans_chan_mask,trans_chan_mask,0);
+
+    int rdy2=y;
+    if (prev->isFlipped()) rdy2 = prev->getHeight()-1-y;
+    const LICE_pixel *in2 = prev->getBits() + rdy2*prev->getRowSpan();
+
+    LICE_pixel last_pixel_rgb = st->last_pixel_rgb;
+    GifPixelType last_pixel_idx = st->last_pixel_idx;
+
+    if (wr->transalpha&0x100)
+    {
+      int *pix_stats = st->pix_stats;
+      if (use_octree) for(x=0;x<usew;x++)
+      {
+        const LICE_pixel p = in[x]&trans_mask;
+        if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
+        {
+          if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = LICE_FindInOctree(use_octree,p);
+          else 
+          {
+            const GifPixelType np = LICE_FindInOctree(use_octree,p);
+            if (p != (wr->last_palette[np]&trans_mask) || pix_stats[transparent_pix] > pix_stats[np])
+              last_pixel_idx = transparent_pix;
+            else 
+              last_pixel_idx = np;
+          }
+        }
+        linebuf[x] = last_pixel_idx;
+        pix_stats[last_pixel_idx]++;
+        last_pixel_rgb = p;
+      }
+      else for(x=0;x<usew;x++)
+      {
+        const LICE_pixel p = in[x]&trans_mask;
+        if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
+        {
+          if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = QuantPixel(p,wr);
+          else 
+          {
+            const GifPixelType np = QuantPixel(p,wr);
+
+            if (p != (wr->last_palette[np]&trans_mask) || pix_stats[transparent_pix] > pix_stats[np])
+              last_pixel_idx = transparent_pix;
+            else 
+              last_pixel_idx = np;
+          }
+        }
+        linebuf[x] = last_pixel_idx;
+        pix_stats[last_pixel_idx]++;
+        last_pixel_rgb = p;
+      }
+    }
+    else
+    {
+      // optimize solids by reusing the same value if previous rgb was the same, also avoid switching between
+      // from color to transparent if the color hasn't changed
+      if (use_octree) for(x=0;x<usew;x++)
+      {
+        const LICE_pixel p = in[x]&trans_mask;
+        if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
+        {
+          if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = LICE_FindInOctree(use_octree,last_pixel_rgb = p);
+          else last_pixel_idx = transparent_pix;
+        }
+        linebuf[x] = last_pixel_idx;
+      }
+      else for(x=0;x<usew;x++)
+      {
+        const LICE_pixel p = in[x]&trans_mask;
+        if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
+        {
+          if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = QuantPixel(last_pixel_rgb = p,wr);
+          else last_pixel_idx = transparent_pix;
+        }
+        linebuf[x] = last_pixel_idx;
+      }
+    }
+    st->last_pixel_rgb = last_pixel_rgb;
+    st->last_pixel_idx = last_pixel_idx;
+  }
+  else if (wr->transalpha>0)
+  {
+    const unsigned int al = wr->transalpha&0xff;
+    if (use_octree) for(x=0;x<usew;x++)
+    {
+      const LICE_pixel p = in[x];
+      if (LICE_GETA(p)<al) linebuf[x]=transparent_pix;
+      else linebuf[x] = LICE_FindInOctree(use_octree,p);
+    }
+    else for(x=0;x<usew;x++)
+    {
+      const LICE_pixel p = in[x];
+      if (LICE_GETA(p)<al) linebuf[x]=transparent_pix;
+      else linebuf[x] = QuantPixel(p,wr);
+    }
+  }
+  else
+  {
+    if (use_octree) for(x=0;x<usew;x++) linebuf[x] = LICE_FindInOctree(use_octree,in[x]);
+    else for(x=0;x<usew;x++) linebuf[x] = QuantPixel(in[x],wr);
+  }
+}
+
+
+// LZW-compresses one band of an image into a packed (LSB first) code stream, using the same
+// code sequence as giflib's EGifCompressLine(). The first band begins with a clear code, the
+// last band ends with the EOF code, and every other band ends with a clear code so that the
+// next band can start with an empty dictionary. This lets bands be compressed independently
+// and then concatenated at bit granularity into a single valid image.
+#define GIF_LZW_MAX_CODE 4095
+#define GIF_LZW_HSIZE 8192 // must be power of two, >= 2*GIF_LZW_MAX_CODE
+
+static int LZWCompressBand(const GifPixelType *pix, int npix, int codesize, bool isFirst, bool isLast, WDL_TypedBuf<unsigned char> *out)
+{
+  unsigned int htab[GIF_LZW_HSIZE]; // (key<<12)|code, or ~0 if empty. key is (prefix_code<<8)|pixel
+  memset(htab,0xff,sizeof(htab));
+
+  const int clear_code = 1<<codesize, eof_code = clear_code+1;
+  const GifPixelType mask = (GifPixelType)(clear_code-1);
+  int running_code = eof_code+1, running_bits = codesize+1, max_code1 = 1<<running_bits;
+
+  // worst case is one code per pixel, plus clear/eof
+  unsigned char *wrptr = out->Resize(((npix+4)*12)/8+4,false);
+  if (!wrptr) return 0;
+  unsigned char *wrstart = wrptr;
+  unsigned int acc=0;
+  int acc_bits=0;
+
+#define LZW_OUTPUT(code) do { \
+    acc |= ((unsigned int)(code)) << acc_bits; \
+    acc_bits += running_bits; \
+    while (acc_bits >= 8) { *wrptr++ = (unsigned char)acc; acc >>= 8; acc_bits -= 8; } \
+    if (running_code >= max_code1) max_code1 = 1 << ++running_bits; \
+  } while (0)
+
+  if (isFirst) LZW_OUTPUT(clear_code);
+
+  int crnt = npix > 0 ? (pix[0]&mask) : 0;
+  int i;
+  for (i = 1; i < npix; i ++)
+  {
+    const int p = pix[i]&mask;
+    const unsigned int key = (((unsigned int)crnt)<<8) | p;
+    unsigned int hidx = ((key >> 12) ^ key) & (GIF_LZW_HSIZE-1);
+    int found=-1;
+    for (;;)
+    {
+      const unsigned int e = htab[hidx];
+      if (e == ~0u) break;
+      if ((e>>12) == key) { found = e&0xfff; break; }
+      hidx = (hidx+1) & (GIF_LZW_HSIZE-1);
+    }
+    if (found >= 0)
+    {
+      crnt = found;
+    }
+    else
+    {
+      LZW_OUTPUT(crnt);
+      crnt = p;
+      if (running_code >= GIF_LZW_MAX_CODE)
+      {
+        LZW_OUTPUT(clear_code);
+        running_code = eof_code+1;
+        running_bits = codesize+1;
+        max_code1 = 1<<running_bits;
+        memset(htab,0xff,sizeof(htab));
+      }
+      else
+      {
+        htab[hidx] = (key<<12) | (unsigned int)running_code++;
+      }
+    }
+  }
+
+  if (npix > 0) LZW_OUTPUT(crnt);
+  LZW_OUTPUT(isLast ? eof_code : clear_code);
+
+#undef LZW_OUTPUT
+
+  const int nbits = (int)(wrptr-wrstart)*8 + acc_bits;
+  if (acc_bits > 0) *wrptr++ = (unsigned char)acc;
+  return nbits;
+}
+
+
+struct gifBandEncoder
+{
+  liceGifWriteRec *wr;
+  LICE_IBitmap *frame, *prev;
+  bool ignFr;
+  int usew, useh, nbands, codesize;
+  void *use_octree;
+  GifPixelType transparent_pix;
+
+  struct bandRec
+  {
+    WDL_TypedBuf<GifPixelType> pix;
+    WDL_TypedBuf<unsigned char> codes;
+    int nbits;
+  } *bands;
+
+  static void encodeBand(void *ctx, int idx)
+  {
+    gifBandEncoder *_this = (gifBandEncoder *)ctx;
+    bandRec *band = _this->bands+idx;
+    const int y0 = (_this->useh * idx) / _this->nbands;
+    const int y1 = (_this->useh * (idx+1)) / _this->nbands;
+    const int usew = _this->usew;
+
+    band->nbits = 0;
+    GifPixelType *pix = band->pix.Resize(usew*(y1-y0),false);
+    if (!pix) return;
+
+    gifQuantState st;
+    st.init(_this->wr,_this->transparent_pix);
+    int y;
+    for (y = y0; y < y1; y ++)
+    {
+      QuantizeRow(_this->wr,_this->frame,_this->prev,_this->ignFr,usew,y,_this->use_octree,&st,pix);
+      pix += usew;
+    }
+
+    band->nbits = LZWCompressBand(band->pix.Get(),usew*(y1-y0),_this->codesize,idx==0,idx==_this->nbands-1,&band->codes);
+  }
+};
+
+// splits the image into horizontal bands, quantizes and compresses them in parallel, and writes
+// the concatenated code stream as the image data (must be called after EGifPutImageDesc())
+static void WriteFrameBands(liceGifWriteRec *wr, LICE_IBitmap *frame, LICE_IBitmap *prev, bool ignFr, int usew, int useh,
+                            void *use_octree, GifPixelType transparent_pix, int nbands)
+{
+  // match EGifSetupCompress()
+  const ColorMapObject *cm = wr->f->Image.ColorMap ? wr->f->Image.ColorMap : wr->f->SColorMap;
+  int codesize = cm ? cm->BitsPerPixel : 8;
+  if (codesize < 2) codesize = 2;
+
+  gifBandEncoder enc;
+  enc.wr = wr;
+  enc.frame = frame;
+  enc.prev = prev;
+  enc.ignFr = ignFr;
+  enc.usew = usew;
+  enc.useh = useh;
+  enc.nbands = nbands;
+  enc.codesize = codesize;
+  enc.use_octree = use_octree;
+  enc.transparent_pix = transparent_pix;
+  enc.bands = new gifBandEncoder::bandRec[nbands];
+
+  LICE_RunParallel(nbands,gifBandEncoder::encodeBand,&enc,wr->encode_threads);
+
+  // concatenate the band bitstreams and write them out in 255-byte sub-blocks
+  GifByteType block[256];
+  block[0]=0;
+  unsigned int acc=0;
+  int acc_bits=0;
+
+#define GIF_BLOCK_ADD(c) do { \
+    block[++block[0]] = (GifByteType)(c); \
+    if (block[0] == 255) { EGifPutCodeNext(wr->f,block); block[0]=0; } \
+  } while (0)
+
+  int b;
+  for (b = 0; b < nbands; b ++)
+  {
+    const unsigned char *rd = enc.bands[b].codes.Get();
+    const int nbits = enc.bands[b].nbits;
+    int i;
+    if (!acc_bits) for (i = 0; i < nbits/8; i ++) GIF_BLOCK_ADD(rd[i]);
+    else for (i = 0; i < nbits/8; i ++)
+    {
+      acc |= ((unsigned int)rd[i]) << acc_bits;
+      GIF_BLOCK_ADD(acc&0xff);
+      acc >>= 8;
+    }
+    const int rem = nbits&7;
+    if (rem)
+    {
+      acc |= ((unsigned int)(rd[nbits/8] & ((1<<rem)-1))) << acc_bits;
+      acc_bits += rem;
+      if (acc_bits >= 8)
+      {
+        GIF_BLOCK_ADD(acc&0xff);
+        acc >>= 8;
+        acc_bits -= 8;
+      }
+    }
+  }
+  if (acc_bits > 0) GIF_BLOCK_ADD(acc&0xff);
+
+#undef GIF_BLOCK_ADD
+
+  if (block[0]) EGifPutCodeNext(wr->f,block);
+  EGifPutCodeNext(wr->f,NULL);
+
+  delete [] enc.bands;
+}
+
 static int generate_palette_from_octree(void *ww, void *octree, int numcolors)
 {
   liceGifWriteRec  *wr = (liceGifWriteRec *)ww;
@@ -57,8 +404,16 @@ static int generate_palette_from_octree(void *ww, void *octree, int numcolors)
   // store palette
   {
     LICE_pixel* palette=wr->last_palette;
+    LICE_pixel oldpal[256];
+    const int oldpal_sz = wr->has_from15to8bit ? wr->last_palette_sz : -1;
+    if (oldpal_sz > 0) memcpy(oldpal,palette,oldpal_sz*sizeof(LICE_pixel));
 
     palette_sz = LICE_ExtractOctreePalette(octree, palette);
+    wr->last_palette_sz = palette_sz;
+
+    // same colors as the previous frame (common when content is static), keep using its table
+    if (palette_sz != oldpal_sz || memcmp(oldpal,palette,palette_sz*sizeof(LICE_pixel)))
+      wr->has_from15to8bit = false;
 
     int i;
     for (i = 0; i < palette_sz; ++i)
@@ -73,7 +428,6 @@ static int generate_palette_from_octree(void *ww, void *octree, int numcolors)
     }
   }
 
-  wr->has_from15to8bit = false;
   wr->has_global_cmap=true;
 
   return palette_sz;
@@ -85,22 +439,43 @@ static void generate15to8(void *ww, void *octree)
   if (!octree||!ww) return;
 
   // map palette to 16 bit
-  unsigned char r,g,b;
-  for(r=0;r<32;r++)  
+  wr->has_from15to8bit = LICE_GenerateOctreeLookupTable(octree, &wr->from15to8bit[0][0][0]);
+}
+
+// mean squared error per channel of quantizing the pixels of frame that would be written (not
+// transparent) with pal/tab. returns 0 if no pixels would be written
+static double palette_error(const liceGifWriteRec *wr, LICE_IBitmap *frame, LICE_IBitmap *prev, int usew, int useh,
+                            const LICE_pixel *pal, const unsigned char (*tab)[32][32])
+{
+  const int trans_chan_mask = wr->transalpha&0xff;
+  const LICE_pixel trans_mask = prev ? LICE_RGBA(trans_chan_mask,trans_chan_mask,trans_chan_mask,0) : LICE_RGBA(255,255,255,0);
+  const unsigned int al = wr->transalpha>0 ? (wr->transalpha&0xff) : 0;
+  WDL_INT64 err=0, cnt=0;
+  int x,y;
+  for (y=0;y<useh;y++)
   {
-    unsigned char cr = r<<3;
-    for (g=0;g<32;g++)
+    const LICE_pixel *in = frame->getBits() + (frame->isFlipped() ? frame->getHeight()-1-y : y)*frame->getRowSpan();
+    const LICE_pixel *in2 = prev ? prev->getBits() + (prev->isFlipped() ? prev->getHeight()-1-y : y)*prev->getRowSpan() : NULL;
+    LICE_pixel last=0;
+    int lasterr=-1;
+    for (x=0;x<usew;x++)
     {
-      unsigned char cg = g<<3;
-      for (b=0;b<32;b++)
+      const LICE_pixel p = in[x]&trans_mask;
+      if (in2 && p == (in2[x]&trans_mask)) continue;
+      if (al && LICE_GETA(in[x]) < al) continue;
+      if (lasterr<0 || p != last)
       {
-        unsigned char cb = b<<3;
-        LICE_pixel col = LICE_RGBA(cr,cg,cb,0);
-        wr->from15to8bit[r][g][b] = LICE_FindInOctree(octree, col);
+        const unsigned int r=LICE_GETR(p), g=LICE_GETG(p), b=LICE_GETB(p);
+        const LICE_pixel q = pal[tab[r>>3][g>>3][b>>3]];
+        const int dr = (int)r-(int)LICE_GETR(q), dg = (int)g-(int)LICE_GETG(q), db = (int)b-(int)LICE_GETB(q);
+        lasterr = dr*dr+dg*dg+db*db;
+        last = p;
       }
+      err += lasterr;
+      cnt++;
     }
   }
-  wr->has_from15to8bit=true;
+  return cnt ? (double)err / (3.0*(double)cnt) : 0.0;
 }
 
 int LICE_SetGIFColorMapFromOctree(void *ww, void *octree, int numcolors)
@@ -110,6 +485,62 @@ int LICE_SetGIFColorMapFromOctree(void *ww, void *octree, int numcolors)
   return rv;
 }
 
+int LICE_SetGIFColorMap(void *ww, const LICE_pixel *palette, int numcolors, bool isGlobal, const unsigned char *tab)
+{
+  liceGifWriteRec *wr = (liceGifWriteRec *)ww;
+  if (!wr || !palette || numcolors < 1) return 0;
+  if (isGlobal && wr->has_had_frame && !wr->membuf) return 0; // the global table has been written
+
+  const int ccnt = 256 - (wr->transalpha?1:0);
+  if (numcolors > ccnt) numcolors = ccnt;
+  memcpy(wr->last_palette,palette,numcolors*sizeof(LICE_pixel));
+  wr->last_palette_sz = numcolors;
+
+  ColorMapObject *cmap = wr->cmap;
+  int i;
+  for (i = 0; i < 256; ++i)
+  {
+    const LICE_pixel c = i < numcolors ? palette[i] : 0;
+    cmap->Colors[i].Red = LICE_GETR(c);
+    cmap->Colors[i].Green = LICE_GETG(c);
+    cmap->Colors[i].Blue = LICE_GETB(c);
+  }
+  const int pcnt = numcolors + (wr->transalpha && numcolors < 256 ? 1 : 0);
+  int nb = 1;
+  while (nb < 8 && (1<<nb) < pcnt) nb++;
+  cmap->ColorCount = 1<<nb;
+  cmap->BitsPerPixel = nb;
+
+  if (tab) memcpy(wr->from15to8bit,tab,sizeof(wr->from15to8bit));
+  else LICE_GeneratePaletteLookupTable(palette,numcolors,&wr->from15to8bit[0][0][0]);
+  wr->has_from15to8bit = true;
+  wr->has_global_cmap = isGlobal;
+  wr->has_local_palette = false;
+
+  if (isGlobal && wr->membuf)
+  {
+    // memory handles have no screen descriptor, but giflib needs the global table's size to encode images
+    if (wr->f->SColorMap) FreeMapObject(wr->f->SColorMap);
+    wr->f->SColorMap = MakeMapObject(cmap->ColorCount,cmap->Colors);
+  }
+  return numcolors;
+}
+
+void LICE_WriteGIFSetPaletteReuse(void *handle, double maxerr)
+{
+  liceGifWriteRec *wr = (liceGifWriteRec*)handle;
+  if (!wr || wr->has_had_frame || wr->append) return; // an appended file's global palette is unknown
+  wr->palette_reuse_err = maxerr > 0.0 ? maxerr*maxerr : 0.0;
+}
+
+void LICE_WriteGIFSetThreads(void *handle, int nthreads)
+{
+  liceGifWriteRec *wr = (liceGifWriteRec*)handle;
+  if (!wr) return;
+  if (nthreads <= 0) nthreads = LICE_GetNumCPUs();
+  wr->encode_threads = nthreads;
+}
+
 unsigned int LICE_WriteGIFGetSize(void *handle)
 {
   if (handle)
@@ -120,10 +551,38 @@ unsigned int LICE_WriteGIFGetSize(void *handle)
   return 0;
 }
 
+// loop count (first frame only) and graphic control extensions that precede an image
+static void write_frame_extensions(liceGifWriteRec *wr, bool isFirst, int frame_delay, int nreps, bool has_trans, unsigned char transparent_pix)
+{
+  unsigned char gce[4] = { 0, };
+  if (has_trans)
+  {
+    gce[0] |= 1;
+    gce[3] = transparent_pix;
+  }
+
+  int a = frame_delay/10;
+  if(a<1&&frame_delay)a=1;
+  else if (a>60000) a=60000;
+  gce[1]=(a)&255;
+  gce[2]=(a)>>8;
+
+  if (isFirst && frame_delay && nreps!=1 && !wr->append)
+  {
+    int nr = nreps > 1 && nreps <= 65536 ? nreps-1 : 0;
+    unsigned char ext[]={0xB, 'N','E','T','S','C','A','P','E','2','.','0',3,1,(unsigned char) (nr&0xff), (unsigned char) ((nr>>8)&0xff)};
+    EGifPutExtension(wr->f,0xFF, sizeof(ext),ext);
+  }
+
+  if (gce[0]||gce[1]||gce[2])
+    EGifPutExtension(wr->f, 0xF9, sizeof(gce), gce);
+}
+
 bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, bool perImageColorMap, int frame_delay, int nreps)
 {
   liceGifWriteRec *wr = (liceGifWriteRec*)handle;
   if (!wr) return false;
+  if (wr->membuf) frame_delay=0; // LICE_WriteGIFFrameFromMem() writes the delay
 
   bool isFirst=false;
   if (!wr->has_had_frame)
@@ -131,7 +590,7 @@ bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, b
     wr->has_had_frame=true;
     isFirst=true;
 
-    if (!perImageColorMap && !wr->has_global_cmap)
+    if ((!perImageColorMap || wr->palette_reuse_err > 0.0) && !wr->has_global_cmap && !wr->has_from15to8bit)
     {
       const int ccnt = 256 - (wr->transalpha?1:0);
       void* octree = wr->last_octree;
@@ -149,6 +608,16 @@ bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, b
         while (nb < 8 && (1<<nb) < pcnt) nb++;
         wr->cmap->ColorCount = 1<<nb;
         wr->cmap->BitsPerPixel=nb;
+
+        if (perImageColorMap)
+        {
+          // keep the global palette and its lookup table for later frames to test against
+          generate15to8(wr,octree);
+          memcpy(wr->global_palette,wr->last_palette,sizeof(wr->global_palette));
+          wr->global_palette_sz = wr->last_palette_sz;
+          wr->global_cmap_bits = nb;
+          memcpy(wr->global_from15to8bit,wr->from15to8bit,sizeof(wr->global_from15to8bit));
+        }
       }
     }
 
@@ -167,6 +636,40 @@ bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, b
   const LICE_pixel trans_mask = LICE_RGBA(trans_chan_mask,trans_chan_mask,trans_chan_mask,0);
   const bool advanced_trans_stats = !!(wr->transalpha&0x100);
 
+  bool reuse_build_local=false;
+  if (perImageColorMap && wr->palette_reuse_err > 0.0 && !isFirst && wr->global_palette_sz > 0)
+  {
+    LICE_SubBitmap tmpprev(wr->prevframe, xpos, ypos, usew, useh);
+    LICE_IBitmap *prev = wr->transalpha<0 && wr->prevframe ? &tmpprev : NULL;
+
+    perImageColorMap=false;
+    if (palette_error(wr,frame,prev,usew,useh,wr->global_palette,wr->global_from15to8bit) <= wr->palette_reuse_err)
+    {
+      // no local color table
+      if (!wr->has_global_cmap)
+      {
+        memcpy(wr->last_palette,wr->global_palette,sizeof(wr->last_palette));
+        wr->last_palette_sz = wr->global_palette_sz;
+        memcpy(wr->from15to8bit,wr->global_from15to8bit,sizeof(wr->from15to8bit));
+        wr->has_from15to8bit = true;
+        wr->cmap->ColorCount = 1<<wr->global_cmap_bits;
+        wr->cmap->BitsPerPixel = wr->global_cmap_bits;
+        wr->has_global_cmap = true;
+        wr->has_local_palette = false;
+      }
+    }
+    else
+    {
+      wr->has_global_cmap = false;
+      // if the previous local palette is still good enough, write it again without rebuilding it
+      if (!wr->has_local_palette ||
+          palette_error(wr,frame,prev,usew,useh,wr->last_palette,wr->from15to8bit) > wr->palette_reuse_err)
+      {
+        perImageColorMap = reuse_build_local = true;
+      }
+    }
+  }
+
   if (perImageColorMap && !wr->has_global_cmap)
   {
     const int ccnt = 256 - (wr->transalpha?1:0);
@@ -175,9 +678,10 @@ bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, b
     else LICE_ResetOctree(octree,ccnt);
     if (octree) 
     {
-      if ((!isFirst || frame_delay) && wr->transalpha<0 && wr->prevframe)
+      LICE_IBitmap *prevframe = wr->membuf ? wr->mem_prevframe : (!isFirst || frame_delay) ? wr->prevframe : NULL;
+      if (wr->transalpha<0 && prevframe)
       {
-        LICE_SubBitmap tmpprev(wr->prevframe, xpos, ypos, usew, useh);
+        LICE_SubBitmap tmpprev(prevframe, xpos, ypos, usew, useh);
         int pc=LICE_BuildOctreeForDiff(octree,frame,&tmpprev,trans_mask);
         if (!advanced_trans_stats) pixcnt = pc;
       }
@@ -195,6 +699,13 @@ bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, b
       while (nb < 8 && (1<<nb) < pcnt) nb++;
       wr->cmap->ColorCount = 1<<nb;
       wr->cmap->BitsPerPixel=nb;
+
+      if (reuse_build_local)
+      {
+        // later frames are tested against this palette's table
+        if (!wr->has_from15to8bit) generate15to8(wr,octree);
+        wr->has_local_palette = wr->has_from15to8bit;
+      }
     }
   }
 
@@ -204,174 +715,50 @@ bool LICE_WriteGIFFrame(void *handle, LICE_IBitmap *frame, int xpos, int ypos, b
   }
 
   const unsigned char transparent_pix = wr->cmap->ColorCount-1;
-  unsigned char gce[4] = { 0, };
-  if (wr->transalpha)
-  {
-    gce[0] |= 1;
-    gce[3] = transparent_pix;
-  }
-
-  int a = frame_delay/10;
-  if(a<1&&frame_delay)a=1;
-  else if (a>60000) a=60000;
-  gce[1]=(a)&255;
-  gce[2]=(a)>>8;
-
-  if (isFirst && frame_delay && nreps!=1 && !wr->append)
-  {
-    int nr = nreps > 1 && nreps <= 65536 ? nreps-1 : 0;
-    unsigned char ext[]={0xB, 'N','E','T','S','C','A','P','E','2','.','0',3,1,(unsigned char) (nr&0xff), (unsigned char) ((nr>>8)&0xff)};
-    EGifPutExtension(wr->f,0xFF, sizeof(ext),ext);
-  }
-
-  if (gce[0]||gce[1]||gce[2])
-    EGifPutExtension(wr->f, 0xF9, sizeof(gce), gce);
-
+  if (wr->membuf) wr->mem_trans_pix = wr->transalpha ? transparent_pix : -1; // LICE_WriteGIFFrameFromMem() writes the extensions
+  else write_frame_extensions(wr,isFirst,frame_delay,nreps,wr->transalpha != 0,transparent_pix);
 
   EGifPutImageDesc(wr->f, xpos, ypos, usew,useh, 0, wr->has_global_cmap ? NULL : wr->cmap); 
 
-  GifPixelType *linebuf = wr->linebuf;
-  int y;
-
   void *use_octree = wr->has_from15to8bit ? NULL : wr->last_octree;
 
-  if ((!isFirst || frame_delay) && wr->transalpha<0)
+  // if set, pixels unchanged from prevframe (or mem_prevframe) are encoded as transparent
+  const bool use_prev = wr->transalpha<0 && (wr->membuf ? wr->mem_prevframe != NULL : (!isFirst || frame_delay));
+  bool ignFr=false;
+  if (use_prev && !wr->membuf && !wr->prevframe)
   {
-    bool ignFr=false;
-    if (!wr->prevframe)
-    {
-      ignFr=true;
-      wr->prevframe = new WDL_NEW LICE_MemBitmap(wr->w,wr->h);
-      LICE_Clear(wr->prevframe,0);
-    }
-
-    LICE_SubBitmap tmp(wr->prevframe,xpos,ypos,usew,useh);
-
-    LICE_pixel last_pixel_rgb=0;
-    GifPixelType last_pixel_idx=transparent_pix;
-
-    int pix_stats[256];
-    if (advanced_trans_stats) memset(pix_stats,0,sizeof(pix_stats));
-    pix_stats[transparent_pix] = -8;
-
-    for(y=0;y<useh;y++)
-    {
-      int rdy=y,rdy2=y;
-      if (frame->isFlipped()) rdy = frame->getHeight()-1-y;
-      if (tmp.isFlipped()) rdy2 = tmp.getHeight()-1-y;
-      const LICE_pixel *in = frame->getBits() + rdy*frame->getRowSpan();
-      const LICE_pixel *in2 = tmp.getBits() + rdy2*tmp.getRowSpan();
-      int x;
-
-      if (advanced_trans_stats)
-      {
-        if (use_octree) for(x=0;x<usew;x++)
-        {
-          const LICE_pixel p = in[x]&trans_mask;
-          if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
-          {
-            if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = LICE_FindInOctree(use_octree,p);
-            else 
-            {
-              const GifPixelType np = LICE_FindInOctree(use_octree,p);
-              if (p != (wr->last_palette[np]&trans_mask) || pix_stats[transparent_pix] > pix_stats[np])
-                last_pixel_idx = transparent_pix;
-              else 
-                last_pixel_idx = np;
-            }
-          }
-          linebuf[x] = last_pixel_idx;
-          pix_stats[last_pixel_idx]++;
-          last_pixel_rgb = p;
-        }
-        else for(x=0;x<usew;x++)
-        {
-          const LICE_pixel p = in[x]&trans_mask;
-          if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
-          {
-            if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = QuantPixel(p,wr);
-            else 
-            {
-              const GifPixelType np = QuantPixel(p,wr);
-
-              if (p != (wr->last_palette[np]&trans_mask) || pix_stats[transparent_pix] > pix_stats[np])
-                last_pixel_idx = transparent_pix;
-              else 
-                last_pixel_idx = np;
-            }
-          }
-          linebuf[x] = last_pixel_idx;
-          pix_stats[last_pixel_idx]++;
-          last_pixel_rgb = p;
-        }
-      }
-      else
-      {
-        // optimize solids by reusing the same value if previous rgb was the same, also avoid switching between
-        // from color to transparent if the color hasn't changed
-        if (use_octree) for(x=0;x<usew;x++)
-        {
-          const LICE_pixel p = in[x]&trans_mask;
-          if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
-          {
-            if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = LICE_FindInOctree(use_octree,last_pixel_rgb = p);
-            else last_pixel_idx = transparent_pix;
-          }
-          linebuf[x] = last_pixel_idx;
-        }
-        else for(x=0;x<usew;x++)
-        {
-          const LICE_pixel p = in[x]&trans_mask;
-          if (last_pixel_idx == transparent_pix || last_pixel_rgb!=p)
-          {
-            if (ignFr || p != (in2[x]&trans_mask)) last_pixel_idx = QuantPixel(last_pixel_rgb = p,wr);
-            else last_pixel_idx = transparent_pix;
-          }
-          linebuf[x] = last_pixel_idx;
-        }
-      }
-
+    ignFr=true;
+    wr->prevframe = new WDL_NEW LICE_MemBitmap(wr->w,wr->h);
+    LICE_Clear(wr->prevframe,0);
+  }
+  LICE_SubBitmap tmp(use_prev ? (wr->membuf ? wr->mem_prevframe : wr->prevframe) : NULL,xpos,ypos,usew,useh);
+  LICE_IBitmap *prev = use_prev ? &tmp : NULL;
 
-      EGifPutLine(wr->f, linebuf, usew);
-    }
+  int nbands = 1;
+  if (wr->encode_threads > 1 && useh >= GIF_BAND_MINROWS*2 && usew*useh >= GIF_BAND_MINPIXELS*2)
+  {
+    nbands = wdl_min(wr->encode_threads, useh / GIF_BAND_MINROWS);
+    nbands = wdl_min(nbands, (usew*useh) / GIF_BAND_MINPIXELS);
+  }
 
-    LICE_Blit(&tmp,frame,0,0,0,0,usew,useh,1.0f,LICE_BLIT_MODE_COPY);
-    
+  if (nbands > 1)
+  {
+    WriteFrameBands(wr,frame,prev,ignFr,usew,useh,use_octree,transparent_pix,nbands);
   }
-  else if (wr->transalpha>0)
+  else
   {
-    const unsigned int al = wr->transalpha&0xff;
+    GifPixelType *linebuf = wr->linebuf;
+    gifQuantState st;
+    st.init(wr,transparent_pix);
+    int y;
     for(y=0;y<useh;y++)
     {
-      int rdy=y;
-      if (frame->isFlipped()) rdy = frame->getHeight()-1-y;
-      const LICE_pixel *in = frame->getBits() + rdy*frame->getRowSpan();
-      int x;
-      if (use_octree) for(x=0;x<usew;x++)
-      {
-        const LICE_pixel p = in[x];
-        if (LICE_GETA(p)<al) linebuf[x]=transparent_pix;
-        else linebuf[x] = LICE_FindInOctree(use_octree,p);
-      }
-      else for(x=0;x<usew;x++)
-      {
-        const LICE_pixel p = in[x];
-        if (LICE_GETA(p)<al) linebuf[x]=transparent_pix;
-        else linebuf[x] = QuantPixel(p,wr);
-      }
+      QuantizeRow(wr,frame,prev,ignFr,usew,y,use_octree,&st,linebuf);
       EGifPutLine(wr->f, linebuf, usew);
     }
   }
-  else for(y=0;y<useh;y++)
-  {
-    int rdy=y;
-    if (frame->isFlipped()) rdy = frame->getHeight()-1-y;
-    const LICE_pixel *in = frame->getBits() + rdy*frame->getRowSpan();
-    int x;
-    if (use_octree) for(x=0;x<usew;x++) linebuf[x] = LICE_FindInOctree(use_octree,in[x]);
-    else for(x=0;x<usew;x++) linebuf[x] = QuantPixel(in[x],wr);
-    EGifPutLine(wr->f, linebuf, usew);
-  }
+
+  if (prev && !wr->membuf) LICE_Blit(prev,frame,0,0,0,0,usew,useh,1.0f,LICE_BLIT_MODE_COPY);
 
   return true;
 }
@@ -381,6 +768,35 @@ static int writefunc_fh(GifFileType *fh, const GifByteType *buf, int sz)
   return ((WDL_FileWrite *)fh->UserData)->Write(buf,sz);
 }
 
+static int writefunc_mem(GifFileType *fh, const GifByteType *buf, int sz) 
+{  
+  return ((WDL_Queue *)fh->UserData)->Add(buf,sz) ? sz : 0;
+}
+
+static liceGifWriteRec *create_write_rec(GifFileType *f, int w, int h, int transparent_alpha, bool dither, bool is_append)
+{
+  liceGifWriteRec *wr = (liceGifWriteRec*)calloc(sizeof(liceGifWriteRec),1);
+  wr->f = f;
+  wr->append = is_append;
+  wr->dither = dither;
+  wr->w=w;
+  wr->h=h;
+  wr->cmap = (ColorMapObject*)calloc(sizeof(ColorMapObject)+256*sizeof(GifColorType),1);
+  wr->cmap->Colors = (GifColorType*)(wr->cmap+1);
+  wr->cmap->ColorCount=256;
+  wr->cmap->BitsPerPixel=8;
+  wr->has_had_frame=false;
+  wr->has_global_cmap=false;
+  wr->has_from15to8bit=false;
+  wr->last_octree=NULL;
+
+  wr->linebuf = (GifPixelType*)malloc(wr->w*sizeof(GifPixelType));
+  wr->transalpha = transparent_alpha;
+  wr->encode_threads = 1;
+
+  return wr;
+}
+
 void *LICE_WriteGIFBeginNoFrame(const char *filename, int w, int h, int transparent_alpha, bool dither, bool is_append)
 {
   WDL_FileWrite *fp = new WDL_FileWrite(filename,1,65536,16,16,is_append);
@@ -401,27 +817,53 @@ void *LICE_WriteGIFBeginNoFrame(const char *filename, int w, int h, int transpar
     return NULL;
   }
 
-  liceGifWriteRec *wr = (liceGifWriteRec*)calloc(sizeof(liceGifWriteRec),1);
-  wr->f = f;
+  liceGifWriteRec *wr = create_write_rec(f,w,h,transparent_alpha,dither,is_append);
   wr->fh = fp;
-  wr->append = is_append;
-  wr->dither = dither;
-  wr->w=w;
-  wr->h=h;
-  wr->cmap = (ColorMapObject*)calloc(sizeof(ColorMapObject)+256*sizeof(GifColorType),1);
-  wr->cmap->Colors = (GifColorType*)(wr->cmap+1);
-  wr->cmap->ColorCount=256;
-  wr->cmap->BitsPerPixel=8;
-  wr->has_had_frame=false;
-  wr->has_global_cmap=false;
-  wr->has_from15to8bit=false;
-  wr->last_octree=NULL;
+  return wr;
+}
 
-  wr->linebuf = (GifPixelType*)malloc(wr->w*sizeof(GifPixelType));
-  wr->transalpha = transparent_alpha;
+void *LICE_WriteGIFBeginMem(int w, int h, int transparent_alpha, bool dither)
+{
+  WDL_Queue *q = new WDL_Queue;
+  GifFileType *f = EGifOpen(q,writefunc_mem);
+  if (!f) 
+  {
+    delete q;
+    return NULL;
+  }
 
+  // like appending: no header. extensions are written by LICE_WriteGIFFrameFromMem()
+  liceGifWriteRec *wr = create_write_rec(f,w,h,transparent_alpha,dither,true);
+  wr->membuf = q;
+  wr->mem_trans_pix = -1;
   return wr;
 }
+
+void LICE_WriteGIFSetPrevFrame(void *handle, LICE_IBitmap *prev)
+{
+  liceGifWriteRec *wr = (liceGifWriteRec*)handle;
+  if (wr && wr->membuf) wr->mem_prevframe = prev;
+}
+
+bool LICE_WriteGIFFrameFromMem(void *handle, void *memhandle, int frame_delay, int nreps)
+{
+  liceGifWriteRec *wr = (liceGifWriteRec*)handle;
+  liceGifWriteRec *src = (liceGifWriteRec*)memhandle;
+  if (!wr || !wr->fh || !src || !src->membuf || !src->membuf->Available()) return false;
+
+  const bool isFirst = !wr->has_had_frame;
+  if (isFirst)
+  {
+    wr->has_had_frame=true;
+    if (!wr->append) EGifPutScreenDesc(wr->f,wr->w,wr->h,8,0,wr->has_global_cmap ? wr->cmap : 0);
+  }
+  write_frame_extensions(wr,isFirst,frame_delay,nreps,src->mem_trans_pix >= 0,(unsigned char)src->mem_trans_pix);
+
+  // giflib doesn't buffer anything between images, so the encoded image can go straight to the file
+  const bool ok = wr->fh->Write(src->membuf->Get(),src->membuf->Available()) == src->membuf->Available();
+  src->membuf->Clear();
+  return ok;
+}
 void *LICE_WriteGIFBegin(const char *filename, LICE_IBitmap *firstframe, int transparent_alpha, int frame_delay, bool dither, int nreps)
 {
   if (!firstframe) return NULL;
@@ -447,6 +889,7 @@ bool LICE_WriteGIFEnd(void *handle)
 
   delete wr->prevframe;
   delete wr->fh;
+  delete wr->membuf;
 
   free(wr);
 
@@ -2,31 +2,206 @@
 #include <stdlib.h>
 
 #include "lice_lcf.h"
+#include "lice_parallel.h"
+#include "lice_lz.h"
 
 #include "../filewrite.h"
 #include "../fileread.h"
+#include "../time_precise.h"
 
 
 #define LCF_VERSION 0x11CEb001
-
-LICECaptureCompressor::LICECaptureCompressor(const char *outfn, int w, int h, int interval, int bsize_w, int bsize_h)
+#define LCF_VERSION2 0x11CEb002 // header is followed by nstreams and a csize/dsize pair per stream
+#define LCF_VERSION3 0x11CEb003 // header is followed by the codec ID (and flags), then as LCF_VERSION2
+#define LCF_MAX_STREAMS 256
+
+// written after the last block when the compressor is closed, so readers can seek without scanning the file:
+//   LCF_INDEX, nblocks, then per block: 64-bit file offset, start ms (relative to the first frame), LCF_INDEX_* flags
+//   trailer: 64-bit offset of LCF_INDEX, length ms, LCF_INDEX
+// older readers stop at it, since it doesn't parse as a block header
+#define LCF_INDEX 0x11CEb1d0
+#define LCF_INDEX_KEYFRAME 1 // block can be decoded without the ones before it (currently all blocks)
+#define LCF_INDEX_ENTRYSIZE 16
+#define LCF_INDEX_TRAILERSIZE 16
+#define LCF_MMAP_MAXSIZE 0x7fffffff // larger files are read normally (GetMappedView() takes int offsets)
+#define LCF_STREAM_MINPIXELS (512*1024) // SetStreaming(): frame pixels per thread encoding tiles, smaller frames are encoded on the calling thread
+
+// flags in the high bits of the version 3 codec ID
+#define LCF_CODEC_MASK 0xff
+#define LCF_FLAG_TILEDELTA 0x100 // repeat counts are 0-63, bits 6-7 give the LCF_TILEMODE_* of the tile that follows
+
+#define LCF_TILEMODE_RAW 0
+#define LCF_TILEMODE_XOR 1 // samples are XORed with the previous frame's tile
+#define LCF_TILEMODE_SUB 2 // samples are the previous frame's tile subtracted (mod 2^bits)
+
+// pixel row conversions. RGB565 is (r>>3) | (g>>2)<<5 | (b>>3)<<11, 24-bit is R,G,B bytes,
+// 32-bit is the LICE_pixel value (little endian) with alpha forced to 255
+#if defined(__AVX2__)
+  #include <immintrin.h>
+  #define LCF_SIMD_AVX2
+#endif
+#if defined(__SSE2__) || _M_IX86_FP >= 2 || defined(_M_X64)
+  #include <emmintrin.h>
+  #define LCF_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define LCF_SIMD_NEON
+#endif
+
+static void LCF_RowTo565(const LICE_pixel *sp, unsigned short *dp, int n)
 {
-  m_inframes = m_outframes=0;
-  m_file = new WDL_FileWrite(outfn,1,512*1024);
-  if (!m_file->IsOpen()) { delete m_file; m_file=0; }
+  int x=0;
+#ifdef LCF_SIMD_AVX2
+  {
+    const __m256i mr = _mm256_set1_epi32(0x1f), mg = _mm256_set1_epi32(0x7e0), mb = _mm256_set1_epi32(0xf800);
+    for (; x+16 <= n; x+=16)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(sp+x)), b = _mm256_loadu_si256((const __m256i *)(sp+x+8));
+      a = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(a,19),mr),_mm256_and_si256(_mm256_srli_epi32(a,5),mg)),
+                          _mm256_and_si256(_mm256_slli_epi32(a,8),mb));
+      b = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(b,19),mr),_mm256_and_si256(_mm256_srli_epi32(b,5),mg)),
+                          _mm256_and_si256(_mm256_slli_epi32(b,8),mb));
+      _mm256_storeu_si256((__m256i *)(dp+x),_mm256_permute4x64_epi64(_mm256_packus_epi32(a,b),0xd8));
+    }
+  }
+#endif
+#if defined(LCF_SIMD_SSE2)
+  {
+    // no unsigned 32->16 pack in SSE2: bias into signed range, pack with saturation, unbias
+    const __m128i mr = _mm_set1_epi32(0x1f), mg = _mm_set1_epi32(0x7e0), mb = _mm_set1_epi32(0xf800);
+    const __m128i bias32 = _mm_set1_epi32(0x8000), bias16 = _mm_set1_epi16((short)0x8000);
+    for (; x+8 <= n; x+=8)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *)(sp+x)), b = _mm_loadu_si128((const __m128i *)(sp+x+4));
+      a = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(a,19),mr),_mm_and_si128(_mm_srli_epi32(a,5),mg)),
+                       _mm_and_si128(_mm_slli_epi32(a,8),mb));
+      b = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(b,19),mr),_mm_and_si128(_mm_srli_epi32(b,5),mg)),
+                       _mm_and_si128(_mm_slli_epi32(b,8),mb));
+      const __m128i r = _mm_packs_epi32(_mm_sub_epi32(a,bias32),_mm_sub_epi32(b,bias32));
+      _mm_storeu_si128((__m128i *)(dp+x),_mm_add_epi16(r,bias16));
+    }
+  }
+#elif defined(LCF_SIMD_NEON)
+  {
+    const uint32x4_t mr = vdupq_n_u32(0x1f), mg = vdupq_n_u32(0x7e0), mb = vdupq_n_u32(0xf800);
+    for (; x+8 <= n; x+=8)
+    {
+      uint32x4_t a = vld1q_u32((const uint32_t *)(sp+x)), b = vld1q_u32((const uint32_t *)(sp+x+4));
+      a = vorrq_u32(vorrq_u32(vandq_u32(vshrq_n_u32(a,19),mr),vandq_u32(vshrq_n_u32(a,5),mg)),vandq_u32(vshlq_n_u32(a,8),mb));
+      b = vorrq_u32(vorrq_u32(vandq_u32(vshrq_n_u32(b,19),mr),vandq_u32(vshrq_n_u32(b,5),mg)),vandq_u32(vshlq_n_u32(b,8),mb));
+      vst1q_u16(dp+x,vcombine_u16(vmovn_u32(a),vmovn_u32(b)));
+    }
+  }
+#endif
+  for (; x < n; x ++)
+  {
+    const LICE_pixel pix = sp[x];
+    dp[x] = (((int)LICE_GETR(pix)&0xF8)>>3) | (((int)LICE_GETG(pix)&0xFC)<<3) | (((int)LICE_GETB(pix)&0xF8)<<8);
+  }
+}
 
-  memset(&m_compstream,0,sizeof(m_compstream));
-  if (m_file)
+// sp may be unaligned (slices are packed after 1-byte repeat counts)
+static void LCF_RowFrom565(const unsigned char *sp, LICE_pixel *dp, int n)
+{
+  int x=0;
+#ifdef LCF_SIMD_AVX2
   {
-    if (deflateInit(&m_compstream,9)!=Z_OK)
+    const __m256i mr = _mm256_set1_epi32(0xf80000), mg = _mm256_set1_epi32(0xfc00), mb = _mm256_set1_epi32(0xf8), ma = _mm256_set1_epi32((int)0xff000000);
+    for (; x+8 <= n; x+=8)
     {
-      delete m_file; 
-      m_file=0;
+      const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(sp+x*2)));
+      const __m256i r = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(v,19),mr),_mm256_and_si256(_mm256_slli_epi32(v,5),mg)),
+                                        _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v,8),mb),ma));
+      _mm256_storeu_si256((__m256i *)(dp+x),r);
+    }
+  }
+#endif
+#if defined(LCF_SIMD_SSE2)
+  {
+    const __m128i mr = _mm_set1_epi32(0xf80000), mg = _mm_set1_epi32(0xfc00), mb = _mm_set1_epi32(0xf8), ma = _mm_set1_epi32((int)0xff000000);
+    const __m128i z = _mm_setzero_si128();
+    for (; x+8 <= n; x+=8)
+    {
+      const __m128i v = _mm_loadu_si128((const __m128i *)(sp+x*2));
+      const __m128i a = _mm_unpacklo_epi16(v,z), b = _mm_unpackhi_epi16(v,z);
+      _mm_storeu_si128((__m128i *)(dp+x),_mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_slli_epi32(a,19),mr),_mm_and_si128(_mm_slli_epi32(a,5),mg)),
+                                                      _mm_or_si128(_mm_and_si128(_mm_srli_epi32(a,8),mb),ma)));
+      _mm_storeu_si128((__m128i *)(dp+x+4),_mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_slli_epi32(b,19),mr),_mm_and_si128(_mm_slli_epi32(b,5),mg)),
+                                                        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(b,8),mb),ma)));
+    }
+  }
+#elif defined(LCF_SIMD_NEON)
+  {
+    const uint32x4_t mr = vdupq_n_u32(0xf80000), mg = vdupq_n_u32(0xfc00), mb = vdupq_n_u32(0xf8), ma = vdupq_n_u32(0xff000000);
+    for (; x+8 <= n; x+=8)
+    {
+      const uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(sp+x*2));
+      const uint32x4_t a = vmovl_u16(vget_low_u16(v)), b = vmovl_u16(vget_high_u16(v));
+      vst1q_u32((uint32_t *)(dp+x),vorrq_u32(vorrq_u32(vandq_u32(vshlq_n_u32(a,19),mr),vandq_u32(vshlq_n_u32(a,5),mg)),vorrq_u32(vandq_u32(vshrq_n_u32(a,8),mb),ma)));
+      vst1q_u32((uint32_t *)(dp+x+4),vorrq_u32(vorrq_u32(vandq_u32(vshlq_n_u32(b,19),mr),vandq_u32(vshlq_n_u32(b,5),mg)),vorrq_u32(vandq_u32(vshrq_n_u32(b,8),mb),ma)));
     }
   }
+#endif
+  for (; x < n; x ++)
+  {
+    const int px = sp[x*2] | (sp[x*2+1]<<8);
+    dp[x] = LICE_RGBA((px<<3)&0xF8,(px>>3)&0xFC,(px>>8)&0xF8,255);
+  }
+}
+
+static void LCF_RowTo24(const LICE_pixel *sp, unsigned char *dp, int n)
+{
+  while (n--)
+  {
+    const LICE_pixel pix = *sp++;
+    dp[0] = (unsigned char)LICE_GETR(pix);
+    dp[1] = (unsigned char)LICE_GETG(pix);
+    dp[2] = (unsigned char)LICE_GETB(pix);
+    dp+=3;
+  }
+}
+
+static void LCF_RowFrom24(const unsigned char *sp, LICE_pixel *dp, int n)
+{
+  while (n--)
+  {
+    *dp++ = LICE_RGBA(sp[0],sp[1],sp[2],255);
+    sp+=3;
+  }
+}
+
+static void LCF_RowTo32(const LICE_pixel *sp, unsigned char *dp, int n)
+{
+  int x;
+  for (x=0;x<n;x++)
+  {
+    const LICE_pixel pix = sp[x] | LICE_RGBA(0,0,0,255);
+    dp[x*4] = (unsigned char)pix; // little endian, the compiler merges these into a single store
+    dp[x*4+1] = (unsigned char)(pix>>8);
+    dp[x*4+2] = (unsigned char)(pix>>16);
+    dp[x*4+3] = (unsigned char)(pix>>24);
+  }
+}
+
+static void LCF_RowFrom32(const unsigned char *sp, LICE_pixel *dp, int n)
+{
+  int x;
+  for (x=0;x<n;x++)
+    dp[x] = (sp[x*4] | (sp[x*4+1]<<8) | (sp[x*4+2]<<16)) | LICE_RGBA(0,0,0,255);
+}
+
+LICECaptureCompressor::LICECaptureCompressor(const char *outfn, int w, int h, int interval, int bsize_w, int bsize_h, int level)
+{
+  m_inframes = m_outframes=0;
+  m_file = new WDL_FileWrite(outfn,1,512*1024);
+  if (!m_file->IsOpen()) { delete m_file; m_file=0; }
 
   m_inbytes=0;
   m_outsize=0;
+  m_writepos=0;
+  m_index_nblocks=0;
+  m_index_ms=0;
+  m_index_firstdelay=0;
   m_w=w;
   m_h=h;
   m_interval=interval;
@@ -34,155 +209,311 @@ LICECaptureCompressor::LICECaptureCompressor(const char *outfn, int w, int h, in
   m_bsize_h=bsize_h;
   m_state=0;
   m_which=0;
-  m_outchunkpos=0;
   m_numcols = (m_w+bsize_w-1) / (bsize_w>0?bsize_w:1);
   if (m_numcols<1) m_numcols=1;
   m_numrows = (m_h+bsize_h-1)/ (bsize_h>0?bsize_h:1);
 
-  m_current_block_srcsize=0;
+  m_nthreads=1;
+  m_bpp=16;
+  m_codec=LICE_LCF_CODEC_DEFLATE;
+  m_tiledelta=false;
+  m_adaptive = level<0;
+  m_level = m_adaptive ? 6 : wdl_min(level,9);
+  m_comptime=0.0;
+  m_joblist=NULL;
+  m_joblist_size=0;
+  m_jobflush=false;
+  m_jobframe=NULL;
+  m_streammem=0;
+  m_pending=0;
+  m_streamcur=0;
+
+  if (m_file && !InitStreams(1))
+  {
+    delete m_file; 
+    m_file=0;
+  }
 }
 
-void LICECaptureCompressor::OnFrame(LICE_IBitmap *fr, int delta_t_ms)
+bool LICECaptureCompressor::InitStreams(int nstreams)
 {
-  if (fr) 
-  {
-    if (fr->getWidth()!=m_w || fr->getHeight()!=m_h) return;
+  const int ntiles = m_numcols*m_numrows;
+  if (nstreams > ntiles) nstreams=ntiles;
+  if (nstreams > LCF_MAX_STREAMS) nstreams=LCF_MAX_STREAMS;
+  if (nstreams < 1) nstreams=1;
 
-    frameRec *rec = m_framelists[m_which].Get(m_state);
-    if (!rec)
+  int x;
+  for (x=0;x<nstreams;x++)
+  {
+    streamRec *s = new streamRec;
+    memset(&s->compstream,0,sizeof(s->compstream));
+    if (!InitDeflate(&s->compstream,m_level))
     {
-      rec = new frameRec(m_w*m_h);
-      m_framelists[m_which].Add(rec);
+      delete s;
+      return false;
     }
-    rec->delta_t_ms=delta_t_ms;
-    BitmapToFrameRec(fr,rec);
-    m_state++;
-    m_inframes++;
+    s->current_block_srcsize=0;
+    s->chunkstart = s->outchunkpos = (int) ((ntiles * (WDL_INT64)x) / nstreams);
+    s->chunkend = (int) ((ntiles * (WDL_INT64)(x+1)) / nstreams);
+    s->compressTo = s->chunkstart;
+    s->inbytes = s->outbytes = 0;
+    s->lz_pending = s->lz_base = 0;
+    s->pending = 0;
+    m_streams.Add(s);
+  }
+  return true;
+}
+
+void LICECaptureCompressor::FreeStreams()
+{
+  int x;
+  for (x=0;x<m_streams.GetSize();x++)
+  {
+    streamRec *s = m_streams.Get(x);
+    deflateEnd(&s->compstream);
+    delete s;
   }
+  m_streams.Empty();
+}
 
+void LICECaptureCompressor::SetThreads(int nthreads, int nstreams)
+{
+  if (!m_file || m_inframes) return;
 
-  bool isLastBlock = m_state >= m_interval || !fr;
+  if (nthreads<1) nthreads = LICE_GetNumCPUs();
+  if (nstreams<1) nstreams = nthreads;
+  m_nthreads = nthreads;
 
-  if (m_framelists[!m_which].GetSize())
+  FreeStreams();
+  if (!InitStreams(nstreams))
   {
-    int compressTo;
-    if (isLastBlock) compressTo = m_numcols*m_numrows;
-    else compressTo = (m_state * m_numcols*m_numrows) / m_interval;
+    FreeStreams();
+    delete m_file;
+    m_file=0;
+  }
+}
 
-    frameRec **list = m_framelists[!m_which].GetList();
-    int list_size = m_framelists[!m_which].GetSize();
+void LICECaptureCompressor::SetCodec(int codec)
+{
+  if (!m_file || m_inframes) return;
+  m_codec = codec == LICE_LCF_CODEC_LZ ? codec : LICE_LCF_CODEC_DEFLATE;
+}
 
-    // compress some data
-    int chunkpos = m_outchunkpos;
-    while (chunkpos < compressTo)
-    {
-      int xpos = (chunkpos%m_numcols) * m_bsize_w;
-      int ypos = (chunkpos/m_numcols) * m_bsize_h;
+void LICECaptureCompressor::SetBitDepth(int bpp)
+{
+  if (!m_file || m_inframes) return;
+  m_bpp = bpp == 24 || bpp == 32 ? bpp : 16;
+  if (m_streammem) SetStreaming(m_streammem); // frame size changed
+}
 
-      int wid = m_w-xpos;
-      int hei = m_h-ypos;
-      if (wid > m_bsize_w) wid=m_bsize_w;
-      if (hei > m_bsize_h) hei=m_bsize_h;
+void LICECaptureCompressor::SetTileDelta(bool enable)
+{
+  if (!m_file || m_inframes) return;
+  m_tiledelta = enable;
 
-      int i;
-      int rdoffs = xpos + ypos*m_w;
-      int rdspan = m_w;
+  int x;
+  for (x=0;x<m_streams.GetSize();x++)
+  {
+    z_stream *cs = &m_streams.Get(x)->compstream;
+    deflateEnd(cs);
+    memset(cs,0,sizeof(*cs));
+    InitDeflate(cs,m_level);
+  }
+}
 
-      int repeat_cnt=0;
+void LICECaptureCompressor::SetStreaming(int maxmem)
+{
+  if (!m_file || m_inframes) return;
 
-      for(i=0;i<list_size; i++)
-      {
-        unsigned short *rd = list[i]->data + rdoffs;
-        if (i&&repeat_cnt<255)
-        {
-          unsigned short *rd1=rd;
-          unsigned short *rd2=list[i-1]->data+rdoffs;
-          int a=hei;
-          while(a--)
-          {
-            if (memcmp(rd1,rd2,wid*sizeof(short))) break;
-            rd1+=rdspan;
-            rd2+=rdspan;
-          }
-          if (a<0)
-          {
-            repeat_cnt++;
-            continue;
-          }          
-        }
+  m_tiles.Empty(true);
+  m_streamframes[0].Resize(0);
+  m_streamframes[1].Resize(0);
+  m_streammem = 0;
+  if (maxmem<1) return;
 
-        if (i || repeat_cnt)
-        {
-          unsigned char c = (unsigned char)repeat_cnt;
-          DeflateBlock(&c,1,false);
-          repeat_cnt=0;
-        }
-        int a=hei;
-        while (a--)
-        {
-          DeflateBlock(rd,wid*sizeof(short),false);
-          rd+=rdspan;
-        }
+  const int fsize = m_w*m_h*(m_bpp/8);
+  if (!m_streamframes[0].ResizeOK(fsize) || !m_streamframes[1].ResizeOK(fsize)) return;
+  const int ntiles = m_numcols*m_numrows;
+  int x;
+  for (x=0;x<ntiles;x++)
+  {
+    tileRec *t = new tileRec;
+    t->repeat_cnt[0]=t->repeat_cnt[1]=0;
+    m_tiles.Add(t);
+  }
+  m_streammem = maxmem;
+}
+
+bool LICECaptureCompressor::InitDeflate(z_stream *cs, int level)
+{
+  if (deflateInit(cs,level)!=Z_OK) return false;
+  TuneDeflate(cs,level);
+  return true;
+}
+
+void LICECaptureCompressor::TuneDeflate(z_stream *cs, int level)
+{
+  // residuals are mostly zero with sparse changes, which makes the long hash chains
+  // of levels 8-9 very slow (10x) for little gain. deflateReset() undoes this
+  if (m_tiledelta && level >= 8) deflateTune(cs,32,level == 9 ? 258 : 128,258,128); // level 7's chain length
+}
+
+void LICECaptureCompressor::OnFrame(LICE_IBitmap *fr, int delta_t_ms)
+{
+  if (fr) 
+  {
+    if (fr->getWidth()!=m_w || fr->getHeight()!=m_h) return;
+
+    if (m_streammem)
+    {
+      // a frame's tiles are cheap to compare and copy, so threads (created per call) only pay off for large frames
+      const int nthreads = wdl_min(m_nthreads, (int)(m_w*(double)m_h / LCF_STREAM_MINPIXELS));
+      int x;
+      m_jobframe = fr;
+      if (nthreads > 1) LICE_RunParallel(m_streams.GetSize(),EncodeStreamJob,this,nthreads);
+      else for (x=0;x<m_streams.GetSize();x++) EncodeTiles(m_streams.Get(x));
+      m_jobframe = NULL;
+      for (x=0;x<m_streams.GetSize();x++)
+      {
+        m_pending += m_streams.Get(x)->pending;
+        m_streams.Get(x)->pending = 0;
       }
-      if (repeat_cnt)
+      m_streamcur = !m_streamcur;
+      m_delays[m_which].Add(delta_t_ms);
+    }
+    else
+    {
+      frameRec *rec = m_framelists[m_which].Get(m_state);
+      if (!rec)
       {
-        unsigned char c = (unsigned char)repeat_cnt;
-        DeflateBlock(&c,1,false);
+        rec = new frameRec(m_w*m_h*(m_bpp/8));
+        m_framelists[m_which].Add(rec);
       }
+      rec->delta_t_ms=delta_t_ms;
+      BitmapToFrameRec(fr,rec);
+    }
+    m_state++;
+    m_inframes++;
+  }
 
-      chunkpos++;
+
+  const bool overLimit = m_streammem && m_pending > m_streammem;
+  bool isLastBlock = m_state >= m_interval || !fr || overLimit;
+
+  const int nstreams = m_streams.GetSize();
+  if (BlockFrames(!m_which))
+  {
+    // each stream advances through its own tile range at the same rate
+    int x;
+    for (x=0;x<nstreams;x++)
+    {
+      streamRec *s = m_streams.Get(x);
+      if (isLastBlock) s->compressTo = s->chunkend;
+      else s->compressTo = s->chunkstart + (m_state * (s->chunkend-s->chunkstart)) / m_interval;
+    }
+
+    m_joblist = m_framelists[!m_which].GetList();
+    m_joblist_size = m_framelists[!m_which].GetSize();
+    m_jobflush = isLastBlock;
+
+    const double t0 = time_precise();
+    LICE_RunParallel(nstreams,CompressStreamJob,this,m_nthreads);
+    m_comptime += time_precise()-t0;
+
+    for (x=0;x<nstreams;x++)
+    {
+      streamRec *s = m_streams.Get(x);
+      m_inbytes += s->inbytes;
+      m_outsize += s->outbytes;
+      m_pending += s->pending;
+      s->inbytes = s->outbytes = s->pending = 0;
     }
-    m_outchunkpos=chunkpos;
   }
 
   if (isLastBlock)
   {
-    if (m_framelists[!m_which].GetSize())
+    if (BlockFrames(!m_which))
     {
-      m_outframes += m_framelists[!m_which].GetSize();
+      m_outframes += BlockFrames(!m_which);
 
-      DeflateBlock(NULL,0,true);
+      int sz=0, uncomp_sz=0, x;
+      for (x=0;x<nstreams;x++)
+      {
+        sz += m_streams.Get(x)->current_block.Available();
+        uncomp_sz += m_streams.Get(x)->current_block_srcsize;
+      }
 
-      deflateReset(&m_compstream);
+      const int codecfield = m_codec | (m_tiledelta ? LCF_FLAG_TILEDELTA : 0);
 
       m_hdrqueue.Clear();
-      AddHdrInt(LCF_VERSION);
-      AddHdrInt(16);
+      AddHdrInt(codecfield ? LCF_VERSION3 : nstreams > 1 ? LCF_VERSION2 : LCF_VERSION);
+      AddHdrInt(m_bpp);
       AddHdrInt(m_w);
       AddHdrInt(m_h);
       AddHdrInt(m_bsize_w);
       AddHdrInt(m_bsize_h);
-      int nf = m_framelists[!m_which].GetSize();
+      int nf = BlockFrames(!m_which);
       AddHdrInt(nf);
-      int sz = m_current_block.Available();
       AddHdrInt(sz);
-
-      int uncomp_sz = m_current_block_srcsize;
       AddHdrInt(uncomp_sz);
 
+      for(x=0;x<nf;x++)
+      {
+        AddHdrInt(BlockDelay(!m_which,x));
+      }
+
+      if (codecfield) AddHdrInt(codecfield);
+      if (codecfield || nstreams > 1)
       {
-        int x;
-        for(x=0;x<nf;x++)
+        AddHdrInt(nstreams);
+        for (x=0;x<nstreams;x++)
         {
-          AddHdrInt(m_framelists[!m_which].Get(x)->delta_t_ms);
+          AddHdrInt(m_streams.Get(x)->current_block.Available());
+          AddHdrInt(m_streams.Get(x)->current_block_srcsize);
         }
       }
 
+      // seek times match what a reader scanning the headers computes: the first frame is at 0
+      const int delta0 = BlockDelay(!m_which,0);
+      if (!m_index_nblocks) m_index_firstdelay = delta0;
+      const unsigned int startms = m_index_nblocks ? m_index_ms + delta0 - m_index_firstdelay : 0;
+      m_index.AddToLE(&m_writepos);
+      m_index.AddToLE(&startms);
+      const int flags = LCF_INDEX_KEYFRAME;
+      m_index.AddToLE(&flags);
+      m_index_nblocks++;
+      for (x=0;x<nf;x++) m_index_ms += BlockDelay(!m_which,x);
 
       m_file->Write(m_hdrqueue.Get(),m_hdrqueue.Available());
       m_outsize += m_hdrqueue.Available();
-      m_file->Write(m_current_block.Get(),sz);
-      m_outsize += sz;
+      m_writepos += m_hdrqueue.Available() + sz;
+      for (x=0;x<nstreams;x++)
+      {
+        streamRec *s = m_streams.Get(x);
+        m_file->Write(s->current_block.Get(),s->current_block.Available());
+        m_outsize += s->current_block.Available();
+        s->current_block.Clear();
+        s->current_block_srcsize=0;
+      }
 
-      m_current_block.Clear();
-      m_current_block_srcsize=0;
+      // the block was compressed while the frames of the next one were captured
+      if (m_adaptive && fr && m_codec == LICE_LCF_CODEC_DEFLATE)
+      {
+        int budget_ms=0;
+        for (x=0;x<m_state;x++) budget_ms += BlockDelay(m_which,x);
+        AdaptLevel(budget_ms);
+      }
     }
+    m_comptime=0.0;
 
 
     int old_state=m_state;
     m_state=0;
-    m_outchunkpos=0;
+    int x;
+    for (x=0;x<nstreams;x++)
+      m_streams.Get(x)->outchunkpos = m_streams.Get(x)->chunkstart;
     m_which=!m_which;
+    m_delays[m_which].Resize(0,false);
 
 
     if (old_state>0 && !fr)
@@ -192,6 +523,11 @@ void LICECaptureCompressor::OnFrame(LICE_IBitmap *fr, int delta_t_ms)
 
       OnFrame(NULL,0);
     }
+    else if (overLimit && fr)
+    {
+      // compress the block now rather than alongside the next one, which would start over the limit
+      OnFrame(NULL,0);
+    }
 
     if (!fr)
     {
@@ -201,9 +537,285 @@ void LICECaptureCompressor::OnFrame(LICE_IBitmap *fr, int delta_t_ms)
   }
 }
 
+void LICECaptureCompressor::AdaptLevel(int budget_ms)
+{
+  if (budget_ms<1) return;
+
+  // compression runs on the capture thread, keep it to a fraction of real time
+  const double load = m_comptime*1000.0 / budget_ms;
+  int level = m_level;
+  if (load > 1.0) level -= 3;
+  else if (load > 0.5) level--;
+  else if (load < 0.15) level++;
+
+  if (level<1) level=1;
+  else if (level>9) level=9;
+
+  if (level != m_level)
+  {
+    m_level = level;
+    int x;
+    for (x=0;x<m_streams.GetSize();x++)
+    {
+      // deflateParams() would try to flush into the stale output buffer, the streams are at a block boundary anyway
+      z_stream *cs = &m_streams.Get(x)->compstream;
+      deflateEnd(cs);
+      memset(cs,0,sizeof(*cs));
+      InitDeflate(cs,level);
+    }
+  }
+}
+
+void LICECaptureCompressor::CompressStreamJob(void *ctx, int idx)
+{
+  LICECaptureCompressor *_this = (LICECaptureCompressor *)ctx;
+  streamRec *s = _this->m_streams.Get(idx);
+  _this->CompressChunks(s);
+  if (_this->m_jobflush)
+  {
+    _this->DeflateBlock(s,NULL,0,true);
+    deflateReset(&s->compstream);
+    _this->TuneDeflate(&s->compstream,_this->m_level);
+  }
+}
+
+void LICECaptureCompressor::EncodeStreamJob(void *ctx, int idx)
+{
+  LICECaptureCompressor *_this = (LICECaptureCompressor *)ctx;
+  _this->EncodeTiles(_this->m_streams.Get(idx));
+}
+
+// SetStreaming(): adds m_jobframe to the stream's tiles of the current block, in the same form as CompressChunks()
+void LICECaptureCompressor::EncodeTiles(streamRec *s)
+{
+  unsigned char *cur = m_streamframes[m_streamcur].Get();
+  const unsigned char *prev = m_streamframes[!m_streamcur].Get();
+  const int i = m_state; // frame index in the block
+  const int bps = m_bpp/8;
+  const int rdspan = m_w*bps;
+  const int max_repeat = m_tiledelta ? 63 : 255;
+
+  int chunkpos;
+  for (chunkpos = s->chunkstart; chunkpos < s->chunkend; chunkpos++)
+  {
+    int xpos = (chunkpos%m_numcols) * m_bsize_w;
+    int ypos = (chunkpos/m_numcols) * m_bsize_h;
+
+    int wid = m_w-xpos;
+    int hei = m_h-ypos;
+    if (wid > m_bsize_w) wid=m_bsize_w;
+    if (hei > m_bsize_h) hei=m_bsize_h;
+
+    const int rdoffs = (xpos + ypos*m_w)*bps;
+    const int rowbytes = wid*bps;
+    BitmapToTile(m_jobframe,cur+rdoffs,xpos,ypos,wid,hei);
+
+    tileRec *t = m_tiles.Get(chunkpos);
+    WDL_TypedBuf<unsigned char> *out = &t->data[m_which];
+    int *repeat_cnt = &t->repeat_cnt[m_which];
+    const int oldsz = out->GetSize();
+
+    if (i && *repeat_cnt<max_repeat)
+    {
+      const unsigned char *rd1=cur+rdoffs, *rd2=prev+rdoffs;
+      int a=hei;
+      while(a--)
+      {
+        if (memcmp(rd1,rd2,rowbytes)) break;
+        rd1+=rdspan;
+        rd2+=rdspan;
+      }
+      if (a<0)
+      {
+        (*repeat_cnt)++;
+        continue;
+      }
+    }
+
+    int mode = LCF_TILEMODE_RAW;
+    if (i || *repeat_cnt)
+    {
+      if (m_tiledelta && i) mode = EncodeTileDelta(s,prev+rdoffs,cur+rdoffs,wid,hei);
+      out->Add((unsigned char)(*repeat_cnt | (mode<<6)));
+      *repeat_cnt=0;
+    }
+    if (mode != LCF_TILEMODE_RAW) out->Add(s->deltabuf.Get(),rowbytes*hei);
+    else
+    {
+      const unsigned char *rd = cur+rdoffs;
+      int a=hei;
+      while (a--)
+      {
+        out->Add(rd,rowbytes);
+        rd+=rdspan;
+      }
+    }
+    s->pending += out->GetSize() - oldsz;
+  }
+}
+
+void LICECaptureCompressor::CompressChunks(streamRec *s)
+{
+  frameRec **list = m_joblist;
+  const int list_size = m_joblist_size;
+
+  // compress some data
+  int chunkpos = s->outchunkpos;
+  if (m_streammem)
+  {
+    // tiles were encoded by EncodeTiles(), memory is released as they are compressed
+    for (; chunkpos < s->compressTo; chunkpos++)
+    {
+      tileRec *t = m_tiles.Get(chunkpos);
+      WDL_TypedBuf<unsigned char> *buf = &t->data[!m_which];
+      DeflateBlock(s,buf->Get(),buf->GetSize(),false);
+      if (t->repeat_cnt[!m_which])
+      {
+        unsigned char c = (unsigned char)t->repeat_cnt[!m_which];
+        DeflateBlock(s,&c,1,false);
+      }
+      s->pending -= buf->GetSize();
+      buf->Resize(0);
+      t->repeat_cnt[!m_which]=0;
+    }
+    s->outchunkpos=chunkpos;
+    return;
+  }
+
+  while (chunkpos < s->compressTo)
+  {
+    int xpos = (chunkpos%m_numcols) * m_bsize_w;
+    int ypos = (chunkpos/m_numcols) * m_bsize_h;
+
+    int wid = m_w-xpos;
+    int hei = m_h-ypos;
+    if (wid > m_bsize_w) wid=m_bsize_w;
+    if (hei > m_bsize_h) hei=m_bsize_h;
+
+    int i;
+    const int bps = m_bpp/8;
+    int rdoffs = (xpos + ypos*m_w)*bps;
+    int rdspan = m_w*bps;
+    const int rowbytes = wid*bps;
+
+    int repeat_cnt=0;
+    const int max_repeat = m_tiledelta ? 63 : 255;
+
+    for(i=0;i<list_size; i++)
+    {
+      unsigned char *rd = list[i]->data + rdoffs;
+      if (i&&repeat_cnt<max_repeat)
+      {
+        unsigned char *rd1=rd;
+        unsigned char *rd2=list[i-1]->data+rdoffs;
+        int a=hei;
+        while(a--)
+        {
+          if (memcmp(rd1,rd2,rowbytes)) break;
+          rd1+=rdspan;
+          rd2+=rdspan;
+        }
+        if (a<0)
+        {
+          repeat_cnt++;
+          continue;
+        }          
+      }
+
+      if (i || repeat_cnt)
+      {
+        const int mode = m_tiledelta && i ? EncodeTileDelta(s,list[i-1]->data+rdoffs,rd,wid,hei) : LCF_TILEMODE_RAW;
+        unsigned char c = (unsigned char)(repeat_cnt | (mode<<6));
+        DeflateBlock(s,&c,1,false);
+        repeat_cnt=0;
+        if (mode != LCF_TILEMODE_RAW)
+        {
+          DeflateBlock(s,s->deltabuf.Get(),rowbytes*hei,false);
+          continue;
+        }
+      }
+      int a=hei;
+      while (a--)
+      {
+        DeflateBlock(s,rd,rowbytes,false);
+        rd+=rdspan;
+      }
+    }
+    if (repeat_cnt)
+    {
+      unsigned char c = (unsigned char)repeat_cnt;
+      DeflateBlock(s,&c,1,false);
+    }
+
+    chunkpos++;
+  }
+  s->outchunkpos=chunkpos;
+}
+
+// counts the sample-to-sample changes of the raw, XOR and SUB forms of a tile (costs[LCF_TILEMODE_*])
+template<class T> static void LCF_TileDeltaCosts(const T *cur, const T *prev, int span, int wid, int hei, int *costs)
+{
+  int craw=0, cxor=0, csub=0;
+  T lraw=0, lxor=0, lsub=0;
+  int y;
+  for (y=0;y<hei;y++)
+  {
+    const T *a = cur + y*span, *b = prev + y*span;
+    int x;
+    for (x=0;x<wid;x++)
+    {
+      const T r = a[x], xo = a[x]^b[x], su = (T)(a[x]-b[x]);
+      craw += r != lraw;
+      cxor += xo != lxor;
+      csub += su != lsub;
+      lraw=r;
+      lxor=xo;
+      lsub=su;
+    }
+  }
+  costs[LCF_TILEMODE_RAW]=craw;
+  costs[LCF_TILEMODE_XOR]=cxor;
+  costs[LCF_TILEMODE_SUB]=csub;
+}
+
+template<class T> static void LCF_TileDeltaEncode(const T *cur, const T *prev, int span, int wid, int hei, int mode, T *out)
+{
+  int y;
+  for (y=0;y<hei;y++)
+  {
+    const T *a = cur + y*span, *b = prev + y*span;
+    int x;
+    if (mode == LCF_TILEMODE_XOR) for (x=0;x<wid;x++) *out++ = a[x]^b[x];
+    else for (x=0;x<wid;x++) *out++ = (T)(a[x]-b[x]);
+  }
+}
+
+// picks the tile mode with the fewest sample-to-sample changes (a cheap proxy for compressed size),
+// favoring raw unless a residual is clearly better. the residual is left in s->deltabuf.
+// samples are 16-bit for RGB565 and bytes otherwise
+int LICECaptureCompressor::EncodeTileDelta(streamRec *s, const unsigned char *prev, const unsigned char *cur, int wid, int hei)
+{
+  const int bps = m_bpp/8;
+  int costs[3];
+  if (bps == 2) LCF_TileDeltaCosts((const unsigned short *)cur,(const unsigned short *)prev,m_w,wid,hei,costs);
+  else LCF_TileDeltaCosts(cur,prev,m_w*bps,wid*bps,hei,costs);
+
+  const int craw = costs[LCF_TILEMODE_RAW];
+  int mode = LCF_TILEMODE_RAW;
+  if (costs[LCF_TILEMODE_XOR] <= costs[LCF_TILEMODE_SUB]) { if (costs[LCF_TILEMODE_XOR] < craw - craw/4) mode = LCF_TILEMODE_XOR; }
+  else if (costs[LCF_TILEMODE_SUB] < craw - craw/4) mode = LCF_TILEMODE_SUB;
+  if (mode == LCF_TILEMODE_RAW) return mode;
+
+  unsigned char *out = s->deltabuf.ResizeOK(wid*hei*bps,false);
+  if (!out) return LCF_TILEMODE_RAW;
+  if (bps == 2) LCF_TileDeltaEncode((const unsigned short *)cur,(const unsigned short *)prev,m_w,wid,hei,mode,(unsigned short *)out);
+  else LCF_TileDeltaEncode(cur,prev,m_w*bps,wid*bps,hei,mode,out);
+  return mode;
+}
+
 void LICECaptureCompressor::BitmapToFrameRec(LICE_IBitmap *fr, frameRec *dest)
 {
-  unsigned short *outptr = dest->data;
+  unsigned char *outptr = dest->data;
   const LICE_pixel *p = fr->getBits();
   int span = fr->getRowSpan();
   if (fr->isFlipped())
@@ -211,40 +823,116 @@ void LICECaptureCompressor::BitmapToFrameRec(LICE_IBitmap *fr, frameRec *dest)
     p+=(fr->getHeight()-1)*span;
     span=-span;
   }
-  int h = fr->getHeight(),w=fr->getWidth();
-  while (h--)
+  const int h = fr->getHeight(),w=fr->getWidth();
+  const int rowbytes = w*(m_bpp/8);
+  int y;
+  for (y=0;y<h;y++)
   {
-    int x=w;
-    const LICE_pixel *sp = p;
-    while (x--)
+    switch (m_bpp)
     {
-      LICE_pixel pix = *sp++;
-      *outptr++ = (((int)LICE_GETR(pix)&0xF8)>>3) | (((int)LICE_GETG(pix)&0xFC)<<3) | (((int)LICE_GETB(pix)&0xF8)<<8);
+      case 16: LCF_RowTo565(p,(unsigned short *)outptr,w); break;
+      case 24: LCF_RowTo24(p,outptr,w); break;
+      default: LCF_RowTo32(p,outptr,w); break;
     }
+    outptr += rowbytes;
     p += span;
   }
 }
 
-void LICECaptureCompressor::DeflateBlock(void *data, int data_size, bool flush)
+void LICECaptureCompressor::BitmapToTile(LICE_IBitmap *fr, unsigned char *dest, int xpos, int ypos, int wid, int hei)
 {
-  m_current_block_srcsize += data_size;
-  m_inbytes += data_size;
+  const LICE_pixel *p = fr->getBits();
+  int span = fr->getRowSpan();
+  if (fr->isFlipped())
+  {
+    p+=(fr->getHeight()-1)*span;
+    span=-span;
+  }
+  p += ypos*span + xpos;
+  const int destspan = m_w*(m_bpp/8);
+  while (hei--)
+  {
+    switch (m_bpp)
+    {
+      case 16: LCF_RowTo565(p,(unsigned short *)dest,wid); break;
+      case 24: LCF_RowTo24(p,dest,wid); break;
+      default: LCF_RowTo32(p,dest,wid); break;
+    }
+    dest += destspan;
+    p += span;
+  }
+}
+
+void LICECaptureCompressor::LZBlock(streamRec *s, void *data, int data_size, bool flush)
+{
+  s->current_block_srcsize += data_size;
+  s->inbytes += data_size;
+
+  if (data_size>0) s->lz_window.Add((const unsigned char *)data,data_size);
+
+  int wsize = s->lz_window.GetSize();
+  if (wsize - s->lz_pending >= 65536 || (flush && wsize > s->lz_pending))
+  {
+    if (s->lz_hash.GetSize() != LICE_LZ_HASH_SIZE)
+    {
+      s->lz_hash.Resize(LICE_LZ_HASH_SIZE,false);
+      LICE_LZ_ResetHash(s->lz_hash.Get());
+    }
+
+    const int maxsz = LICE_LZ_MAXSIZE(wsize - s->lz_pending);
+    unsigned char *out = (unsigned char *)s->current_block.Add(NULL,maxsz);
+    const int len = LICE_LZ_Compress(s->lz_window.Get(),s->lz_pending,wsize,out,s->lz_hash.Get(),s->lz_base);
+    s->current_block.Add(NULL,len-maxsz);
+    s->outbytes += len;
+    s->lz_pending = wsize;
+
+    if (wsize > LICE_LZ_MAX_OFFSET+1)
+    {
+      const int drop = wsize - (LICE_LZ_MAX_OFFSET+1);
+      unsigned char *w = s->lz_window.Get();
+      memmove(w,w+drop,wsize-drop);
+      s->lz_window.Resize(wsize-drop,false);
+      s->lz_base += drop;
+      s->lz_pending -= drop;
+    }
+  }
+
+  if (flush)
+  {
+    // blocks are independent
+    s->lz_window.Resize(0,false);
+    s->lz_pending = s->lz_base = 0;
+    if (s->lz_hash.GetSize()) LICE_LZ_ResetHash(s->lz_hash.Get());
+  }
+}
+
+void LICECaptureCompressor::DeflateBlock(streamRec *s, void *data, int data_size, bool flush)
+{
+  if (m_codec == LICE_LCF_CODEC_LZ)
+  {
+    LZBlock(s,data,data_size,flush);
+    return;
+  }
+
+  s->current_block_srcsize += data_size;
+  s->inbytes += data_size;
   int bytesout=0;
 
-  m_compstream.next_in = (unsigned char *)data;
-  m_compstream.avail_in = data_size;
+  z_stream *cs = &s->compstream;
+  cs->next_in = (unsigned char *)data;
+  cs->avail_in = data_size;
   
   for (;;)
   {
     int add_sz = data_size+32768;
-    m_compstream.next_out = (unsigned char *)m_current_block.Add(NULL,add_sz);
-    m_compstream.avail_out = add_sz;
+    cs->next_out = (unsigned char *)s->current_block.Add(NULL,add_sz);
+    cs->avail_out = add_sz;
 
-    int e = deflate(&m_compstream,flush?Z_FULL_FLUSH:Z_NO_FLUSH);
+    int e = deflate(cs,flush?Z_FULL_FLUSH:Z_NO_FLUSH);
   
-    m_current_block.Add(NULL,-(int)m_compstream.avail_out);
+    s->current_block.Add(NULL,-(int)cs->avail_out);
 
-    bytesout+=add_sz-m_compstream.avail_out;
+    bytesout+=add_sz-cs->avail_out;
 
 
     if (e != Z_OK)
@@ -252,26 +940,50 @@ void LICECaptureCompressor::DeflateBlock(void *data, int data_size, bool flush)
       break;
     }
 
-    if (!m_compstream.avail_in && (!flush || add_sz==(int)m_compstream.avail_out)) break;
+    if (!cs->avail_in && (!flush || add_sz==(int)cs->avail_out)) break;
   }
-  m_outsize += bytesout;
+  s->outbytes += bytesout;
     
 }
 
 
 
+void LICECaptureCompressor::WriteIndex()
+{
+  m_hdrqueue.Clear();
+  AddHdrInt(LCF_INDEX);
+  AddHdrInt(m_index_nblocks);
+  m_file->Write(m_hdrqueue.Get(),m_hdrqueue.Available());
+  m_file->Write(m_index.Get(),m_index.Available());
+
+  m_hdrqueue.Clear();
+  m_hdrqueue.AddToLE(&m_writepos);
+  AddHdrInt((int)m_index_ms);
+  AddHdrInt(LCF_INDEX);
+  m_file->Write(m_hdrqueue.Get(),m_hdrqueue.Available());
+
+  const int sz = 8 + m_index.Available() + LCF_INDEX_TRAILERSIZE;
+  m_outsize += sz;
+  m_writepos += sz;
+  m_index.Clear();
+}
+
 LICECaptureCompressor::~LICECaptureCompressor()
 {
   // process any pending frames
   if (m_file)
   {
     OnFrame(NULL,0);
-    deflateEnd(&m_compstream);
+    if (m_index_nblocks) WriteIndex();
   }
+  FreeStreams();
 
   delete m_file;
   m_framelists[0].Empty(true);
   m_framelists[1].Empty(true);
+  m_tiles.Empty(true);
+  m_streamframes[0].Resize(0);
+  m_streamframes[1].Resize(0);
 }
 
 
@@ -300,7 +1012,7 @@ LICECaptureDecompressor::LICECaptureDecompressor(const char *fn, bool want_seeka
   m_frameidx=0;
   memset(&m_compstream,0,sizeof(m_compstream));
   memset(&m_curhdr,0,sizeof(m_curhdr));
-  m_file = new WDL_FileRead(fn,2,1024*1024);
+  m_file = new WDL_FileRead(fn,0,1024*1024,4,0,LCF_MMAP_MAXSIZE);
   if (m_file->IsOpen())
   {
     if (inflateInit(&m_compstream)!=Z_OK)
@@ -310,40 +1022,16 @@ LICECaptureDecompressor::LICECaptureDecompressor(const char *fn, bool want_seeka
     }
     if (m_file)
     {
-      m_file_frame_info.Clear();
+      m_seektab.Resize(0);
       m_file_length_ms=0;
-      if (want_seekable)
-      {
-        unsigned int lastpos = 0;
-        int first_frame_delay = 0;
-        while (ReadHdr(0))
-        {
-          m_file_frame_info.Add(&lastpos,1);
-          unsigned int mst = m_file_length_ms;
-          if (m_frame_deltas[0].GetSize()) 
-          {
-            if (lastpos > 0)
-              mst += m_frame_deltas[0].Get()[0]-first_frame_delay; // TOC is by time of first frames, ignore first delay when seeking
-            else
-              first_frame_delay = m_frame_deltas[0].Get()[0];
-          }
-          m_file_frame_info.Add(&mst,1);         
-
-          int x;
-          for(x=0;x<m_frame_deltas[0].GetSize();x++)
-          {
-            m_file_length_ms+=m_frame_deltas[0].Get()[x];
-          }
-
-          m_file->SetPosition(lastpos = (unsigned int)(m_file->GetPosition() + m_curhdr[0].cdata_left));
-        }
-      }
+      if (want_seekable && !ReadIndex()) ScanHeaders();
 
       Seek(0);
     }
   }
 
-  if (m_curhdr[m_rd_which].bpp!=16) 
+  const int bpp = m_curhdr[m_rd_which].bpp;
+  if (bpp!=16 && bpp!=24 && bpp!=32) 
   {
     delete m_file;
     m_file=0;
@@ -351,6 +1039,97 @@ LICECaptureDecompressor::LICECaptureDecompressor(const char *fn, bool want_seeka
 
 }
 
+bool LICECaptureDecompressor::ReadIndex()
+{
+  const WDL_INT64 fsize = m_file->GetSize();
+  if (fsize < 8 + LCF_INDEX_ENTRYSIZE + LCF_INDEX_TRAILERSIZE) return false;
+
+  m_tmp.Clear();
+  m_file->SetPosition(fsize - LCF_INDEX_TRAILERSIZE);
+  if (m_file->Read(m_tmp.Add(NULL,LCF_INDEX_TRAILERSIZE),LCF_INDEX_TRAILERSIZE)!=LCF_INDEX_TRAILERSIZE) return false;
+  WDL_INT64 idxpos=0;
+  unsigned int length_ms=0;
+  int tag=0;
+  m_tmp.GetTFromLE(&idxpos);
+  m_tmp.GetTFromLE(&length_ms);
+  m_tmp.GetTFromLE(&tag);
+  if (tag != LCF_INDEX || idxpos < 0 || idxpos > fsize - LCF_INDEX_TRAILERSIZE - 8) return false;
+
+  m_tmp.Clear();
+  m_file->SetPosition(idxpos);
+  if (m_file->Read(m_tmp.Add(NULL,8),8)!=8) return false;
+  int nblocks=0;
+  m_tmp.GetTFromLE(&tag);
+  m_tmp.GetTFromLE(&nblocks);
+  if (tag != LCF_INDEX || nblocks < 1 || 
+      (fsize - LCF_INDEX_TRAILERSIZE - idxpos - 8) != nblocks * (WDL_INT64)LCF_INDEX_ENTRYSIZE) return false;
+
+  m_tmp.Clear();
+  const int sz = nblocks * LCF_INDEX_ENTRYSIZE;
+  if (m_file->Read(m_tmp.Add(NULL,sz),sz)!=sz) return false;
+
+  int x;
+  for (x=0;x<nblocks;x++)
+  {
+    seekEntry e = { 0, 0 };
+    int flags=0;
+    m_tmp.GetTFromLE(&e.offset);
+    m_tmp.GetTFromLE(&e.ms);
+    m_tmp.GetTFromLE(&flags);
+    const seekEntry *last = m_seektab.GetSize() ? m_seektab.Get()+m_seektab.GetSize()-1 : NULL;
+    if (e.offset < (last ? last->offset+1 : 0) || e.offset >= idxpos || (last && e.ms < last->ms)) break;
+    if (flags & LCF_INDEX_KEYFRAME) m_seektab.Add(e);
+  }
+  if (x < nblocks || !m_seektab.GetSize() || m_seektab.Get()[0].offset || m_seektab.Get()[0].ms)
+  {
+    m_seektab.Resize(0);
+    return false;
+  }
+  m_file_length_ms = length_ms;
+  return true;
+}
+
+void LICECaptureDecompressor::ScanHeaders()
+{
+  WDL_INT64 lastpos = 0;
+  int first_frame_delay = 0;
+  m_file->SetPosition(0);
+  while (ReadHdr(0))
+  {
+    seekEntry e;
+    e.offset = lastpos;
+    e.ms = m_file_length_ms;
+    if (m_frame_deltas[0].GetSize()) 
+    {
+      if (lastpos > 0)
+        e.ms += m_frame_deltas[0].Get()[0]-first_frame_delay; // TOC is by time of first frames, ignore first delay when seeking
+      else
+        first_frame_delay = m_frame_deltas[0].Get()[0];
+    }
+    m_seektab.Add(e);
+
+    int x;
+    for(x=0;x<m_frame_deltas[0].GetSize();x++)
+    {
+      m_file_length_ms+=m_frame_deltas[0].Get()[x];
+    }
+
+    m_file->SetPosition(lastpos = m_file->GetPosition() + m_curhdr[0].cdata_left);
+  }
+}
+
+// returns the next len bytes of the file without copying them, if it is memory mapped
+const unsigned char *LICECaptureDecompressor::MapInput(int len)
+{
+  const WDL_INT64 pos = m_file->GetPosition();
+  if (pos < 0 || pos + len > LCF_MMAP_MAXSIZE) return NULL;
+  int avail = len;
+  const unsigned char *p = (const unsigned char *)m_file->GetMappedView((int)pos,&avail);
+  if (!p || avail != len) return NULL;
+  m_file->SetPosition(pos + len);
+  return p;
+}
+
 LICECaptureDecompressor::~LICECaptureDecompressor()
 {
   inflateEnd(&m_compstream);
@@ -383,18 +1162,21 @@ int LICECaptureDecompressor::Seek(unsigned int offset_ms)
 
   int rval=0;
 
-  unsigned int seekpos=0;
+  WDL_INT64 seekpos=0;
   m_frameidx=0;
-  if (offset_ms>0&&m_file_frame_info.GetSize())
+  if (offset_ms>0&&m_seektab.GetSize())
   {
-    int x;
-    for(x=0;x<m_file_frame_info.GetSize()-2;x+=2)
+    // last block starting at or before offset_ms
+    const seekEntry *tab = m_seektab.Get();
+    int lo=0, hi=m_seektab.GetSize()-1;
+    while (lo < hi)
     {
-      if (offset_ms < m_file_frame_info.Get()[x+2+1]) break;
+      const int mid = (lo+hi+1)/2;
+      if (offset_ms < tab[mid].ms) hi=mid-1;
+      else lo=mid;
     }
-    seekpos = m_file_frame_info.Get()[x];
-    offset_ms -= m_file_frame_info.Get()[x+1];
-    // figure out the best place to seek
+    seekpos = tab[lo].offset;
+    offset_ms -= tab[lo].ms;
   }
   else 
   {
@@ -437,13 +1219,14 @@ int LICECaptureDecompressor::Seek(unsigned int offset_ms)
 
 bool LICECaptureDecompressor::ReadHdr(int whdr) // todo: eventually make this read/decompress the next header as it goes
 {
+  m_compstream.avail_out = 0;
   m_tmp.Clear();
   int hdr_sz = (4*9);
   if (m_file->Read(m_tmp.Add(NULL,hdr_sz),hdr_sz)!=hdr_sz) return false;
   m_bytes_read+=hdr_sz;
   int ver=0;
   m_tmp.GetTFromLE(&ver);
-  if (ver !=LCF_VERSION) return false;
+  if (ver !=LCF_VERSION && ver != LCF_VERSION2 && ver != LCF_VERSION3) return false;
   m_tmp.GetTFromLE(&m_curhdr[whdr].bpp);
   m_tmp.GetTFromLE(&m_curhdr[whdr].w);
   m_tmp.GetTFromLE(&m_curhdr[whdr].h);
@@ -470,10 +1253,61 @@ bool LICECaptureDecompressor::ReadHdr(int whdr) // todo: eventually make this re
   {
     WDL_Queue::WDL_Queue__bswap_buffer(m_frame_deltas[whdr].Get()+x,4);
   }
+
+  int codec=LICE_LCF_CODEC_DEFLATE;
+  if (ver == LCF_VERSION3)
+  {
+    if (m_file->Read(&codec,4)!=4) return false;
+    WDL_Queue::WDL_Queue__bswap_buffer(&codec,4);
+    m_bytes_read+=4;
+    if (codec & ~(LCF_CODEC_MASK|LCF_FLAG_TILEDELTA)) return false;
+    if ((codec&LCF_CODEC_MASK) != LICE_LCF_CODEC_DEFLATE && (codec&LCF_CODEC_MASK) != LICE_LCF_CODEC_LZ) return false;
+  }
+
+  int nstreams=1;
+  if (ver != LCF_VERSION)
+  {
+    if (m_file->Read(&nstreams,4)!=4) return false;
+    WDL_Queue::WDL_Queue__bswap_buffer(&nstreams,4);
+    m_bytes_read+=4;
+    if (nstreams<1 || nstreams>LCF_MAX_STREAMS) return false;
+  }
+
+  int *si = m_streaminfo[whdr].Resize(nstreams*3,false);
+  if (m_streaminfo[whdr].GetSize()!=nstreams*3) return false;
+  if (ver != LCF_VERSION)
+  {
+    int csum=0, dsum=0;
+    for (x=0;x<nstreams;x++)
+    {
+      int v[2];
+      if (m_file->Read(v,8)!=8) return false;
+      WDL_Queue::WDL_Queue__bswap_buffer(v,4);
+      WDL_Queue::WDL_Queue__bswap_buffer(v+1,4);
+      m_bytes_read+=8;
+      if (v[0]<0 || v[1]<0) return false;
+      si[x*3]=v[0];
+      si[x*3+1]=v[1];
+      si[x*3+2]=dsum;
+      csum+=v[0];
+      dsum+=v[1];
+    }
+    if (csum != csize || dsum != dsize) return false;
+  }
+  else
+  {
+    si[0]=csize;
+    si[1]=dsize;
+    si[2]=0;
+  }
+
   m_curhdr[whdr].cdata_left = csize;
+  m_curhdr[whdr].codec = codec & LCF_CODEC_MASK;
+  m_curhdr[whdr].flags = codec & ~LCF_CODEC_MASK;
+  m_curhdr[whdr].nstreams = nstreams;
+  m_curhdr[whdr].curstream = -1;
+  m_curhdr[whdr].stream_cleft = 0;
 
-  inflateReset(&m_compstream);
-  m_compstream.avail_out = dsize;
   m_compstream.next_out = (unsigned char *)m_decompdata[whdr].Resize(dsize,false);
   if (m_decompdata[whdr].GetSize()!=dsize) return false;
 
@@ -483,34 +1317,78 @@ bool LICECaptureDecompressor::ReadHdr(int whdr) // todo: eventually make this re
   
 bool LICECaptureDecompressor::DecompressBlock(int whdr, double percent)
 {
-  if (m_compstream.avail_out) 
+  hdrType *hdr = m_curhdr+whdr;
+  unsigned char *base = (unsigned char *)m_decompdata[whdr].Get();
+  const int dsize = m_decompdata[whdr].GetSize();
+  unsigned char buf[16384];
+  for (;;)
   {
-    unsigned char buf[16384];
-    for (;;)
+    if (percent<1.0&&dsize)
+    {
+      double p = (m_compstream.next_out - base) / (double)dsize;
+      if (p>percent) break;
+    }
+
+    if (!m_compstream.avail_out)
     {
-      if (percent<1.0&&m_decompdata[whdr].GetSize())
+      // current stream is complete, skip anything left of it and start the next one
+      if (hdr->stream_cleft > 0)
       {
-        double p =  ((m_decompdata[whdr].GetSize()-m_compstream.avail_out)/(double)m_decompdata[whdr].GetSize());
-        if (p>percent) break;
+        m_file->SetPosition(m_file->GetPosition() + hdr->stream_cleft);
+        m_bytes_read+=hdr->stream_cleft;
+        hdr->cdata_left -= hdr->stream_cleft;
+        hdr->stream_cleft=0;
       }
-      m_compstream.next_in = buf;
-      m_compstream.avail_in = m_curhdr[whdr].cdata_left;
-      if (m_compstream.avail_in > (int)sizeof(buf)) m_compstream.avail_in=(int)sizeof(buf);
-
-      m_compstream.avail_in = m_file->Read(buf,m_compstream.avail_in);
-      m_bytes_read+=m_compstream.avail_in;
-      m_curhdr[whdr].cdata_left -= m_compstream.avail_in;
+      if (hdr->curstream+1 >= hdr->nstreams) break;
 
-      int e = inflate(&m_compstream,0);
-      if (e != Z_OK&&e!=Z_STREAM_END) 
+      const int *si = m_streaminfo[whdr].Get() + 3 * ++hdr->curstream;
+      if (hdr->codec == LICE_LCF_CODEC_LZ)
       {
-//        printf("inflate error: %d (%d/%d)\n",e,m_compstream.avail_in, m_curhdr[whdr].cdata_left);
-        return !m_compstream.avail_out;
-      }   
-      if (!m_compstream.avail_out && !m_compstream.avail_in) break;
+        // decoded a stream at a time, the codec is fast enough that progressive decoding isn't worth it
+        const unsigned char *cbuf = MapInput(si[0]);
+        if (!cbuf)
+        {
+          unsigned char *rdbuf = (unsigned char *)m_lzbuf.Resize(si[0],false);
+          if (m_lzbuf.GetSize() != si[0] || m_file->Read(rdbuf,si[0]) != si[0]) return false;
+          cbuf = rdbuf;
+        }
+        m_bytes_read+=si[0];
+        hdr->cdata_left -= si[0];
+        if (!LICE_LZ_Decompress(cbuf,si[0],base+si[2],si[1])) return false;
+        m_compstream.next_out = base + si[2] + si[1];
+        continue;
+      }
+
+      inflateReset(&m_compstream);
+      m_compstream.next_out = base + si[2];
+      m_compstream.avail_out = si[1];
+      hdr->stream_cleft = si[0];
+      continue;
     }
-    m_compstream.next_in = NULL;
+
+    m_compstream.avail_in = hdr->stream_cleft;
+    if (m_compstream.avail_in > (int)sizeof(buf)) m_compstream.avail_in=(int)sizeof(buf);
+
+    const unsigned char *mapped = MapInput(m_compstream.avail_in);
+    if (mapped) m_compstream.next_in = (Bytef *)mapped;
+    else
+    {
+      m_compstream.next_in = buf;
+      m_compstream.avail_in = m_file->Read(buf,m_compstream.avail_in);
+    }
+    m_bytes_read+=m_compstream.avail_in;
+    hdr->cdata_left -= m_compstream.avail_in;
+    hdr->stream_cleft -= m_compstream.avail_in;
+
+    int e = inflate(&m_compstream,0);
+    if (e != Z_OK&&e!=Z_STREAM_END) 
+    {
+//      printf("inflate error: %d (%d/%d)\n",e,m_compstream.avail_in, hdr->cdata_left);
+      m_compstream.next_in = NULL;
+      return !m_compstream.avail_out && hdr->curstream+1 >= hdr->nstreams;
+    }   
   }
+  m_compstream.next_in = NULL;
 
   return true;
 }
@@ -556,6 +1434,7 @@ void LICECaptureDecompressor::DecodeSlices()
       totw=hdr->w;
 
   int bytespersample = (hdr->bpp+7)/8;
+  const bool tiledelta = !!(hdr->flags & LCF_FLAG_TILEDELTA);
 
   for (ypos = 0; ypos < toth; ypos+=hdr->bsize_h)
   {
@@ -573,10 +1452,16 @@ void LICECaptureDecompressor::DecodeSlices()
       void *lvalid = NULL;
       while (i<nf&&sp_left>0)
       {
+        int mode = LCF_TILEMODE_RAW;
         if (lvalid)
         {
           unsigned char c = *sp++;
           sp_left--;
+          if (tiledelta)
+          {
+            mode = c>>6;
+            c &= 63;
+          }
           while (c-->0 && i++ < nf)
           {
             // repeat last slice
@@ -586,6 +1471,15 @@ void LICECaptureDecompressor::DecodeSlices()
         }
         if (i<nf)
         {
+          if (mode != LCF_TILEMODE_RAW && sz1 <= sp_left)
+          {
+            // residual against the previous slice, reconstructed in place (each block is decoded once)
+            if (!DecodeTileDelta(sp,(const unsigned char *)lvalid,sz1,mode,bytespersample))
+            {
+              m_slices.Resize(0);
+              return;
+            }
+          }
           lvalid = slicelist[slicewritepos] = sp;
           slicewritepos += ns_frame;
           sp += sz1;
@@ -605,6 +1499,34 @@ void LICECaptureDecompressor::DecodeSlices()
 }
 
 
+bool LICECaptureDecompressor::DecodeTileDelta(unsigned char *sp, const unsigned char *prev, int sz, int mode, int bytespersample)
+{
+  int x;
+  switch (mode)
+  {
+    case LCF_TILEMODE_XOR:
+      for (x=0;x<sz;x++) sp[x] ^= prev[x];
+    return true;
+    case LCF_TILEMODE_SUB:
+      if (bytespersample == 2)
+      {
+        // little endian samples, may be unaligned
+        for (x=0;x+1<sz;x+=2)
+        {
+          const int v = (sp[x] | (sp[x+1]<<8)) + (prev[x] | (prev[x+1]<<8));
+          sp[x] = (unsigned char)v;
+          sp[x+1] = (unsigned char)(v>>8);
+        }
+      }
+      else
+      {
+        for (x=0;x<sz;x++) sp[x] += prev[x];
+      }
+    return true;
+  }
+  return false;
+}
+
 LICE_IBitmap *LICECaptureDecompressor::GetCurrentFrame()
 {
   int nf = m_frame_deltas[m_rd_which].GetSize();
@@ -620,15 +1542,15 @@ LICE_IBitmap *LICECaptureDecompressor::GetCurrentFrame()
     if (m_slices.GetSize() != ns_frame*nf)
       return NULL; // invalid slices
 
-    if (hdr->bpp == 16)
+    if (hdr->bpp == 16 || hdr->bpp == 24 || hdr->bpp == 32)
     {
       m_workbm.resize(hdr->w,hdr->h);
-      //unsigned short *
       // format of m_decompdata is:
       // nf frames of slice1, nf frames of slice2, etc
 
       LICE_pixel *pout = m_workbm.getBits();
       int span = m_workbm.getRowSpan();
+      const int bps = hdr->bpp/8;
 
       int ypos,
           toth=hdr->h,
@@ -645,7 +1567,7 @@ LICE_IBitmap *LICECaptureDecompressor::GetCurrentFrame()
           int wid  = totw-xpos;
           if (wid>hdr->bsize_w) wid=hdr->bsize_w;
 
-          unsigned short *rdptr = (unsigned short *)*sliceptr;
+          const unsigned char *rdptr = (const unsigned char *)*sliceptr;
 
           sliceptr++;
 
@@ -653,13 +1575,13 @@ LICE_IBitmap *LICECaptureDecompressor::GetCurrentFrame()
           int y;
           for (y=0;y<hei;y++)
           {
-            int x=wid;
-            LICE_pixel *wr = dest;
-            while (x--)
+            switch (bps)
             {
-              unsigned short px = *rdptr++;
-              *wr++ = LICE_RGBA((px<<3)&0xF8,(px>>3)&0xFC,(px>>8)&0xF8,255);
+              case 2: LCF_RowFrom565(rdptr,dest,wid); break;
+              case 3: LCF_RowFrom24(rdptr,dest,wid); break;
+              default: LCF_RowFrom32(rdptr,dest,wid); break;
             }
+            rdptr += wid*bps;
             dest+=span;
           }         
         }
@@ -9,18 +9,48 @@
 class WDL_FileWrite;
 class WDL_FileRead;
 
+#define LICE_LCF_LEVEL_ADAPTIVE -1 // start at 6, adjust 1-9 per block to keep compression well under real time
+
+// codec IDs stored in version 3 block headers
+#define LICE_LCF_CODEC_DEFLATE 0
+#define LICE_LCF_CODEC_LZ 1 // lice_lz.h, much faster than deflate but larger output
+
 class LICECaptureCompressor
 {
 public:
-  LICECaptureCompressor(const char *outfn, int w, int h, int interval=20, int bsize_w=128, int bsize_h=16);
+  // level is the deflate level (0-9) or LICE_LCF_LEVEL_ADAPTIVE
+  LICECaptureCompressor(const char *outfn, int w, int h, int interval=20, int bsize_w=128, int bsize_h=16, int level=9);
 
   ~LICECaptureCompressor();
 
   bool IsOpen() { return !!m_file; }
   void OnFrame(LICE_IBitmap *fr, int delta_t_ms);
 
+  // call before the first frame: nthreads<=0 uses the number of CPUs, nstreams<=0 uses one stream per thread.
+  // the tiles of each block are split into nstreams groups that are deflated independently (in parallel).
+  // more than one stream writes version 2 blocks, which older readers can't open
+  void SetThreads(int nthreads, int nstreams=0);
+
+  // call before the first frame. codecs other than deflate write version 3 blocks, which older readers can't open
+  void SetCodec(int codec);
+
+  // call before the first frame. 16 (default) stores RGB565, 24 (RGB) and 32 (RGB + unused byte) are lossless
+  void SetBitDepth(int bpp);
+
+  // call before the first frame. tiles that changed since the previous frame may be stored as the XOR or
+  // difference against it, whichever is estimated to compress best. writes version 3 blocks
+  void SetTileDelta(bool enable);
+
+  // call before the first frame. if maxmem>0, frames are not kept until their block is compressed: the tiles of
+  // each frame are compared (and delta coded) against the previous frame as it arrives, and only changed tiles
+  // are kept. a block that would keep more than maxmem bytes ends early and is compressed right away. uses two
+  // frames plus up to maxmem, rather than 2*interval frames. with deflate the output is the same unless blocks end early
+  void SetStreaming(int maxmem);
+
   WDL_INT64 GetOutSize() { return m_outsize; }
   WDL_INT64 GetInSize() { return m_inbytes; }
+  WDL_INT64 GetPendingSize() { return m_streammem ? m_pending : 0; } // SetStreaming(): bytes of tiles kept
+  int GetLevel() { return m_level; } // current deflate level, changes over time in adaptive mode
 
 private:
   WDL_FileWrite *m_file;
@@ -28,27 +58,89 @@ private:
   int m_inframes, m_outframes;
 
   int m_w,m_h,m_interval,m_bsize_w,m_bsize_h;
+  int m_nthreads;
+  int m_bpp;
+  int m_level;
+  int m_codec;
+  bool m_adaptive;
+  bool m_tiledelta;
+  double m_comptime; // seconds spent compressing the current block
 
 
   struct frameRec
   {
-    frameRec(int sz) { data=(unsigned short *)malloc(sz*sizeof(short)); delta_t_ms=0; }
+    frameRec(int sz) { data=(unsigned char *)malloc(sz); delta_t_ms=0; }
     ~frameRec() { free(data); }
-    unsigned short *data; // shorts
+    unsigned char *data; // m_bpp/8 bytes per pixel
     int delta_t_ms; // time (ms) since last frame
   };
   WDL_PtrList<frameRec> m_framelists[2];
-  WDL_Queue m_current_block;
   WDL_Queue m_hdrqueue;
 
-  int m_state, m_which,m_outchunkpos,m_numrows,m_numcols;
-  int m_current_block_srcsize;
+  // SetStreaming(): encoded tiles of the current block (m_which) and of the block being compressed.
+  // each holds what CompressChunks() would produce for that tile, less the final repeat count
+  struct tileRec
+  {
+    WDL_TypedBuf<unsigned char> data[2];
+    int repeat_cnt[2];
+  };
+  int m_streammem;
+  WDL_INT64 m_pending; // bytes in tileRec::data
+  WDL_PtrList<tileRec> m_tiles;
+  WDL_TypedBuf<unsigned char> m_streamframes[2]; // the current and previous frames, m_bpp/8 bytes per pixel
+  int m_streamcur; // index of the current frame in m_streamframes
+  WDL_TypedBuf<int> m_delays[2]; // delta_t_ms of each frame of the block
+  LICE_IBitmap *m_jobframe;
+
+  WDL_INT64 m_writepos; // file offset of the next block
+  WDL_Queue m_index; // entries for WriteIndex()
+  int m_index_nblocks;
+  unsigned int m_index_ms, m_index_firstdelay;
+
+  // a deflate stream covering tiles [chunkstart,chunkend) of each block
+  struct streamRec
+  {
+    z_stream compstream;
+    WDL_Queue current_block;
+    int current_block_srcsize;
+    int chunkstart, chunkend, outchunkpos, compressTo;
+    int inbytes, outbytes; // added to m_inbytes/m_outsize after the jobs complete
+
+    // LICE_LCF_CODEC_LZ: up to 64k of history followed by data not yet compressed (from lz_pending)
+    WDL_TypedBuf<unsigned char> lz_window;
+    WDL_TypedBuf<int> lz_hash;
+    int lz_pending, lz_base; // lz_base is the stream position of lz_window[0]
+
+    WDL_TypedBuf<unsigned char> deltabuf;
+    int pending; // SetStreaming(): change in m_pending, applied after the jobs complete
+  };
+  WDL_PtrList<streamRec> m_streams;
 
-  z_stream m_compstream;
+  int m_state, m_which,m_numrows,m_numcols;
+
+  // set for the duration of the parallel jobs
+  frameRec **m_joblist;
+  int m_joblist_size;
+  bool m_jobflush;
 
   void BitmapToFrameRec(LICE_IBitmap *fr, frameRec *dest);
-  void DeflateBlock(void *data, int data_size, bool flush);
+  void BitmapToTile(LICE_IBitmap *fr, unsigned char *dest, int xpos, int ypos, int wid, int hei);
+  int BlockFrames(int which) { return m_streammem ? m_delays[which].GetSize() : m_framelists[which].GetSize(); }
+  int BlockDelay(int which, int idx) { return m_streammem ? m_delays[which].Get()[idx] : m_framelists[which].Get(idx)->delta_t_ms; }
+  void EncodeTiles(streamRec *s);
+  static void EncodeStreamJob(void *ctx, int idx);
+  void CompressChunks(streamRec *s);
+  static void CompressStreamJob(void *ctx, int idx);
+  void DeflateBlock(streamRec *s, void *data, int data_size, bool flush);
+  void LZBlock(streamRec *s, void *data, int data_size, bool flush);
+  int EncodeTileDelta(streamRec *s, const unsigned char *prev, const unsigned char *cur, int wid, int hei);
   void AddHdrInt(int a) { m_hdrqueue.AddToLE(&a); }
+  void WriteIndex();
+  bool InitDeflate(z_stream *cs, int level);
+  void TuneDeflate(z_stream *cs, int level);
+  bool InitStreams(int nstreams);
+  void FreeStreams();
+  void AdaptLevel(int budget_ms);
 
 
 };
@@ -57,6 +149,7 @@ private:
 class LICECaptureDecompressor
 {
 public:
+  // want_seekable uses the index written at the end of the file, or scans the block headers if there isn't one
   LICECaptureDecompressor(const char *fn, bool want_seekable=false);
   ~LICECaptureDecompressor();
 
@@ -85,6 +178,8 @@ private:
     int w, h;
     int bsize_w, bsize_h;
     int cdata_left;
+    int codec, flags;
+    int nstreams, curstream, stream_cleft;
   } m_curhdr[2];
 
   int m_rd_which;
@@ -99,13 +194,24 @@ private:
   WDL_FileRead *m_file;
 
   unsigned int m_file_length_ms;
-  WDL_TypedQueue<unsigned int> m_file_frame_info; //pairs of offset_bytes, offset_ms
+  struct seekEntry
+  {
+    WDL_INT64 offset; // of the block header
+    unsigned int ms;
+  };
+  WDL_TypedBuf<seekEntry> m_seektab;
+  bool ReadIndex();
+  void ScanHeaders();
+  const unsigned char *MapInput(int len);
 
   WDL_TypedBuf<int> m_frame_deltas[2];
+  WDL_TypedBuf<int> m_streaminfo[2]; // csize, dsize, offset of each stream in the block
+  WDL_HeapBuf m_lzbuf;
   WDL_HeapBuf m_decompdata[2];
   WDL_TypedBuf<void *> m_slices; // indexed by [frame][slice]
 
   void DecodeSlices();
+  static bool DecodeTileDelta(unsigned char *sp, const unsigned char *prev, int sz, int mode, int bytespersample);
 };
 
 #endif
@@ -0,0 +1,158 @@
+#ifndef _LICE_LZ_H_
+#define _LICE_LZ_H_
+
+/*
+  Cockos WDL - LICE - Lightweight Image Compositing Engine
+  See lice.h for license and other information
+
+  Fast byte-oriented LZ77 codec (no entropy coding), used for LCF blocks when capture speed
+  matters more than size. The format is a series of sequences:
+
+    token: high nibble = literal count, low nibble = match length-4 (15 = more length bytes follow)
+    [literal count extension: bytes of 255 terminated by a byte <255]
+    literals
+    16-bit little endian match offset, 0 = no match (the token's low nibble is then 0)
+    [match length extension, same encoding as the literal count]
+
+  Matches refer back up to 65535 bytes, and may refer to data compressed by a previous call,
+  which lets a stream be compressed incrementally from a sliding window.
+*/
+
+#include <string.h>
+
+#include "../wdltypes.h"
+
+#define LICE_LZ_HASH_BITS 14
+#define LICE_LZ_HASH_SIZE (1<<LICE_LZ_HASH_BITS)
+#define LICE_LZ_MAX_OFFSET 65535
+#define LICE_LZ_MAXSIZE(n) ((n) + (n)/255 + 16) // worst case output size for n bytes of input
+
+static WDL_STATICFUNC_UNUSED void LICE_LZ_ResetHash(int *hashtab)
+{
+  memset(hashtab,0xC0,LICE_LZ_HASH_SIZE*sizeof(int)); // large negative positions, never valid
+}
+
+static inline unsigned int LICE_LZ_Read32(const unsigned char *p)
+{
+  unsigned int v;
+  memcpy(&v,p,4);
+  return v;
+}
+
+static inline unsigned char *LICE_LZ_PutLength(unsigned char *op, int len)
+{
+  while (len >= 255) { *op++ = 255; len -= 255; }
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+static inline unsigned char *LICE_LZ_PutSequence(unsigned char *op, const unsigned char *lit, int litlen, int offs, int matchlen)
+{
+  const int ml = offs ? matchlen-4 : 0;
+  *op++ = (unsigned char) (((litlen < 15 ? litlen : 15)<<4) | (ml < 15 ? ml : 15));
+  if (litlen >= 15) op = LICE_LZ_PutLength(op,litlen-15);
+  memcpy(op,lit,litlen);
+  op += litlen;
+  *op++ = (unsigned char) (offs&0xff);
+  *op++ = (unsigned char) (offs>>8);
+  if (ml >= 15) op = LICE_LZ_PutLength(op,ml-15);
+  return op;
+}
+
+// compresses src[start..end), matches may refer back into src[0..start). hashtab holds positions
+// offset by posbase (the stream position of src[0]), so it stays valid when the window is shifted.
+// dest must have room for LICE_LZ_MAXSIZE(end-start) bytes. returns the number of bytes written.
+static WDL_STATICFUNC_UNUSED int LICE_LZ_Compress(const unsigned char *src, int start, int end, unsigned char *dest, int *hashtab, int posbase)
+{
+  unsigned char *op = dest;
+  int ip = start, anchor = start;
+  const int limit = end - 4;
+
+  while (ip <= limit)
+  {
+    const unsigned int v = LICE_LZ_Read32(src+ip);
+    const unsigned int h = (v * 2654435761u) >> (32-LICE_LZ_HASH_BITS);
+    int cand = hashtab[h] - posbase;
+    hashtab[h] = ip + posbase;
+
+    if (cand < 0 || ip-cand > LICE_LZ_MAX_OFFSET || LICE_LZ_Read32(src+cand) != v)
+    {
+      ip += 1 + ((ip-anchor)>>6); // skip faster through incompressible data
+      continue;
+    }
+
+    int len = 4;
+    while (ip+len < end && src[cand+len] == src[ip+len]) len++;
+    while (ip > anchor && cand > 0 && src[ip-1] == src[cand-1]) { ip--; cand--; len++; }
+
+    op = LICE_LZ_PutSequence(op,src+anchor,ip-anchor,ip-cand,len);
+    ip += len;
+    anchor = ip;
+    if (ip-2 >= 0 && ip-2 <= limit) hashtab[(LICE_LZ_Read32(src+ip-2) * 2654435761u) >> (32-LICE_LZ_HASH_BITS)] = ip-2 + posbase;
+  }
+
+  if (anchor < end) op = LICE_LZ_PutSequence(op,src+anchor,end-anchor,0,0);
+  return (int) (op - dest);
+}
+
+// decompresses a complete stream of exactly destlen bytes. returns false if the data is invalid.
+static WDL_STATICFUNC_UNUSED bool LICE_LZ_Decompress(const unsigned char *src, int srclen, unsigned char *dest, int destlen)
+{
+  const unsigned char *ip = src, *iend = src + srclen;
+  unsigned char *op = dest, *oend = dest + destlen;
+
+  while (ip < iend)
+  {
+    const int token = *ip++;
+    int litlen = token>>4;
+    if (litlen == 15)
+    {
+      int c;
+      do
+      {
+        if (ip >= iend) return false;
+        c = *ip++;
+        litlen += c;
+      }
+      while (c == 255);
+    }
+    if (litlen > iend-ip || litlen > oend-op) return false;
+    memcpy(op,ip,litlen);
+    op += litlen;
+    ip += litlen;
+
+    if (iend-ip < 2) return false;
+    const int offs = ip[0] | (ip[1]<<8);
+    ip += 2;
+    if (!offs) continue;
+
+    int matchlen = (token&15);
+    if (matchlen == 15)
+    {
+      int c;
+      do
+      {
+        if (ip >= iend) return false;
+        c = *ip++;
+        matchlen += c;
+      }
+      while (c == 255);
+    }
+    matchlen += 4;
+    if (offs > op-dest || matchlen > oend-op) return false;
+
+    const unsigned char *mp = op - offs;
+    if (offs >= matchlen)
+    {
+      memcpy(op,mp,matchlen);
+      op += matchlen;
+    }
+    else
+    {
+      while (matchlen--) *op++ = *mp++; // overlapping, repeats the last offs bytes
+    }
+  }
+  return op == oend;
+}
+
+#endif
@@ -1,27 +1,41 @@
 #include "lice.h"
 #include "../ptrlist.h"
 #include "../wdltypes.h"
+#include "../heapbuf.h"
+#include "lice_parallel.h"
+
+#if defined(__SSE2__) || _M_IX86_FP >= 2 || defined(_M_X64)
+  #include <emmintrin.h>
+  #define LICE_PAL_SSE2
+#endif
 
 
 #define OCTREE_DEPTH 5  // every depth level adds 3 bits of RGB colorspace (depth 8 => 24-bit RGB)
 
+// nodes live in a single pool owned by the tree and refer to each other by index.
+// index 0 is unused so that 0 can mean "none" for children/next/branches
+#define OCTREE_TRUNK 1
 struct ONode
 {
   WDL_INT64 colorcount;  // number of color instances at or below this node
   WDL_INT64 sumrgb[3];
   int childflag;   // 0=leaf, >0=index of single child, <0=branch
   int leafidx;     // populated at the end
-  ONode* next;     // for OTree::branches
-  ONode* children[8];
+  int next;        // for OTree::branches, OTree::spares
+  int children[8];
 };
 
+// every node is on the path to a leaf, and leafcount never exceeds maxcolors+1
+#define OCTREE_MAXNODES(maxcolors) (2 + OCTREE_DEPTH*((maxcolors)+1))
+
 struct OTree
 {
   int maxcolors;
   int leafcount;  
-  ONode* trunk;
-  ONode* branches[OCTREE_DEPTH];  // linked lists of branches for each level of the tree
-  ONode* spares;
+  int branches[OCTREE_DEPTH];  // linked lists of branches for each level of the tree
+  int spares; // free list of deleted nodes
+  ONode* nodes; // nodes[OCTREE_TRUNK] is the trunk
+  int nodes_used, nodes_alloc;
   LICE_pixel* palette;  // populated at the end
   bool palette_valid;
 };
@@ -38,12 +52,50 @@ int LICE_BuildPalette(LICE_IBitmap* bmp, LICE_pixel* palette, int maxcolors)
 }
 
 
-static void AddColorToTree(OTree*, const LICE_pixel_chan *rgb);
+static void AddColorToTree(OTree*, const LICE_pixel_chan *rgb, int cnt);
+static void AddRunToTree(OTree*, const LICE_pixel_chan *rgb, int cnt);
 static int FindColorInTree(OTree*, const LICE_pixel_chan *rgb);
 static int PruneTree(OTree*);
-static void DeleteNode(OTree*, ONode*, ONode **delete_to);
+static void DeleteNode(OTree*, int idx);
 static int CollectLeaves(OTree*);
-static int CollectNodeLeaves(ONode* node, LICE_pixel* palette, int colorcount);
+static int CollectNodeLeaves(OTree*, ONode* node, LICE_pixel* palette, int colorcount);
+static void FillNodeTable(const OTree*, const ONode* p, unsigned char *tab, int sz, int r, int g, int b);
+
+
+static bool AllocNodes(OTree* tree, int maxcolors)
+{
+  const int n = OCTREE_MAXNODES(maxcolors);
+  if (n <= tree->nodes_alloc) return true;
+  ONode* nodes = (ONode*)realloc(tree->nodes, n*sizeof(ONode));
+  if (!nodes) return false;
+  tree->nodes = nodes;
+  tree->nodes_alloc = n;
+  return true;
+}
+
+// returns index of a cleared node, or 0 on allocation failure
+static int NewNode(OTree* tree)
+{
+  int idx = tree->spares;
+  if (idx)
+  {
+    tree->spares = tree->nodes[idx].next;
+  }
+  else
+  {
+    if (tree->nodes_used >= tree->nodes_alloc)
+    {
+      // only reachable for tiny maxcolors, where pruning can't keep up with the estimate
+      ONode* nodes = (ONode*)realloc(tree->nodes, tree->nodes_alloc*2*sizeof(ONode));
+      if (!nodes) return 0;
+      tree->nodes = nodes;
+      tree->nodes_alloc *= 2;
+    }
+    idx = tree->nodes_used++;
+  }
+  memset(tree->nodes+idx, 0, sizeof(ONode));
+  return idx;
+}
 
 
 void* LICE_CreateOctree(int maxcolors)
@@ -51,9 +103,13 @@ void* LICE_CreateOctree(int maxcolors)
   OTree* tree = new OTree;
   memset(tree, 0, sizeof(OTree));
   tree->maxcolors = maxcolors;
-  tree->trunk = new ONode;
-  memset(tree->trunk, 0, sizeof(ONode));
-  tree->spares = NULL;
+  if (!AllocNodes(tree, maxcolors))
+  {
+    delete tree;
+    return NULL;
+  }
+  memset(tree->nodes, 0, (OCTREE_TRUNK+1)*sizeof(ONode));
+  tree->nodes_used = OCTREE_TRUNK+1;
   return tree;
 }
 
@@ -69,17 +125,17 @@ void LICE_ResetOctree(void *octree, int maxc)
     tree->palette=0;
   }
 
-  DeleteNode(tree, tree->trunk, &tree->spares);
+  AllocNodes(tree, maxc); // on failure, keep the old pool and grow on demand
+
+  // the whole pool becomes free again, no need to walk the tree
+  tree->nodes_used = OCTREE_TRUNK+1;
+  tree->spares = 0;
   tree->leafcount = 0;
   tree->maxcolors = maxc;
   tree->palette_valid=false;
   memset(tree->branches,0,sizeof(tree->branches));
 
-  tree->trunk=tree->spares;
-  if (tree->trunk) tree->spares = tree->trunk->next;
-  else tree->trunk = new ONode;
-
-  memset(tree->trunk, 0, sizeof(ONode));
+  memset(tree->nodes+OCTREE_TRUNK, 0, sizeof(ONode));
 }
 
 void LICE_DestroyOctree(void* octree)
@@ -87,16 +143,7 @@ void LICE_DestroyOctree(void* octree)
   OTree* tree = (OTree*)octree;
   if (!tree) return;
 
-  DeleteNode(tree, tree->trunk, NULL);
-
-  ONode *p = tree->spares;
-  while (p)
-  {
-    ONode *del = p;
-    p = p->next;
-
-    delete del;
-  }
+  free(tree->nodes);
   free(tree->palette);
   delete tree;
 }
@@ -117,12 +164,15 @@ int LICE_BuildOctree(void* octree, LICE_IBitmap* bmp)
   for (y = 0; y < h; ++y)
   {
     const LICE_pixel *px = bits+y*rowspan;
-    int x=w;
-    while (x--)
-    {    
-      AddColorToTree(tree, (const LICE_pixel_chan*)px);      
-      if (tree->leafcount > tree->maxcolors) PruneTree(tree);
-      px++;
+    int x=0;
+    while (x < w)
+    {
+      // runs of the same color (flat UI areas) only need one walk down the tree
+      const LICE_pixel c = px[x] & LICE_RGBA(255,255,255,0);
+      int run=1;
+      while (x+run < w && (px[x+run] & LICE_RGBA(255,255,255,0)) == c) run++;
+      AddRunToTree(tree, (const LICE_pixel_chan*)(px+x), run);
+      x+=run;
     }
   }
 
@@ -148,9 +198,9 @@ int LICE_BuildOctreeForAlpha(void* octree, LICE_IBitmap* bmp, unsigned int minal
     int x=w;
     while (x--)
     {    
-      if (px[LICE_PIXEL_A] >= minalpha)
+      if (LICE_GETA(*px) >= minalpha)
       {
-        AddColorToTree(tree, (const LICE_pixel_chan*)px);      
+        AddColorToTree(tree, (const LICE_pixel_chan*)px, 1);
         if (tree->leafcount > tree->maxcolors) PruneTree(tree);
         pxcnt++;
       }
@@ -162,9 +212,9 @@ int LICE_BuildOctreeForAlpha(void* octree, LICE_IBitmap* bmp, unsigned int minal
 }
 
 
-int LICE_BuildOctreeForDiff(void* octree, LICE_IBitmap* bmp, LICE_IBitmap* refbmp, LICE_pixel mask)
+// LICE_BuildOctreeForDiff(), also skipping pixels with alpha < minalpha (for LICE_BuildPaletteEx())
+static int BuildOctreeForDiffAlpha(OTree* tree, LICE_IBitmap* bmp, LICE_IBitmap* refbmp, LICE_pixel mask, unsigned int minalpha)
 {
-  OTree* tree = (OTree*)octree;
   if (!tree || !bmp || !refbmp) return 0;
 
   tree->palette_valid=false;
@@ -195,23 +245,34 @@ int LICE_BuildOctreeForDiff(void* octree, LICE_IBitmap* bmp, LICE_IBitmap* refbm
   {
     const LICE_pixel * px = bits+y*rowspan;
     const LICE_pixel * px2 = bits2+y*rowspan2;
-    int x=w;
-    while (x--)
-    {    
-      if ((*px ^ *px2) & mask)
+    int x=0;
+    while (x < w)
+    {
+      if (((px[x] ^ px2[x]) & mask) && LICE_GETA(px[x]) >= minalpha)
       {
-        AddColorToTree(tree, (const LICE_pixel_chan *)px);
-        if (tree->leafcount > tree->maxcolors) PruneTree(tree);
-        pxcnt++;
+        const LICE_pixel c = px[x] & LICE_RGBA(255,255,255,0);
+        int run=1;
+        while (x+run < w && ((px[x+run] ^ px2[x+run]) & mask) && LICE_GETA(px[x+run]) >= minalpha &&
+               (px[x+run] & LICE_RGBA(255,255,255,0)) == c) run++;
+        AddRunToTree(tree, (const LICE_pixel_chan *)(px+x), run);
+        pxcnt+=run;
+        x+=run;
+      }
+      else
+      {
+        x++;
       }
-      px++;
-      px2++;
     }
   }
 
   return pxcnt;
 }
 
+int LICE_BuildOctreeForDiff(void* octree, LICE_IBitmap* bmp, LICE_IBitmap* refbmp, LICE_pixel mask)
+{
+  return BuildOctreeForDiffAlpha((OTree*)octree, bmp, refbmp, mask, 0);
+}
+
 
 int LICE_FindInOctree(void* octree, LICE_pixel color)
 {
@@ -224,6 +285,30 @@ int LICE_FindInOctree(void* octree, LICE_pixel color)
 }
 
 
+bool LICE_GenerateOctreeLookupTable(void* octree, unsigned char *tab)
+{
+  OTree* tree = (OTree*)octree;
+  if (!tree || !tab) return false;
+
+  if (!tree->palette_valid) CollectLeaves(tree);
+
+#if OCTREE_DEPTH == 5
+  // the tree resolves exactly 5 bits per channel, so each node covers a cube of table cells
+  FillNodeTable(tree, tree->nodes+OCTREE_TRUNK, tab, 32, 0, 0, 0);
+#else
+  int r,g,b;
+  for (r=0;r<32;r++)
+    for (g=0;g<32;g++)
+      for (b=0;b<32;b++)
+      {
+        const LICE_pixel col = LICE_RGBA(r<<3,g<<3,b<<3,0);
+        *tab++ = FindColorInTree(tree, (const LICE_pixel_chan *)&col);
+      }
+#endif
+  return true;
+}
+
+
 int LICE_ExtractOctreePalette(void* octree, LICE_pixel* palette)
 {
   OTree* tree = (OTree*)octree;
@@ -269,10 +354,30 @@ void LICE_TestPalette(LICE_IBitmap* bmp, LICE_pixel* palette, int numcolors)
 }
 
 
-void AddColorToTree(OTree* tree, const LICE_pixel_chan *rgb)
+// adds cnt copies of the same color, pruning exactly as if they were added one at a time
+void AddRunToTree(OTree* tree, const LICE_pixel_chan *rgb, int cnt)
+{
+  AddColorToTree(tree, rgb, 1);
+  if (tree->leafcount > tree->maxcolors) PruneTree(tree);
+  if (--cnt < 1) return;
+
+  if (tree->leafcount <= tree->maxcolors)
+  {
+    // the color now ends at a leaf, so the rest can't add leaves or trigger a prune
+    AddColorToTree(tree, rgb, cnt);
+  }
+  else while (cnt--)
+  {
+    AddColorToTree(tree, rgb, 1);
+    if (tree->leafcount > tree->maxcolors) PruneTree(tree);
+  }
+}
+
+void AddColorToTree(OTree* tree, const LICE_pixel_chan *rgb, int cnt)
 {
-  ONode* p = tree->trunk;
-  p->colorcount++;
+  ONode* nodes = tree->nodes;
+  ONode* p = nodes+OCTREE_TRUNK;
+  p->colorcount += cnt;
 
   int i;
   const unsigned char r = rgb[LICE_PIXEL_R];
@@ -283,15 +388,23 @@ void AddColorToTree(OTree* tree, const LICE_pixel_chan *rgb)
     const int j = i+8-OCTREE_DEPTH;
     const unsigned char idx = (((r>>(j-2))&4))|(((g>>(j-1))&2))|((b>>j)&1);
 
-    ONode* np = p->children[idx];
+    ONode* np;
     bool isleaf = false;
 
-    if (np)
+    if (p->children[idx])
     {
+      np = nodes+p->children[idx];
       isleaf = !np->childflag;
     }
     else // add node
     {
+      const int pidx = (int)(p-nodes);
+      const int npidx = NewNode(tree);
+      if (!npidx) return;
+      nodes = tree->nodes; // pool may have moved
+      p = nodes+pidx;
+      np = nodes+npidx;
+
       if (!p->childflag) // first time down this path
       {
         p->childflag=idx+1;
@@ -300,22 +413,17 @@ void AddColorToTree(OTree* tree, const LICE_pixel_chan *rgb)
       {    
         p->childflag = -1;
         p->next = tree->branches[i];
-        tree->branches[i] = p;
+        tree->branches[i] = pidx;
       }
       // else multiple branch, which we don't care about
 
-      np=tree->spares;
-      if (np) tree->spares = np->next;
-      else np = new ONode;
-
-      p->children[idx] = np;
-      memset(np, 0, sizeof(ONode));    
+      p->children[idx] = npidx;
     }
 
-    np->sumrgb[0] += r;
-    np->sumrgb[1] += g;
-    np->sumrgb[2] += b;
-    np->colorcount++;
+    np->sumrgb[0] += r*cnt;
+    np->sumrgb[1] += g*cnt;
+    np->sumrgb[2] += b*cnt;
+    np->colorcount += cnt;
 
     if (isleaf) return;
 
@@ -328,7 +436,8 @@ void AddColorToTree(OTree* tree, const LICE_pixel_chan *rgb)
 
 int FindColorInTree(OTree* tree, const LICE_pixel_chan *rgb)
 {
-  ONode* p = tree->trunk;
+  const ONode* nodes = tree->nodes;
+  const ONode* p = nodes+OCTREE_TRUNK;
 
   int i;
   const unsigned char r=rgb[LICE_PIXEL_R];
@@ -341,25 +450,53 @@ int FindColorInTree(OTree* tree, const LICE_pixel_chan *rgb)
     const int j = i+8-OCTREE_DEPTH;
     const unsigned char idx = (((r>>(j-2))&4))|(((g>>(j-1))&2))|((b>>j)&1);
 
-    ONode* np = p->children[idx];
-    if (!np) break; 
+    const int npidx = p->children[idx];
+    if (!npidx) break; 
 
-    p = np;
+    p = nodes+npidx;
   }
 
   return p->leafidx;
 }
 
 
+static void FillTableCube(unsigned char *tab, unsigned char v, int sz, int r, int g, int b)
+{
+  int i,j;
+  for (i = r; i < r+sz; ++i)
+    for (j = g; j < g+sz; ++j)
+      memset(tab + i*32*32 + j*32 + b, v, sz);
+}
+
+// fills the sz*sz*sz cube at r,g,b (in 15-bit table units) with what FindColorInTree() would return for its colors
+void FillNodeTable(const OTree* tree, const ONode* p, unsigned char *tab, int sz, int r, int g, int b)
+{
+  if (!p->childflag)
+  {
+    FillTableCube(tab, (unsigned char)p->leafidx, sz, r, g, b);
+    return;
+  }
+
+  const int hsz = sz/2;
+  int i;
+  for (i = 0; i < 8; ++i)
+  {
+    const int cr = r + ((i&4) ? hsz : 0), cg = g + ((i&2) ? hsz : 0), cb = b + ((i&1) ? hsz : 0);
+    if (p->children[i]) FillNodeTable(tree, tree->nodes+p->children[i], tab, hsz, cr, cg, cb);
+    else FillTableCube(tab, (unsigned char)p->leafidx, hsz, cr, cg, cb); // lookups that diverge off this node use its leafidx
+  }
+}
+
+
 int PruneTree(OTree* tree)
 {
   ONode* branch=0;
   int i;
   for (i = 0; i < OCTREE_DEPTH; ++i) // prune at the furthest level from the trunk
   {
-    branch = tree->branches[i];
-    if (branch)
+    if (tree->branches[i])
     {
+      branch = tree->nodes+tree->branches[i];
       tree->branches[i] = branch->next;
       branch->next=0;
       break;
@@ -372,7 +509,7 @@ int PruneTree(OTree* tree)
     {
       if (branch->children[i])
       {
-        DeleteNode(tree, branch->children[i],&tree->spares);
+        DeleteNode(tree, branch->children[i]);
         branch->children[i]=0;
       }
     }
@@ -389,14 +526,14 @@ int CollectLeaves(OTree* tree)
 
   if (!tree->palette) return 0;
 
-  int sz = CollectNodeLeaves(tree->trunk, tree->palette, 0);
+  int sz = CollectNodeLeaves(tree, tree->nodes+OCTREE_TRUNK, tree->palette, 0);
   memset(tree->palette+sz, 0, (tree->maxcolors-sz)*sizeof(LICE_pixel));
   tree->palette_valid = true;
 
   return sz;
 }
 
-int CollectNodeLeaves(ONode* p, LICE_pixel* palette, int colorcount)
+int CollectNodeLeaves(OTree* tree, ONode* p, LICE_pixel* palette, int colorcount)
 {  
   if (!p->childflag)
   {
@@ -410,7 +547,7 @@ int CollectNodeLeaves(ONode* p, LICE_pixel* palette, int colorcount)
   {
     if (p->childflag > 0)
     {
-      colorcount = CollectNodeLeaves(p->children[p->childflag-1], palette, colorcount);
+      colorcount = CollectNodeLeaves(tree, tree->nodes+p->children[p->childflag-1], palette, colorcount);
     }
     else
     {
@@ -419,7 +556,7 @@ int CollectNodeLeaves(ONode* p, LICE_pixel* palette, int colorcount)
       {
         if (p->children[i])
         {
-          colorcount = CollectNodeLeaves(p->children[i], palette, colorcount);
+          colorcount = CollectNodeLeaves(tree, tree->nodes+p->children[i], palette, colorcount);
         }
       }
     }
@@ -434,15 +571,16 @@ int CollectNodeLeaves(ONode* p, LICE_pixel* palette, int colorcount)
 }
 
 
-void DeleteNode(OTree* tree, ONode* p, ONode **delete_to)
+void DeleteNode(OTree* tree, int idx)
 {
+  ONode* p = tree->nodes+idx;
   if (!p->childflag)
   {
     tree->leafcount--;
   }
   else if (p->childflag > 0)
   {
-    DeleteNode(tree, p->children[p->childflag-1],delete_to);
+    DeleteNode(tree, p->children[p->childflag-1]);
   }
   else
   {
@@ -451,19 +589,517 @@ void DeleteNode(OTree* tree, ONode* p, ONode **delete_to)
     {
       if (p->children[i])
       {       
-        DeleteNode(tree, p->children[i],delete_to);     
+        DeleteNode(tree, p->children[i]);     
       }
     } 
   }
 
-  if (delete_to) 
+  p->next = tree->spares;
+  tree->spares = idx;
+}
+
+
+
+
+////////////////////////////////////////////////////////////////////////////
+// histogram palettes (LICE_BuildPaletteEx)
+//
+// pixels are counted in a 15-bit histogram. each cell also keeps the sum of the
+// 3 discarded low bits per channel, so cell means are exact and fit in 32 bits.
+
+#define PALHIST_SIZE 32768
+#define PALHIST_KMEANS_PASSES 6
+
+struct PalHistCell
+{
+  unsigned int cnt;
+  unsigned int res[3]; // sum of r&7, g&7, b&7
+};
+
+struct PalHistJob
+{
+  const LICE_pixel *bits, *refbits;
+  int rowspan, refrowspan;
+  int w, h;
+  LICE_pixel mask;
+  unsigned int minalpha;
+  int nbands;
+  PalHistCell *hists; // PALHIST_SIZE cells per band
+  int pxcnt[64];
+};
+
+static inline void PalHistAdd(PalHistCell *hist, LICE_pixel c, unsigned int cnt)
+{
+  const unsigned int r = LICE_GETR(c), g = LICE_GETG(c), b = LICE_GETB(c);
+  PalHistCell *cell = hist + (((r>>3)<<10)|((g>>3)<<5)|(b>>3));
+  cell->cnt += cnt;
+  cell->res[0] += (r&7)*cnt;
+  cell->res[1] += (g&7)*cnt;
+  cell->res[2] += (b&7)*cnt;
+}
+
+static inline bool PalHistUsePixel(const PalHistJob *job, const LICE_pixel *px, const LICE_pixel *ref, int x)
+{
+  if (ref && !((px[x]^ref[x]) & job->mask)) return false;
+  return LICE_GETA(px[x]) >= job->minalpha;
+}
+
+#ifdef LICE_PAL_SSE2
+// lanes set for pixels that should be skipped
+static inline __m128i PalHistSkip4(const PalHistJob *job, const LICE_pixel *ref, __m128i p)
+{
+  __m128i skip = _mm_cmplt_epi32(_mm_srli_epi32(p,24), _mm_set1_epi32((int)job->minalpha));
+  if (ref)
+  {
+    const __m128i d = _mm_and_si128(_mm_xor_si128(p, _mm_loadu_si128((const __m128i*)ref)), _mm_set1_epi32((int)job->mask));
+    skip = _mm_or_si128(skip, _mm_cmpeq_epi32(d, _mm_setzero_si128()));
+  }
+  return skip;
+}
+#endif
+
+// returns the number of pixels counted
+static int PalHistRow(const PalHistJob *job, PalHistCell *hist, const LICE_pixel *px, const LICE_pixel *ref)
+{
+  const int w = job->w;
+  const LICE_pixel rgbmask = LICE_RGBA(255,255,255,0);
+  int x=0, used=0;
+  while (x < w)
+  {
+#ifdef LICE_PAL_SSE2
+    while (x+4 <= w) // skip unchanged/transparent pixels 4 at a time
+    {
+      const __m128i p = _mm_loadu_si128((const __m128i*)(px+x));
+      if (_mm_movemask_epi8(PalHistSkip4(job, ref ? ref+x : NULL, p)) != 0xffff) break;
+      x+=4;
+    }
+#endif
+    while (x < w && !PalHistUsePixel(job,px,ref,x)) x++;
+    if (x >= w) break;
+
+    // count runs of the same color with one histogram update
+    const LICE_pixel c = px[x] & rgbmask;
+    int end = x+1;
+#ifdef LICE_PAL_SSE2
+    const __m128i cv = _mm_set1_epi32((int)c), mv = _mm_set1_epi32((int)rgbmask);
+    while (end+4 <= w)
+    {
+      const __m128i p = _mm_loadu_si128((const __m128i*)(px+end));
+      const __m128i ok = _mm_andnot_si128(PalHistSkip4(job, ref ? ref+end : NULL, p),
+                                          _mm_cmpeq_epi32(_mm_and_si128(p,mv), cv));
+      if (_mm_movemask_epi8(ok) != 0xffff) break;
+      end+=4;
+    }
+#endif
+    while (end < w && (px[end] & rgbmask) == c && PalHistUsePixel(job,px,ref,end)) end++;
+
+    PalHistAdd(hist, c, end-x);
+    used += end-x;
+    x = end;
+  }
+  return used;
+}
+
+static void PalHistBand(void *ctx, int band)
+{
+  PalHistJob *job = (PalHistJob *)ctx;
+  PalHistCell *hist = job->hists + band*PALHIST_SIZE;
+  const int y1 = (int) (((WDL_INT64)job->h * band) / job->nbands);
+  const int y2 = (int) (((WDL_INT64)job->h * (band+1)) / job->nbands);
+  int y, cnt=0;
+  for (y = y1; y < y2; y ++)
+  {
+    cnt += PalHistRow(job, hist, job->bits + y*job->rowspan,
+                      job->refbits ? job->refbits + y*job->refrowspan : NULL);
+  }
+  job->pxcnt[band] = cnt;
+}
+
+
+struct PalCell
+{
+  float col[3]; // mean color of the cell
+  unsigned int cnt;
+};
+
+struct PalBox
+{
+  int start, end; // range of PalCells
+  double cnt, sum[3], err[3]; // err: weighted sum of squared deviation per channel
+};
+
+static int PalCellCmpR(const void *a, const void *b) { const float d = ((const PalCell*)a)->col[0] - ((const PalCell*)b)->col[0]; return d<0.0f ? -1 : d>0.0f ? 1 : 0; }
+static int PalCellCmpG(const void *a, const void *b) { const float d = ((const PalCell*)a)->col[1] - ((const PalCell*)b)->col[1]; return d<0.0f ? -1 : d>0.0f ? 1 : 0; }
+static int PalCellCmpB(const void *a, const void *b) { const float d = ((const PalCell*)a)->col[2] - ((const PalCell*)b)->col[2]; return d<0.0f ? -1 : d>0.0f ? 1 : 0; }
+
+static void PalBoxStats(PalBox *box, const PalCell *cells)
+{
+  double sq[3] = { 0.0, 0.0, 0.0 };
+  int i, c;
+  box->cnt = 0.0;
+  for (c = 0; c < 3; c ++) box->sum[c] = 0.0;
+  for (i = box->start; i < box->end; i ++)
+  {
+    const double n = cells[i].cnt;
+    box->cnt += n;
+    for (c = 0; c < 3; c ++)
+    {
+      box->sum[c] += n * cells[i].col[c];
+      sq[c] += n * cells[i].col[c] * cells[i].col[c];
+    }
+  }
+  for (c = 0; c < 3; c ++) box->err[c] = box->cnt > 0.0 ? sq[c] - box->sum[c]*box->sum[c]/box->cnt : 0.0;
+}
+
+static LICE_pixel PalMeanColor(const double *sum, double cnt)
+{
+  int c[3];
+  for (int i = 0; i < 3; i ++)
+  {
+    c[i] = cnt > 0.0 ? (int) (sum[i] / cnt + 0.5) : 0;
+    if (c[i] > 255) c[i] = 255;
+  }
+  return LICE_RGBA(c[0],c[1],c[2],255);
+}
+
+// splits the box with the largest error along its worst channel at the weighted median, until maxcolors boxes
+static int PalMedianCut(PalCell *cells, int ncells, PalBox *boxes, int maxcolors)
+{
+  boxes[0].start = 0;
+  boxes[0].end = ncells;
+  PalBoxStats(boxes, cells);
+  int nboxes = 1;
+
+  while (nboxes < maxcolors)
+  {
+    int best=-1, i;
+    double besterr=0.0;
+    for (i = 0; i < nboxes; i ++)
+    {
+      const PalBox *b = boxes+i;
+      const double err = b->err[0]+b->err[1]+b->err[2];
+      if (b->end - b->start > 1 && err > besterr) { besterr = err; best = i; }
+    }
+    if (best < 0) break;
+
+    PalBox *b = boxes+best;
+    const int axis = b->err[0] >= b->err[1] ? (b->err[0] >= b->err[2] ? 0 : 2) : (b->err[1] >= b->err[2] ? 1 : 2);
+    qsort(cells + b->start, b->end - b->start, sizeof(PalCell), axis==0 ? PalCellCmpR : axis==1 ? PalCellCmpG : PalCellCmpB);
+
+    double acc = 0.0;
+    int split = b->start+1;
+    for (i = b->start; i < b->end-1; i ++)
+    {
+      acc += cells[i].cnt;
+      split = i+1;
+      if (acc >= b->cnt*0.5) break;
+    }
+
+    PalBox *nb = boxes + nboxes++;
+    nb->start = split;
+    nb->end = b->end;
+    b->end = split;
+    PalBoxStats(b, cells);
+    PalBoxStats(nb, cells);
+  }
+  return nboxes;
+}
+
+// moves each palette entry to the weighted mean of the cells nearest to it
+static void PalKMeans(const PalCell *cells, int ncells, float (*pal)[3], int npal)
+{
+  WDL_TypedBuf<double> accbuf;
+  double *acc = accbuf.ResizeOK(npal*4, false);
+  if (!acc) return;
+
+  int pass, i, j;
+  for (pass = 0; pass < PALHIST_KMEANS_PASSES; pass ++)
+  {
+    memset(acc, 0, npal*4*sizeof(double));
+    for (i = 0; i < ncells; i ++)
+    {
+      const float *c = cells[i].col;
+      int best=0;
+      float besterr = 1.0e30f;
+      for (j = 0; j < npal; j ++)
+      {
+        const float dr = c[0]-pal[j][0], dg = c[1]-pal[j][1], db = c[2]-pal[j][2];
+        const float err = dr*dr + dg*dg + db*db;
+        if (err < besterr) { besterr = err; best = j; }
+      }
+      double *a = acc + best*4;
+      const double n = cells[i].cnt;
+      a[0] += n*c[0];
+      a[1] += n*c[1];
+      a[2] += n*c[2];
+      a[3] += n;
+    }
+
+    float maxmove = 0.0f;
+    for (j = 0; j < npal; j ++)
+    {
+      const double *a = acc + j*4;
+      if (a[3] <= 0.0) continue; // keep unused entries where they are
+      for (i = 0; i < 3; i ++)
+      {
+        const float v = (float) (a[i] / a[3]);
+        const float d = v - pal[j][i];
+        if (d*d > maxmove) maxmove = d*d;
+        pal[j][i] = v;
+      }
+    }
+    if (maxmove < 0.25f) break; // converged to within half a level
+  }
+}
+
+
+// sets up job to count bmp (where it differs from refbmp, if set). returns false if there is nothing to count
+static bool PalHistSetup(PalHistJob *job, LICE_IBitmap* bmp, LICE_IBitmap* refbmp, LICE_pixel mask, unsigned int minalpha)
+{
+  memset(job, 0, sizeof(*job));
+  job->w = bmp->getWidth();
+  job->h = bmp->getHeight();
+  job->rowspan = bmp->getRowSpan();
+  job->bits = bmp->getBits();
+  if (bmp->isFlipped())
+  {
+    job->bits += job->rowspan * (job->h-1);
+    job->rowspan = -job->rowspan;
+  }
+  if (refbmp)
+  {
+    job->w = lice_min(job->w, refbmp->getWidth());
+    job->h = lice_min(job->h, refbmp->getHeight());
+    job->refrowspan = refbmp->getRowSpan();
+    job->refbits = refbmp->getBits();
+    if (refbmp->isFlipped())
+    {
+      job->refbits += job->refrowspan * (refbmp->getHeight()-1);
+      job->refrowspan = -job->refrowspan;
+    }
+  }
+  job->mask = mask;
+  job->minalpha = minalpha;
+  return job->bits && job->w > 0 && job->h > 0;
+}
+
+// bands of at least 64 rows, one histogram per band
+static int PalHistNumBands(const PalHistJob *job, int nthreads)
+{
+  if (nthreads <= 0) nthreads = LICE_GetNumCPUs();
+  return lice_max(lice_min(lice_min(nthreads, job->h/64), 64), 1);
+}
+
+static void PalHistAddCells(PalHistCell *dest, const PalHistCell *src)
+{
+  for (int i = 0; i < PALHIST_SIZE; i ++)
+  {
+    if (!src[i].cnt) continue;
+    dest[i].cnt += src[i].cnt;
+    dest[i].res[0] += src[i].res[0];
+    dest[i].res[1] += src[i].res[1];
+    dest[i].res[2] += src[i].res[2];
+  }
+}
+
+static int PalFromHist(const PalHistCell *hist, LICE_pixel* palette, int maxcolors, int mode)
+{
+  WDL_TypedBuf<PalCell> cellbuf;
+  PalCell *cells = cellbuf.ResizeOK(PALHIST_SIZE, false);
+  if (!cells) return 0;
+  int i, b, ncells=0;
+  for (i = 0; i < PALHIST_SIZE; i ++)
+  {
+    const unsigned int n = hist[i].cnt;
+    if (!n) continue;
+    PalCell *c = cells + ncells++;
+    c->cnt = n;
+    c->col[0] = (float) ((i>>10)<<3) + (float)hist[i].res[0] / n;
+    c->col[1] = (float) (((i>>5)&31)<<3) + (float)hist[i].res[1] / n;
+    c->col[2] = (float) ((i&31)<<3) + (float)hist[i].res[2] / n;
+  }
+  if (!ncells) return 0;
+
+  WDL_TypedBuf<PalBox> boxbuf;
+  PalBox *boxes = boxbuf.ResizeOK(lice_min(maxcolors, ncells), false);
+  if (!boxes) return 0;
+  const int nboxes = PalMedianCut(cells, ncells, boxes, lice_min(maxcolors, ncells));
+
+  if (mode == LICE_PALETTE_KMEANS && nboxes > 1)
+  {
+    WDL_TypedBuf<float> palbuf;
+    float (*pal)[3] = (float (*)[3]) palbuf.ResizeOK(nboxes*3, false);
+    if (pal)
+    {
+      for (b = 0; b < nboxes; b ++)
+        for (i = 0; i < 3; i ++)
+          pal[b][i] = (float) (boxes[b].sum[i] / boxes[b].cnt);
+      PalKMeans(cells, ncells, pal, nboxes);
+      for (b = 0; b < nboxes; b ++)
+      {
+        const double sum[3] = { pal[b][0], pal[b][1], pal[b][2] };
+        palette[b] = PalMeanColor(sum, 1.0);
+      }
+      return nboxes;
+    }
+  }
+
+  for (b = 0; b < nboxes; b ++) palette[b] = PalMeanColor(boxes[b].sum, boxes[b].cnt);
+  return nboxes;
+}
+
+int LICE_BuildPaletteEx(LICE_IBitmap* bmp, LICE_pixel* palette, int maxcolors, int mode,
+                        LICE_IBitmap* refbmp, LICE_pixel mask, unsigned int minalpha, int *pixcnt, int nthreads)
+{
+  if (pixcnt) *pixcnt=0;
+  if (!bmp || !palette || maxcolors < 1) return 0;
+
+  if (mode == LICE_PALETTE_OCTREE)
+  {
+    void *tree = LICE_CreateOctree(maxcolors);
+    if (!tree) return 0;
+    int cnt;
+    if (refbmp) cnt = BuildOctreeForDiffAlpha((OTree*)tree, bmp, refbmp, mask, minalpha);
+    else if (minalpha) cnt = LICE_BuildOctreeForAlpha(tree, bmp, minalpha);
+    else { LICE_BuildOctree(tree, bmp); cnt = bmp->getWidth()*bmp->getHeight(); }
+    const int sz = LICE_ExtractOctreePalette(tree, palette);
+    LICE_DestroyOctree(tree);
+    if (pixcnt) *pixcnt = cnt;
+    return sz;
+  }
+
+  PalHistJob job;
+  if (!PalHistSetup(&job, bmp, refbmp, mask, minalpha)) return 0;
+  job.nbands = PalHistNumBands(&job, nthreads);
+
+  WDL_TypedBuf<PalHistCell> histbuf;
+  job.hists = histbuf.ResizeOK(job.nbands*PALHIST_SIZE, false);
+  if (!job.hists) return 0;
+  memset(job.hists, 0, job.nbands*PALHIST_SIZE*sizeof(PalHistCell));
+
+  if (job.nbands > 1) LICE_RunParallel(job.nbands, PalHistBand, &job, nthreads);
+  else PalHistBand(&job, 0);
+
+  int b, total = job.pxcnt[0];
+  for (b = 1; b < job.nbands; b ++)
+  {
+    PalHistAddCells(job.hists, job.hists + b*PALHIST_SIZE);
+    total += job.pxcnt[b];
+  }
+  if (pixcnt) *pixcnt = total;
+  if (!total) return 0;
+
+  return PalFromHist(job.hists, palette, maxcolors, mode);
+}
+
+
+// histograms accumulated over many images (LICE_CreatePaletteHistogram)
+#define PALHIST_MAXTOTAL 0x20000000 // keeps cnt and res (up to 7*cnt) of every cell within 32 bits
+
+struct PalHistogram
+{
+  PalHistCell cells[PALHIST_SIZE];
+  unsigned int total;
+};
+
+// halves all counts (rounding up so that rare colors are kept), used before a histogram would overflow
+static void PalHistHalve(PalHistogram *h)
+{
+  unsigned int total=0;
+  for (int i = 0; i < PALHIST_SIZE; i ++)
+  {
+    PalHistCell *c = h->cells + i;
+    if (!c->cnt) continue;
+    c->cnt = (c->cnt+1)>>1;
+    c->res[0] = (c->res[0]+1)>>1;
+    c->res[1] = (c->res[1]+1)>>1;
+    c->res[2] = (c->res[2]+1)>>1;
+    total += c->cnt;
+  }
+  h->total = total;
+}
+
+void *LICE_CreatePaletteHistogram()
+{
+  return calloc(sizeof(PalHistogram),1);
+}
+
+void LICE_DestroyPaletteHistogram(void *hist)
+{
+  free(hist);
+}
+
+void LICE_ResetPaletteHistogram(void *hist)
+{
+  if (hist) memset(hist, 0, sizeof(PalHistogram));
+}
+
+int LICE_AddToPaletteHistogram(void *hist, LICE_IBitmap* bmp, LICE_IBitmap* refbmp, LICE_pixel mask, unsigned int minalpha, int nthreads)
+{
+  PalHistogram *h = (PalHistogram *)hist;
+  PalHistJob job;
+  if (!h || !bmp || !PalHistSetup(&job, bmp, refbmp, mask, minalpha)) return 0;
+
+  const unsigned int maxadd = (unsigned int) lice_min((WDL_INT64)job.w*job.h, (WDL_INT64)PALHIST_MAXTOTAL);
+  while (h->total && h->total > PALHIST_MAXTOTAL - maxadd) PalHistHalve(h);
+
+  job.nbands = PalHistNumBands(&job, nthreads);
+  WDL_TypedBuf<PalHistCell> histbuf;
+  if (job.nbands > 1)
   {
-    p->next = *delete_to;
-    *delete_to = p;
+    job.hists = histbuf.ResizeOK(job.nbands*PALHIST_SIZE, false);
+    if (!job.hists) return 0;
+    memset(job.hists, 0, job.nbands*PALHIST_SIZE*sizeof(PalHistCell));
+    LICE_RunParallel(job.nbands, PalHistBand, &job, nthreads);
   }
   else
   {
-    delete p;
+    job.hists = h->cells; // count straight into the histogram
+    PalHistBand(&job, 0);
   }
+
+  int b, total=0;
+  for (b = 0; b < job.nbands; b ++)
+  {
+    if (job.nbands > 1) PalHistAddCells(h->cells, job.hists + b*PALHIST_SIZE);
+    total += job.pxcnt[b];
+  }
+  h->total += total;
+  return total;
+}
+
+void LICE_MergePaletteHistogram(void *dest, void *src)
+{
+  PalHistogram *d = (PalHistogram *)dest, *s = (PalHistogram *)src;
+  if (!d || !s || !s->total) return;
+  while (d->total && d->total > PALHIST_MAXTOTAL - s->total) PalHistHalve(d);
+  PalHistAddCells(d->cells, s->cells);
+  d->total += s->total;
 }
 
+int LICE_BuildPaletteFromHistogram(void *hist, LICE_pixel* palette, int maxcolors, int mode)
+{
+  const PalHistogram *h = (const PalHistogram *)hist;
+  if (!h || !h->total || !palette || maxcolors < 1) return 0;
+  return PalFromHist(h->cells, palette, maxcolors, mode);
+}
+
+void LICE_GeneratePaletteLookupTable(const LICE_pixel* palette, int numcolors, unsigned char *tab)
+{
+  int r, g, b, i;
+  for (r = 0; r < 32; r ++)
+    for (g = 0; g < 32; g ++)
+      for (b = 0; b < 32; b ++)
+      {
+        // nearest entry to the center of the cell
+        const int cr = (r<<3)|4, cg = (g<<3)|4, cb = (b<<3)|4;
+        int best=0, besterr=0x7fffffff;
+        for (i = 0; i < numcolors && besterr; i ++)
+        {
+          const int dr = cr-(int)LICE_GETR(palette[i]), dg = cg-(int)LICE_GETG(palette[i]), db = cb-(int)LICE_GETB(palette[i]);
+          const int err = dr*dr + dg*dg + db*db;
+          if (err < besterr) { besterr = err; best = i; }
+        }
+        *tab++ = (unsigned char)best;
+      }
+}
@@ -0,0 +1,116 @@
+#ifndef _LICE_PARALLEL_H_
+#define _LICE_PARALLEL_H_
+
+/*
+  Cockos WDL - LICE - Lightweight Image Compositing Engine
+  See lice.h for license and other information
+
+  Minimal fork/join helper used by encoders that split work into independent jobs
+  (bands of a GIF frame, groups of LCF tiles, etc). Threads are created per call,
+  so only use this when each job is substantial (milliseconds, not microseconds).
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include "../wdltypes.h"
+#include "../wdlatomic.h"
+
+static WDL_STATICFUNC_UNUSED int LICE_GetNumCPUs()
+{
+  static int cnt;
+  if (!cnt)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    memset(&si,0,sizeof(si));
+    GetSystemInfo(&si);
+    cnt = (int)si.dwNumberOfProcessors;
+#else
+    cnt = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (cnt < 1) cnt=1;
+    else if (cnt > 64) cnt=64;
+  }
+  return cnt;
+}
+
+
+struct LICE_ParallelJobs
+{
+  void (*func)(void *ctx, int idx);
+  void *ctx;
+  int njobs;
+  int nextjob; // atomically incremented, job index is nextjob-1
+
+  void run()
+  {
+    for (;;)
+    {
+      const int idx = wdl_atomic_incr(&nextjob)-1;
+      if (idx >= njobs) break;
+      func(ctx,idx);
+    }
+  }
+
+#ifdef _WIN32
+  static unsigned WINAPI threadProc(void *p) { ((LICE_ParallelJobs *)p)->run(); return 0; }
+#else
+  static void *threadProc(void *p) { ((LICE_ParallelJobs *)p)->run(); return NULL; }
+#endif
+};
+
+// calls func(ctx,0..njobs-1), using up to maxthreads threads (including the calling thread).
+// returns when all jobs have completed. maxthreads<=0 uses the number of CPUs.
+static WDL_STATICFUNC_UNUSED void LICE_RunParallel(int njobs, void (*func)(void *ctx, int idx), void *ctx, int maxthreads=0)
+{
+  if (njobs < 1) return;
+  if (maxthreads <= 0) maxthreads = LICE_GetNumCPUs();
+  if (maxthreads > njobs) maxthreads = njobs;
+  if (maxthreads > 64) maxthreads = 64;
+
+  LICE_ParallelJobs jobs;
+  jobs.func = func;
+  jobs.ctx = ctx;
+  jobs.njobs = njobs;
+  jobs.nextjob = 0;
+
+  int x, nt=0;
+#ifdef _WIN32
+  HANDLE threads[64];
+  for (x = 1; x < maxthreads; x ++)
+  {
+    unsigned id;
+    HANDLE h = (HANDLE)_beginthreadex(NULL,0,LICE_ParallelJobs::threadProc,&jobs,0,&id);
+    if (h) threads[nt++] = h;
+  }
+#else
+  pthread_t threads[64];
+  for (x = 1; x < maxthreads; x ++)
+  {
+    if (!pthread_create(&threads[nt],NULL,LICE_ParallelJobs::threadProc,&jobs)) nt++;
+  }
+#endif
+
+  jobs.run(); // the calling thread takes jobs too, and does all of them if no threads could be created
+
+  for (x = 0; x < nt; x ++)
+  {
+#ifdef _WIN32
+    WaitForSingleObject(threads[x],INFINITE);
+    CloseHandle(threads[x]);
+#else
+    void *r;
+    pthread_join(threads[x],&r);
+#endif
+  }
+}
+
+#endif
@@ -8,6 +8,19 @@
 
 // avoid std::min/max due to SWELL macros; use local helpers
 #include <stdlib.h>  // for malloc, realloc, free
+#include <string.h>
+
+#include "../WDL/lice/lice_parallel.h"  // LICE_RunParallel
+
+// Row kernels for CalculateSimilarity, same feature tests as the
+// LICE_BitmapCmpEx row scanners in lice.cpp.
+#if defined(__SSE2__) || _M_IX86_FP >= 2 || defined(_M_X64)
+  #include <emmintrin.h>
+  #define DUP_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define DUP_SIMD_NEON
+#endif
 
 // Internal helpers ---------------------------------------------------------
 
@@ -44,46 +57,144 @@ static inline void compute_roi(LICE_IBitmap* a,
   *roi_out = r;
 }
 
-// Pixel equality test with optional per-channel tolerance and channel mask.
-// Returns true if p1 ~ p2 under cfg->
-static inline bool pixels_equal(LICE_pixel p1,
-                                LICE_pixel p2,
-                                const DuplicateFrameRemovalSettings* cfg)
+// Pixel comparison derived from cfg. Two pixels are equal when no bit of
+// diff(p1,p2) & mask is set, where diff is XOR for strict compares, and
+// per byte max(|p1-p2|-tol,0) for tolerant ones (mask then selects whole
+// channels: 0xff for each byte of channel_mask that has any bit set).
+struct PixelCompare
 {
-  if (cfg->per_channel_tolerance <= 0)
-  {
-    // Strict equality with channel mask (like LICE_BitmapCmpEx logic)
-    return ((p1 ^ p2) & cfg->channel_mask) == 0;
-  }
+  bool tolerant;
+  LICE_pixel mask;
+  int tol; // 1..255
 
-  // Tolerant per-channel check. Only channels selected by mask are tested.
-  const int tol = cfg->per_channel_tolerance;
+  // scalar tolerant compare, two channels per 16-bit lane (see pixel_differs)
+  unsigned int swar_over, swar_under, swar_flags_lo, swar_flags_hi;
+};
 
-  if (cfg->channel_mask & LICE_RGBA(255,0,0,0))
-  {
-    int d = (int)LICE_GETR(p1) - (int)LICE_GETR(p2);
-    if (d < 0) d = -d;
-    if (d > tol) return false;
-  }
-  if (cfg->channel_mask & LICE_RGBA(0,255,0,0))
+static void pixel_compare_init(PixelCompare* c, const DuplicateFrameRemovalSettings* cfg)
+{
+  c->tolerant = cfg->per_channel_tolerance > 0;
+  c->tol = clampi(cfg->per_channel_tolerance, 1, 255);
+  c->swar_over = c->swar_under = c->swar_flags_lo = c->swar_flags_hi = 0;
+  if (!c->tolerant)
   {
-    int d = (int)LICE_GETG(p1) - (int)LICE_GETG(p2);
-    if (d < 0) d = -d;
-    if (d > tol) return false;
+    c->mask = cfg->channel_mask;
+    return;
   }
-  if (cfg->channel_mask & LICE_RGBA(0,0,255,0))
+  c->mask = 0;
+  for (int sh = 0; sh < 32; sh += 8)
+    if ((cfg->channel_mask >> sh) & 0xff) c->mask |= (LICE_pixel)0xff << sh;
+
+  const unsigned int over = 0x7fff - 256 - c->tol, under = 0x8000 + 255 - c->tol;
+  c->swar_over = over | (over << 16);
+  c->swar_under = under | (under << 16);
+  if (c->mask & 0x000000ff) c->swar_flags_lo |= 0x00008000;
+  if (c->mask & 0x00ff0000) c->swar_flags_lo |= 0x80000000;
+  if (c->mask & 0x0000ff00) c->swar_flags_hi |= 0x00008000;
+  if (c->mask & 0xff000000) c->swar_flags_hi |= 0x80000000;
+}
+
+// Returns 1 if p1 and p2 differ under c, without per-channel branches.
+// Tolerant compares put 256+a-b of bytes 0,2 (then 1,3) in 16-bit lanes,
+// and test it against 256+tol and 256-tol with the sign bit of each lane.
+static inline int pixel_differs(LICE_pixel p1, LICE_pixel p2, const PixelCompare* c)
+{
+  if (!c->tolerant) return ((p1 ^ p2) & c->mask) != 0;
+
+  const unsigned int lo = ((p1 & 0x00ff00ff) + 0x01000100) - (p2 & 0x00ff00ff);
+  const unsigned int hi = (((p1 >> 8) & 0x00ff00ff) + 0x01000100) - ((p2 >> 8) & 0x00ff00ff);
+  const unsigned int flo = (lo + c->swar_over) | (c->swar_under - lo);
+  const unsigned int fhi = (hi + c->swar_over) | (c->swar_under - hi);
+  return ((flo & c->swar_flags_lo) | (fhi & c->swar_flags_hi)) != 0;
+}
+
+#if defined(DUP_SIMD_SSE2)
+// Returns -1 in each 32-bit lane where va and vb are equal under c.
+static inline __m128i equal_lanes(__m128i va, __m128i vb, __m128i m, __m128i tol, bool tolerant)
+{
+  __m128i d;
+  if (tolerant) d = _mm_subs_epu8(_mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)), tol);
+  else d = _mm_xor_si128(va, vb);
+  return _mm_cmpeq_epi32(_mm_and_si128(d, m), _mm_setzero_si128());
+}
+static inline long sum_lanes(__m128i acc)
+{
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1,0,3,2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2,3,0,1)));
+  return _mm_cvtsi128_si32(acc);
+}
+#elif defined(DUP_SIMD_NEON)
+static inline uint32x4_t equal_lanes(uint32x4_t va, uint32x4_t vb, uint32x4_t m, uint8x16_t tol, bool tolerant)
+{
+  uint32x4_t d;
+  if (tolerant) d = vreinterpretq_u32_u8(vqsubq_u8(vabdq_u8(vreinterpretq_u8_u32(va), vreinterpretq_u8_u32(vb)), tol));
+  else d = veorq_u32(va, vb);
+  return vceqq_u32(vandq_u32(d, m), vdupq_n_u32(0));
+}
+static inline long sum_lanes(uint32x4_t acc)
+{
+  const uint32x2_t r = vpadd_u32(vget_low_u32(acc), vget_high_u32(acc));
+  return vget_lane_u32(vpadd_u32(r, r), 0);
+}
+#endif
+
+// Counts the equal pixels among n samples taken every step pixels.
+// The per-lane counters subtract the -1 of each equal lane.
+template<bool tolerant, int step> static long count_equal_row_t(const LICE_pixel* a, const LICE_pixel* b, int n, int rstep, const PixelCompare* c)
+{
+  const int s = step > 0 ? step : rstep;
+  int x = 0;
+  long eq = 0;
+#if defined(DUP_SIMD_SSE2)
+  const __m128i m = _mm_set1_epi32((int)c->mask), tol = _mm_set1_epi8((char)c->tol);
+  __m128i acc = _mm_setzero_si128();
+  for (; x + 4 <= n; x += 4, a += 4*s, b += 4*s)
   {
-    int d = (int)LICE_GETB(p1) - (int)LICE_GETB(p2);
-    if (d < 0) d = -d;
-    if (d > tol) return false;
+    __m128i va, vb;
+    if (s == 1)
+    {
+      va = _mm_loadu_si128((const __m128i*)a);
+      vb = _mm_loadu_si128((const __m128i*)b);
+    }
+    else
+    {
+      va = _mm_set_epi32((int)a[3*s], (int)a[2*s], (int)a[s], (int)a[0]);
+      vb = _mm_set_epi32((int)b[3*s], (int)b[2*s], (int)b[s], (int)b[0]);
+    }
+    acc = _mm_sub_epi32(acc, equal_lanes(va, vb, m, tol, tolerant));
   }
-  if (cfg->channel_mask & LICE_RGBA(0,0,0,255))
+  eq = sum_lanes(acc);
+#elif defined(DUP_SIMD_NEON)
+  const uint32x4_t m = vdupq_n_u32(c->mask);
+  const uint8x16_t tol = vdupq_n_u8((uint8_t)c->tol);
+  uint32x4_t acc = vdupq_n_u32(0);
+  for (; x + 4 <= n; x += 4, a += 4*s, b += 4*s)
   {
-    int d = (int)LICE_GETA(p1) - (int)LICE_GETA(p2);
-    if (d < 0) d = -d;
-    if (d > tol) return false;
+    uint32x4_t va, vb;
+    if (s == 1)
+    {
+      va = vld1q_u32((const uint32_t*)a);
+      vb = vld1q_u32((const uint32_t*)b);
+    }
+    else
+    {
+      const uint32_t ta[4] = { a[0], a[s], a[2*s], a[3*s] }, tb[4] = { b[0], b[s], b[2*s], b[3*s] };
+      va = vld1q_u32(ta);
+      vb = vld1q_u32(tb);
+    }
+    acc = vsubq_u32(acc, equal_lanes(va, vb, m, tol, tolerant));
   }
-  return true;
+  eq = sum_lanes(acc);
+#endif
+  for (; x < n; x++, a += s, b += s) eq += 1 - pixel_differs(*a, *b, c);
+  return eq;
+}
+
+static long count_equal_row(const LICE_pixel* a, const LICE_pixel* b, int n, int step, const PixelCompare* c)
+{
+  if (step == 1)
+    return c->tolerant ? count_equal_row_t<true,1>(a, b, n, 1, c) : count_equal_row_t<false,1>(a, b, n, 1, c);
+  return c->tolerant ? count_equal_row_t<true,0>(a, b, n, step, c) : count_equal_row_t<false,0>(a, b, n, step, c);
 }
 
 // Dynamic array implementations -------------------------------------------
@@ -182,23 +293,16 @@ double CalculateSimilarity(LICE_IBitmap* a,
   const int rh = r.bottom - r.top;
   if (rw <= 0 || rh <= 0) return 1.0; // empty region treated as identical
 
-  // Fast-path: if cfg requires exact match and sampling is full-frame,
-  // use LICE_BitmapCmpEx to bypass per-pixel loop when possible.
+  // Fast-path: exact match over the full frame, count the differing pixels
+  // with LICE_BitmapCmpCount. This is exact, but doesn't stop early.
   if (cfg->per_channel_tolerance <= 0 &&
       cfg->sample_step_x == 1 && cfg->sample_step_y == 1 &&
       r.left == 0 && r.top == 0 && r.right == a->getWidth() && r.bottom == a->getHeight())
   {
-    int diffcoords[4] = {0,0,0,0};
-    int ret = LICE_BitmapCmpEx((LICE_IBitmap*)a,(LICE_IBitmap*)b,cfg->channel_mask,diffcoords);
-    if (ret == 0) return 1.0; // identical
-    // If different, provide a rough similarity estimate by area ratio.
-    const long total = (long)a->getWidth() * (long)a->getHeight();
-    const long diff  = (long)diffcoords[2] * (long)diffcoords[3];
-    if (total <= 0) return 0.0;
-    double approx = 1.0 - (double)diff / (double)total;
-    if (approx < 0.0) approx = 0.0;
-    if (approx > 1.0) approx = 1.0;
-    return approx;
+    const int ndiff = LICE_BitmapCmpCount(a,b,cfg->channel_mask);
+    if (ndiff <= 0) return ndiff < 0 ? 0.0 : 1.0;
+    const long total = (long)rw * (long)rh;
+    return (double)(total - ndiff) / (double)total;
   }
 
   // Manual scan with sampling and optional early-out.
@@ -206,7 +310,6 @@ double CalculateSimilarity(LICE_IBitmap* a,
   const LICE_pixel* p2 = b->getBits();
   int span1 = a->getRowSpan();
   int span2 = b->getRowSpan();
-  const int w = a->getWidth();
 
   if (a->isFlipped()) { p1 += span1 * (a->getHeight()-1); span1 = -span1; }
   if (b->isFlipped()) { p2 += span2 * (b->getHeight()-1); span2 = -span2; }
@@ -220,36 +323,50 @@ double CalculateSimilarity(LICE_IBitmap* a,
   const long total_samples = (long)roi_w_s * (long)roi_h_s;
   if (total_samples <= 0) return 1.0;
 
+  PixelCompare cmp;
+  pixel_compare_init(&cmp, cfg);
+
+  // Early-out: the scan can stop once the best case, every remaining
+  // sample equal, is below the threshold. That only depends on the number
+  // of unequal samples, so find the smallest count that triggers it.
+  long mism_limit = total_samples + 1; // never
+  if (cfg->enable_early_out)
+  {
+    const double thr = cfg->similarity_threshold;
+    long m = (long)((1.0 - thr) * (double)total_samples);
+    if (m < 0) m = 0;
+    if (m > total_samples + 1) m = total_samples + 1;
+    while (m > 0 && (double)(total_samples - (m-1)) / (double)total_samples < thr) m--;
+    while (m <= total_samples && !((double)(total_samples - m) / (double)total_samples < thr)) m++;
+    mism_limit = m;
+  }
+
   long equal_count = 0;
   long processed = 0;
 
   for (int yy = r.top; yy < r.bottom; yy += sY)
   {
-    const LICE_pixel* row1 = p1 + yy * span1;
-    const LICE_pixel* row2 = p2 + yy * span2;
-
-    for (int xx = r.left; xx < r.right; xx += sX)
-    {
-      const LICE_pixel a_px = row1[xx];
-      const LICE_pixel b_px = row2[xx];
-      if (pixels_equal(a_px, b_px, cfg))
-        ++equal_count;
+    const LICE_pixel* row1 = p1 + yy * span1 + r.left;
+    const LICE_pixel* row2 = p2 + yy * span2 + r.left;
 
-      ++processed;
+    const long eq = count_equal_row(row1, row2, roi_w_s, sX, &cmp);
 
-      if (cfg->enable_early_out)
+    if (processed + roi_w_s - (equal_count + eq) >= mism_limit)
+    {
+      // The threshold became unreachable in this row: stop at the same
+      // sample as a per-sample check would, so the result is the same.
+      for (int i = 0; i < roi_w_s; i++)
       {
-        // If even in the best case the threshold is unattainable, exit early.
-        const long remaining = total_samples - processed;
-        const long best_case_equal = equal_count + remaining;
-        const double best_case_sim = (double)best_case_equal / (double)total_samples;
-        if (best_case_sim < cfg->similarity_threshold)
-          goto CALC_FINISH;
+        equal_count += 1 - pixel_differs(row1[i*sX], row2[i*sX], &cmp);
+        ++processed;
+        if (processed - equal_count >= mism_limit) break;
       }
+      break;
     }
+    equal_count += eq;
+    processed += roi_w_s;
   }
 
-CALC_FINISH:
   if (processed <= 0) return 1.0;
   double sim = (double)equal_count / (double)total_samples;
   if (sim < 0.0) sim = 0.0;
@@ -257,46 +374,121 @@ CALC_FINISH:
   return sim;
 }
 
-bool IsDuplicateFrame(const FrameInfo* prev,
-                      const FrameInfo* curr,
-                      const DuplicateFrameRemovalSettings* cfg,
-                      double* out_similarity)
+WDL_UINT64 ComputeFrameFingerprint(LICE_IBitmap* bmp, const RECT* roi)
 {
-  if (!prev->bmp || !curr->bmp) {
-    if (out_similarity) *out_similarity = 0.0;
-    return false;
+  if (!bmp) return 0;
+  RECT r;
+  compute_roi(bmp,bmp,roi,&r);
+  const int rw = r.right - r.left, rh = r.bottom - r.top;
+  if (rw <= 0 || rh <= 0) return 0;
+
+  const LICE_pixel* bits = bmp->getBits();
+  int span = bmp->getRowSpan();
+  if (bmp->isFlipped()) { bits += span * (bmp->getHeight()-1); span = -span; }
+
+  // average luma*16 of each cell, cells are at least 1 pixel
+  int avg[8][9];
+  for (int cy = 0; cy < 8; cy++)
+  {
+    const int y0 = r.top + rh*cy/8;
+    const int y1 = wdl_max(y0+1, r.top + rh*(cy+1)/8);
+    const int sy = wdl_max(1, (y1-y0)/16);
+    for (int cx = 0; cx < 9; cx++)
+    {
+      const int x0 = r.left + rw*cx/9;
+      const int x1 = wdl_max(x0+1, r.left + rw*(cx+1)/9);
+      const int sx = wdl_max(1, (x1-x0)/16);
+      unsigned int sum = 0, cnt = 0;
+      for (int y = y0; y < y1; y += sy)
+      {
+        const LICE_pixel* p = bits + y*span;
+        for (int x = x0; x < x1; x += sx, cnt++)
+          sum += (LICE_GETR(p[x])*77 + LICE_GETG(p[x])*150 + LICE_GETB(p[x])*29) >> 8;
+      }
+      avg[cy][cx] = (int)((sum*16) / cnt);
+    }
   }
 
-  RECT roi;
+  // a margin of 2 luma levels keeps flat areas from flipping on noise
+  WDL_UINT64 h = 0;
+  for (int cy = 0; cy < 8; cy++)
+    for (int cx = 0; cx < 8; cx++)
+      if (avg[cy][cx] > avg[cy][cx+1] + 2*16) h |= (WDL_UINT64)1 << (cy*8+cx);
+  return h;
+}
+
+int FingerprintDistance(WDL_UINT64 a, WDL_UINT64 b)
+{
+  WDL_UINT64 v = a ^ b;
+  int n = 0;
+  while (v) { v &= v-1; n++; }
+  return n;
+}
+
+int FingerprintPrefilter(WDL_UINT64 a, WDL_UINT64 b, const DuplicateFrameRemovalSettings* cfg)
+{
+  if (cfg->fingerprint_dup_bits < 0 && cfg->fingerprint_new_bits <= 0) return -1;
+  const int d = FingerprintDistance(a,b);
+  if (d <= cfg->fingerprint_dup_bits) return 1;
+  if (cfg->fingerprint_new_bits > 0 && d >= cfg->fingerprint_new_bits) return 0;
+  return -1;
+}
+
+// The comparison region of a pair of frames: curr's ROI, else prev's, else
+// the common size.
+static void frame_pair_roi(const FrameInfo* prev, const FrameInfo* curr, RECT* roi)
+{
   if (curr->w > 0 && curr->h > 0)
   {
-    roi.left = curr->x; roi.top = curr->y; roi.right = curr->x + curr->w; roi.bottom = curr->y + curr->h;
+    roi->left = curr->x; roi->top = curr->y; roi->right = curr->x + curr->w; roi->bottom = curr->y + curr->h;
   }
   else if (prev->w > 0 && prev->h > 0)
   {
-    roi.left = prev->x; roi.top = prev->y; roi.right = prev->x + prev->w; roi.bottom = prev->y + prev->h;
+    roi->left = prev->x; roi->top = prev->y; roi->right = prev->x + prev->w; roi->bottom = prev->y + prev->h;
   }
   else
   {
-    roi.left = roi.top = 0;
-    roi.right = (prev->bmp->getWidth() < curr->bmp->getWidth()) ? prev->bmp->getWidth() : curr->bmp->getWidth();
-    roi.bottom = (prev->bmp->getHeight() < curr->bmp->getHeight()) ? prev->bmp->getHeight() : curr->bmp->getHeight();
+    roi->left = roi->top = 0;
+    roi->right = (prev->bmp->getWidth() < curr->bmp->getWidth()) ? prev->bmp->getWidth() : curr->bmp->getWidth();
+    roi->bottom = (prev->bmp->getHeight() < curr->bmp->getHeight()) ? prev->bmp->getHeight() : curr->bmp->getHeight();
   }
+}
+
+bool IsDuplicateFrame(const FrameInfo* prev,
+                      const FrameInfo* curr,
+                      const DuplicateFrameRemovalSettings* cfg,
+                      double* out_similarity)
+{
+  if (!prev->bmp || !curr->bmp) {
+    if (out_similarity) *out_similarity = 0.0;
+    return false;
+  }
+
+  RECT roi;
+  frame_pair_roi(prev, curr, &roi);
 
   double sim = CalculateSimilarity(prev->bmp, curr->bmp, &roi, cfg);
   if (out_similarity) *out_similarity = sim;
   return sim >= cfg->similarity_threshold;
 }
 
-// Collapses consecutive duplicates according to cfg->
-size_t RemoveDuplicateFrames(const FrameInfo* input,
-                             size_t input_count,
-                             FrameArray* output,
-                             const DuplicateFrameRemovalSettings* cfg,
-                             IndexArray* removed_indices)
+// Run collapsing shared by the serial and parallel removal: frames are fed
+// in order with their duplicate decision against the pending frame.
+struct DuplicateRuns
+{
+  const DuplicateFrameRemovalSettings* cfg;
+  FrameArray* output;
+  IndexArray* removed_indices;
+  FrameInfo pending;
+  int group_count;
+  int group_delay_sum;
+  size_t removed;
+};
+
+static void runs_begin(DuplicateRuns* s, const FrameInfo* first, size_t input_count,
+                       FrameArray* output, const DuplicateFrameRemovalSettings* cfg,
+                       IndexArray* removed_indices)
 {
-  if (!input || input_count == 0 || !cfg) return 0;
-
   // Initialize output array
   if (output) {
     FrameArray_Init(output, input_count / 2); // start with half the input capacity
@@ -307,71 +499,272 @@ size_t RemoveDuplicateFrames(const FrameInfo* input,
     IndexArray_Init(removed_indices, input_count / 4); // start with quarter capacity
   }
 
+  s->cfg = cfg;
+  s->output = output;
+  s->removed_indices = removed_indices;
+  s->pending = *first;
+  s->group_count = 1;
+  s->group_delay_sum = first->delay_ms;
+  s->removed = 0;
+}
+
+// Emits pending with its delay adjusted for the run.
+static void runs_flush(DuplicateRuns* s)
+{
+  if (s->cfg->delay_adjust_mode == kSum)
+  {
+    s->pending.delay_ms = s->group_delay_sum;
+  }
+  else if (s->cfg->delay_adjust_mode == kAverage && s->group_count > 0)
+  {
+    s->pending.delay_ms = s->group_delay_sum / s->group_count;
+  }
+  // else kDontAdjust keeps pending.delay_ms as set.
+
+  if (s->output) FrameArray_Add(s->output, &s->pending);
+}
+
+static void runs_add(DuplicateRuns* s, const FrameInfo* cur, size_t i, bool is_dup)
+{
+  if (is_dup)
+  {
+    // Extend the duplicate run.
+    ++s->group_count;
+    s->group_delay_sum += cur->delay_ms;
+    ++s->removed;
+
+    if (s->cfg->keep_mode == kDuplicateKeepFirst)
+    {
+      // Keep the first; mark current as removed.
+      if (s->removed_indices) IndexArray_Add(s->removed_indices, i);
+    }
+    else // keep last
+    {
+      // Replace pending with current, but keep accumulating stats.
+      // The prior pending is dropped in favor of the last.
+      s->pending = *cur;
+      if (s->removed_indices) IndexArray_Add(s->removed_indices, i - 1);
+    }
+    return;
+  }
+
+  // Flush the previous run (singleton or duplicates), start a new run from current
+  runs_flush(s);
+  s->pending = *cur;
+  s->group_count = 1;
+  s->group_delay_sum = cur->delay_ms;
+}
+
+// Collapses consecutive duplicates according to cfg->
+size_t RemoveDuplicateFrames(const FrameInfo* input,
+                             size_t input_count,
+                             FrameArray* output,
+                             const DuplicateFrameRemovalSettings* cfg,
+                             IndexArray* removed_indices)
+{
+  if (!input || input_count == 0 || !cfg) return 0;
+
   // Group duplicates relative to the last kept frame.
-  FrameInfo pending = input[0];
-  int group_count = 1;
-  int group_delay_sum = pending.delay_ms;
-  size_t removed = 0;
+  DuplicateRuns runs;
+  runs_begin(&runs, &input[0], input_count, output, cfg, removed_indices);
+
+  // fingerprint of pending for prefiltering, valid if fp_roi matches
+  const bool prefilter = cfg->fingerprint_dup_bits >= 0 || cfg->fingerprint_new_bits > 0;
+  const RECT no_roi = { 0, 0, -1, -1 };
+  WDL_UINT64 fp_pending = 0;
+  RECT fp_roi = no_roi;
 
   for (size_t i = 1; i < input_count; ++i)
   {
     const FrameInfo* cur = &input[i];
-    double sim = 0.0;
-    const bool is_dup = IsDuplicateFrame(pending, *cur, *cfg, &sim);
-
-    if (is_dup)
+    const FrameInfo* pending = &runs.pending;
+    int pf = -1;
+    WDL_UINT64 fp_cur = 0;
+    RECT roi = no_roi;
+    if (prefilter && pending->bmp && cur->bmp)
     {
-      // Extend the duplicate run.
-      ++group_count;
-      group_delay_sum += cur->delay_ms;
-
-      if (cfg->keep_mode == kDuplicateKeepFirst)
-      {
-        // Keep the first; mark current as removed.
-        ++removed;
-        if (removed_indices) IndexArray_Add(removed_indices, i);
-        continue;
-      }
-      else // keep last
+      frame_pair_roi(pending, cur, &roi);
+      if (memcmp(&roi, &fp_roi, sizeof(roi)))
       {
-        // Replace pending with current, but keep accumulating stats.
-        // We do not emit output yet.
-        pending = *cur;
-        ++removed; // The prior pending will be dropped in favor of the last.
-        if (removed_indices) IndexArray_Add(removed_indices, i - 1);
-        continue;
+        fp_pending = ComputeFrameFingerprint(pending->bmp, &roi);
+        fp_roi = roi;
       }
+      fp_cur = ComputeFrameFingerprint(cur->bmp, &roi);
+      pf = FingerprintPrefilter(fp_pending, fp_cur, cfg);
     }
-
-    // Flush the previous run (singleton or duplicates).
-    if (cfg->delay_adjust_mode == kSum)
-    {
-      pending.delay_ms = group_delay_sum;
-    }
-    else if (cfg->delay_adjust_mode == kAverage && group_count > 0)
+    const bool is_dup = pf >= 0 ? pf == 1 : IsDuplicateFrame(pending, cur, cfg, NULL);
+    // cur becomes pending unless it's a duplicate that keeps the first frame
+    if (!is_dup || cfg->keep_mode != kDuplicateKeepFirst)
     {
-      pending.delay_ms = group_delay_sum / group_count;
+      fp_pending = fp_cur;
+      fp_roi = roi;
     }
-    // else kDontAdjust keeps pending.delay_ms as set.
 
-    if (output) FrameArray_Add(output, &pending);
-
-    // Start new run from current
-    pending = *cur;
-    group_count = 1;
-    group_delay_sum = cur->delay_ms;
+    runs_add(&runs, cur, i, is_dup);
   }
 
   // Flush the final run.
-  if (cfg->delay_adjust_mode == kSum)
+  runs_flush(&runs);
+  return runs.removed;
+}
+
+// Same decision as RemoveDuplicateFrames makes for prev (pending) and curr:
+// 0 = different, 1 = duplicate, 2 = duplicate with every compared pixel
+// equal (only reported for exact compares without the prefilter, where it
+// means curr compares the same as prev against any other frame).
+static int frames_duplicate(const FrameInfo* prev, const FrameInfo* curr,
+                            const DuplicateFrameRemovalSettings* cfg)
+{
+  const bool prefilter = cfg->fingerprint_dup_bits >= 0 || cfg->fingerprint_new_bits > 0;
+  if (prev->bmp && curr->bmp && prefilter)
   {
-    pending.delay_ms = group_delay_sum;
+    RECT roi;
+    frame_pair_roi(prev, curr, &roi);
+    const int pf = FingerprintPrefilter(ComputeFrameFingerprint(prev->bmp, &roi),
+                                        ComputeFrameFingerprint(curr->bmp, &roi), cfg);
+    if (pf >= 0) return pf;
   }
-  else if (cfg->delay_adjust_mode == kAverage && group_count > 0)
+  double sim = 0.0;
+  if (!IsDuplicateFrame(prev, curr, cfg, &sim)) return 0;
+  return sim >= 1.0 && cfg->per_channel_tolerance <= 0 && !prefilter ? 2 : 1;
+}
+
+// A batch of comparisons for the thread pool: frames list[0..count-1]
+// against frame prev, or (list NULL, prev < 0) frames start..start+count-1
+// each against the frame before it.
+struct DuplicatePairJob
+{
+  const FrameInfo* input;
+  const DuplicateFrameRemovalSettings* cfg;
+  long prev;
+  size_t start, count;
+  const size_t* list;
+  unsigned char* out; // count results of frames_duplicate()
+  int njobs;
+};
+
+static void pair_job(void* ctx, int idx)
+{
+  const DuplicatePairJob* job = (const DuplicatePairJob*)ctx;
+  const size_t lo = job->count * idx / job->njobs, hi = job->count * (idx+1) / job->njobs;
+  for (size_t k = lo; k < hi; k++)
   {
-    pending.delay_ms = group_delay_sum / group_count;
+    const size_t i = job->list ? job->list[k] : job->start + k;
+    const FrameInfo* prev = &job->input[job->prev >= 0 ? (size_t)job->prev : i - 1];
+    job->out[k] = (unsigned char)frames_duplicate(prev, &job->input[i], job->cfg);
+  }
+}
+
+static void run_pair_job(DuplicatePairJob* job, int nthreads)
+{
+  // a few jobs per thread, for balance when some pairs stop early
+  job->njobs = (int)(job->count < (size_t)nthreads*4 ? job->count : (size_t)nthreads*4);
+  LICE_RunParallel(job->njobs, pair_job, job, nthreads);
+}
+
+size_t RemoveDuplicateFramesParallel(const FrameInfo* input,
+                                     size_t input_count,
+                                     FrameArray* output,
+                                     const DuplicateFrameRemovalSettings* cfg,
+                                     IndexArray* removed_indices,
+                                     int nthreads)
+{
+  if (!input || input_count == 0 || !cfg) return 0;
+  if (nthreads <= 0) nthreads = LICE_GetNumCPUs();
+  if (nthreads < 2 || input_count < 3)
+    return RemoveDuplicateFrames(input, input_count, output, cfg, removed_indices);
+
+  // adjacent[i]: frames_duplicate() of frame i against frame i-1. That is the
+  // decision whenever pending is the previous frame, which is always the case
+  // when keeping the last frame of a run. batch/batch_list: speculative
+  // compares against pending, batch_pos: index in batch_list of each frame.
+  unsigned char* adjacent = (unsigned char*)malloc(input_count);
+  unsigned char* batch = (unsigned char*)malloc(input_count);
+  size_t* batch_list = (size_t*)malloc(input_count * sizeof(size_t));
+  size_t* batch_pos = (size_t*)malloc(input_count * sizeof(size_t));
+  if (!adjacent || !batch || !batch_list || !batch_pos)
+  {
+    free(adjacent);
+    free(batch);
+    free(batch_list);
+    free(batch_pos);
+    return RemoveDuplicateFrames(input, input_count, output, cfg, removed_indices);
+  }
+
+  DuplicatePairJob job;
+  job.input = input;
+  job.cfg = cfg;
+  job.prev = -1;
+  job.start = 1;
+  job.count = input_count - 1;
+  job.list = NULL;
+  job.out = adjacent + 1;
+  run_pair_job(&job, nthreads);
+
+  DuplicateRuns runs;
+  runs_begin(&runs, &input[0], input_count, output, cfg, removed_indices);
+
+  // when keeping the first frame, frames after the second of a run compare
+  // against its first frame. frames identical to their predecessor need no
+  // compare, the others are compared in speculative batches, which grow
+  // while the run continues. the part of a batch past the end of the run is
+  // wasted.
+  size_t pending = 0, batch_end = 0, batch_size = (size_t)nthreads;
+  for (size_t i = 1; i < input_count; i++)
+  {
+    const FrameInfo* a = &input[i-1];
+    const FrameInfo* b = &input[i];
+    const bool same_as_prev = adjacent[i] == 2 && a->x == b->x && a->y == b->y && a->w == b->w && a->h == b->h;
+    bool is_dup;
+    if (cfg->keep_mode != kDuplicateKeepFirst || pending == i - 1)
+    {
+      is_dup = adjacent[i] != 0;
+    }
+    else if (same_as_prev)
+    {
+      // compares the same as the previous frame, which is in pending's run
+      is_dup = true;
+    }
+    else
+    {
+      if (i >= batch_end)
+      {
+        size_t n = 0, j;
+        for (j = i; j < input_count && n < batch_size; j++)
+        {
+          const FrameInfo* pj = &input[j-1];
+          const FrameInfo* cj = &input[j];
+          if (j == i || adjacent[j] != 2 || pj->x != cj->x || pj->y != cj->y || pj->w != cj->w || pj->h != cj->h)
+          {
+            batch_pos[j] = n;
+            batch_list[n++] = j;
+          }
+        }
+        batch_end = j;
+        if (batch_size < (size_t)nthreads*16) batch_size *= 2;
+
+        job.prev = (long)pending;
+        job.count = n;
+        job.list = batch_list;
+        job.out = batch;
+        run_pair_job(&job, nthreads);
+      }
+      is_dup = batch[batch_pos[i]] != 0;
+    }
+
+    runs_add(&runs, b, i, is_dup);
+    if (!is_dup || cfg->keep_mode != kDuplicateKeepFirst)
+    {
+      pending = i;
+      batch_end = 0; // the rest of any batch was against the old pending
+      batch_size = (size_t)nthreads;
+    }
   }
-  if (output) FrameArray_Add(output, &pending);
 
-  return removed;
+  runs_flush(&runs);
+  free(adjacent);
+  free(batch);
+  free(batch_list);
+  free(batch_pos);
+  return runs.removed;
 }
@@ -20,6 +20,7 @@
 
 #include <stddef.h>
 
+#include "../WDL/wdltypes.h"   // WDL_UINT64
 #include "../WDL/lice/lice.h"  // LICE_IBitmap, LICE_pixel and helpers
 
 // FrameInfo describes a captured frame and basic timing/geometry.
@@ -88,6 +89,14 @@ struct DuplicateFrameRemovalSettings
   // early when it is impossible to reach the threshold.
   bool enable_early_out;
 
+  // Optional perceptual prefilter (see ComputeFrameFingerprint): frames
+  // whose fingerprints differ in at most fingerprint_dup_bits bits are
+  // duplicates, and frames differing in at least fingerprint_new_bits bits
+  // are not, without a pixel compare. Both are heuristics; -1 and 0
+  // (the defaults) disable them.
+  int fingerprint_dup_bits;
+  int fingerprint_new_bits;
+
   DuplicateFrameRemovalSettings()
     : similarity_threshold(0.90),
       sample_step_x(1),
@@ -96,18 +105,37 @@ struct DuplicateFrameRemovalSettings
       channel_mask(LICE_RGBA(255,255,255,0)), // ignore alpha by default
       keep_mode(kDuplicateKeepFirst),
       delay_adjust_mode(kSum),
-      enable_early_out(true)
+      enable_early_out(true),
+      fingerprint_dup_bits(-1),
+      fingerprint_new_bits(0)
   {}
 };
 
 // Calculate pixel-level similarity between two bitmaps.
 // Returns a value in [0,1], where 1.0 means identical under settings.
 // If roi is non-NULL, comparison is restricted to the given rectangle.
+// With enable_early_out, results below similarity_threshold may be lower
+// than the exact similarity.
 double CalculateSimilarity(LICE_IBitmap* a,
                            LICE_IBitmap* b,
                            const RECT* roi,
                            const DuplicateFrameRemovalSettings* cfg);
 
+// Perceptual fingerprint (difference hash) of a frame: the luma of roi
+// (full frame if NULL) is box-averaged down to 9x8 cells, and each of the
+// 64 bits is set when a cell is clearly brighter than its right neighbour.
+// Each average uses at most 16x16 samples, so this is cheap even for
+// large frames.
+WDL_UINT64 ComputeFrameFingerprint(LICE_IBitmap* bmp, const RECT* roi);
+
+// Number of differing bits between two fingerprints.
+int FingerprintDistance(WDL_UINT64 a, WDL_UINT64 b);
+
+// Classifies a pair of fingerprints with cfg->fingerprint_dup_bits and
+// fingerprint_new_bits: 1 = duplicate, 0 = different, -1 = undecided (an
+// exact compare is needed; always the case if the prefilter is disabled).
+int FingerprintPrefilter(WDL_UINT64 a, WDL_UINT64 b, const DuplicateFrameRemovalSettings* cfg);
+
 // Lightweight duplicate test for two frames. Returns true if similar
 // enough under cfg. Optionally writes the computed similarity.
 bool IsDuplicateFrame(const FrameInfo* prev,
@@ -141,7 +169,8 @@ void IndexArray_Add(IndexArray* arr, size_t index);
 void FrameArray_Free(FrameArray* arr);
 void IndexArray_Free(IndexArray* arr);
 
-// Remove consecutive duplicates from an input sequence.
+// Remove consecutive duplicates from an input sequence. Uses the
+// fingerprint prefilter if enabled in cfg.
 // - input:  original frames in capture order
 // - input_count: number of frames in input array
 // - output: filtered frames after duplicate removal (will be initialized)
@@ -154,4 +183,14 @@ size_t RemoveDuplicateFrames(const FrameInfo* input,
                              const DuplicateFrameRemovalSettings* cfg,
                              IndexArray* removed_indices);
 
+// Same as RemoveDuplicateFrames, with identical results, but with the
+// frame comparisons spread over up to nthreads threads (<=0: number of
+// CPUs). For offline processing of long sequences.
+size_t RemoveDuplicateFramesParallel(const FrameInfo* input,
+                                     size_t input_count,
+                                     FrameArray* output,
+                                     const DuplicateFrameRemovalSettings* cfg,
+                                     IndexArray* removed_indices,
+                                     int nthreads);
+
 #endif // DUPLICATE_FRAME_REMOVAL_H_
@@ -19,11 +19,19 @@
 
 #include <stdio.h>
 #include <windows.h>
+#ifdef _WIN32
+#include <process.h>
+#endif
 #include <signal.h>
 
 
 #include "../WDL/lice/lice_lcf.h"
+#include "../WDL/lice/lice_parallel.h"
+#include "../WDL/mutex.h"
+#include "../WDL/time_precise.h"
+#include "../WDL/wdlstring.h"
 #include "licecap_version.h"
+#include "duplicate_frame_removal.h"
 
 bool g_done=false;
 
@@ -71,11 +79,472 @@ void DoMouseCursor(HDC hdc, HWND h, int xoffs, int yoffs)
   else printf("fail cursor\n");
 }
 
+// LCF to GIF conversion pipeline: a thread decodes frames ahead into a ring, worker threads find the
+// changed rectangle of each frame (against the frame before it) and encode it into memory, and the
+// calling thread writes the encoded frames in order, merging the delays of unchanged frames.
+// in analysis mode (the first of two passes for global palettes) the workers count the colors of the
+// changed pixels instead, and the calling thread merges them into one histogram per scene. frames that
+// are encoded with those palettes make their unchanged pixels transparent
+#define TRANSCODE_RING 64
+#define TRANSCODE_MAXTHREADS 32
+#define TRANSCODE_SCENE_CHANGE 0.5 // a frame that changes at least this much of the image can start a new scene
+
+struct lcf_gif_scene
+{
+  int start; // first frame
+  int palsz;
+  LICE_pixel pal[256];
+  unsigned char tab[32*32*32]; // LICE_GeneratePaletteLookupTable()
+};
+
+class lcf_gif_transcoder
+{
+  struct frameRec
+  {
+    LICE_MemBitmap bm;
+    int delay_ms;
+    int coords[4];
+    bool changed;
+    bool done; // set by the worker
+    void *enc; // LICE_WriteGIFBeginMem() handle holding the encoded frame
+    void *hist; // analysis mode: colors of the changed pixels
+    int histcnt;
+  };
+
+  frameRec m_frames[TRANSCODE_RING]; // frame i is in m_frames[i%TRANSCODE_RING]
+  LICECaptureDecompressor *m_dec;
+  int m_w, m_h;
+  bool m_analyze;
+  const WDL_TypedBuf<lcf_gif_scene> *m_scenes; // if set, frames are encoded with these palettes
+
+  WDL_Mutex m_mutex;
+  int m_decoded; // frames available in the ring
+  int m_nextjob; // next frame for a worker
+  int m_released; // frames before this have been written and may be replaced by the decoder
+  bool m_eof, m_kill;
+
+  HANDLE m_threads[TRANSCODE_MAXTHREADS+1];
+  int m_nthreads;
+
+  static unsigned WINAPI decodeThreadProc(void *p)
+  {
+    lcf_gif_transcoder *_this = (lcf_gif_transcoder *)p;
+    int x=0;
+    for (;;)
+    {
+      _this->m_mutex.Enter();
+      const bool full = x - TRANSCODE_RING >= _this->m_released;
+      const bool kill = _this->m_kill;
+      _this->m_mutex.Leave();
+      if (kill) break;
+      if (full) { Sleep(1); continue; }
+
+      LICE_IBitmap *bm = _this->m_dec->GetCurrentFrame();
+      if (!bm) break;
+
+      frameRec *rec = &_this->m_frames[x%TRANSCODE_RING];
+      LICE_Copy(&rec->bm,bm);
+      rec->delay_ms = _this->m_dec->GetTimeToNextFrame();
+      rec->changed = rec->done = false;
+      _this->m_dec->NextFrame();
+
+      _this->m_mutex.Enter();
+      _this->m_decoded = ++x;
+      _this->m_mutex.Leave();
+    }
+    _this->m_mutex.Enter();
+    _this->m_eof = true;
+    _this->m_mutex.Leave();
+    return 0;
+  }
+
+  static unsigned WINAPI encodeThreadProc(void *p)
+  {
+    lcf_gif_transcoder *_this = (lcf_gif_transcoder *)p;
+    for (;;)
+    {
+      int idx = -1;
+      _this->m_mutex.Enter();
+      if (_this->m_nextjob < _this->m_decoded) idx = _this->m_nextjob++;
+      const bool stop = _this->m_kill || (_this->m_eof && _this->m_nextjob >= _this->m_decoded);
+      _this->m_mutex.Leave();
+
+      if (idx < 0)
+      {
+        if (stop) break;
+        Sleep(1);
+        continue;
+      }
+
+      // the previous frame is not released until this one is done
+      frameRec *rec = &_this->m_frames[idx%TRANSCODE_RING];
+      LICE_IBitmap *prevbm = idx ? &_this->m_frames[(idx-1)%TRANSCODE_RING].bm : NULL;
+      rec->coords[0]=rec->coords[1]=0;
+      rec->coords[2]=_this->m_w;
+      rec->coords[3]=_this->m_h;
+      rec->changed = !prevbm || LICE_BitmapCmp(&rec->bm,prevbm,rec->coords);
+      if (rec->changed)
+      {
+        LICE_SubBitmap sub(&rec->bm,rec->coords[0],rec->coords[1],rec->coords[2],rec->coords[3]);
+        if (_this->m_analyze)
+        {
+          LICE_SubBitmap prevsub(prevbm,rec->coords[0],rec->coords[1],rec->coords[2],rec->coords[3]);
+          LICE_ResetPaletteHistogram(rec->hist);
+          rec->histcnt = LICE_AddToPaletteHistogram(rec->hist,&sub,prevbm ? &prevsub : NULL);
+        }
+        else if (_this->m_scenes)
+        {
+          const lcf_gif_scene *scenes = _this->m_scenes->Get();
+          int s = _this->m_scenes->GetSize()-1;
+          while (s > 0 && scenes[s].start > idx) s--;
+          LICE_SetGIFColorMap(rec->enc,scenes[s].pal,scenes[s].palsz,s==0,scenes[s].tab);
+          LICE_WriteGIFSetPrevFrame(rec->enc,prevbm);
+          LICE_WriteGIFFrame(rec->enc,&sub,rec->coords[0],rec->coords[1],false);
+        }
+        else
+        {
+          LICE_WriteGIFFrame(rec->enc,&sub,rec->coords[0],rec->coords[1],true);
+        }
+      }
+
+      _this->m_mutex.Enter();
+      rec->done = true;
+      _this->m_mutex.Leave();
+    }
+    return 0;
+  }
+
+  // waits for frame x to be done, returns NULL at the end
+  frameRec *getFrame(int x)
+  {
+    while (!g_done)
+    {
+      bool ready=false, eof=false;
+      m_mutex.Enter();
+      if (x < m_decoded) ready = m_frames[x%TRANSCODE_RING].done;
+      else eof = m_eof;
+      m_mutex.Leave();
+      if (eof) break;
+      if (ready) return &m_frames[x%TRANSCODE_RING];
+      Sleep(1);
+    }
+    return NULL;
+  }
+
+  // frames before x may be replaced (frame x is compared against by the frame after it)
+  void releaseFrame(int x)
+  {
+    m_mutex.Enter();
+    m_released = x;
+    m_mutex.Leave();
+  }
+
+  static void finishScene(lcf_gif_scene *scene, void *hist, int maxcolors)
+  {
+    scene->palsz = LICE_BuildPaletteFromHistogram(hist,scene->pal,maxcolors,LICE_PALETTE_KMEANS);
+    if (scene->palsz < 1)
+    {
+      scene->pal[0] = LICE_RGBA(0,0,0,255);
+      scene->palsz = 1;
+    }
+    LICE_GeneratePaletteLookupTable(scene->pal,scene->palsz,scene->tab);
+  }
+
+public:
+  int m_frames_in, m_frames_out;
+
+  // analyze: count colors for analyze() rather than encoding for run(). scenes: palettes from analyze() for run() to encode with
+  lcf_gif_transcoder(LICECaptureDecompressor *dec, int nthreads, bool analyze=false, const WDL_TypedBuf<lcf_gif_scene> *scenes=NULL)
+  {
+    m_dec = dec;
+    m_w = dec->GetWidth();
+    m_h = dec->GetHeight();
+    m_analyze = analyze;
+    m_scenes = scenes && scenes->GetSize() ? scenes : NULL;
+    int x;
+    for (x=0;x<TRANSCODE_RING;x++)
+    {
+      m_frames[x].bm.resize(m_w,m_h);
+      m_frames[x].enc = analyze ? NULL : LICE_WriteGIFBeginMem(m_w,m_h,m_scenes ? -1 : 0);
+      m_frames[x].hist = analyze ? LICE_CreatePaletteHistogram() : NULL;
+      m_frames[x].histcnt = 0;
+    }
+    m_decoded=m_nextjob=m_released=0;
+    m_eof=m_kill=false;
+    m_frames_in=m_frames_out=0;
+
+    if (nthreads<1) nthreads=LICE_GetNumCPUs();
+    if (nthreads>TRANSCODE_MAXTHREADS) nthreads=TRANSCODE_MAXTHREADS;
+    m_nthreads=0;
+    unsigned id;
+    m_threads[m_nthreads] = (HANDLE)_beginthreadex(NULL,0,decodeThreadProc,this,0,&id);
+    if (m_threads[m_nthreads]) m_nthreads++;
+    for (x=0;x<nthreads;x++)
+    {
+      m_threads[m_nthreads] = (HANDLE)_beginthreadex(NULL,0,encodeThreadProc,this,0,&id);
+      if (m_threads[m_nthreads]) m_nthreads++;
+    }
+  }
+
+  ~lcf_gif_transcoder()
+  {
+    m_mutex.Enter();
+    m_kill=true;
+    m_mutex.Leave();
+    int x;
+    for (x=0;x<m_nthreads;x++)
+    {
+      WaitForSingleObject(m_threads[x],INFINITE);
+      CloseHandle(m_threads[x]);
+    }
+    for (x=0;x<TRANSCODE_RING;x++)
+    {
+      LICE_WriteGIFEnd(m_frames[x].enc);
+      LICE_DestroyPaletteHistogram(m_frames[x].hist);
+    }
+  }
+
+  // writes all frames to wr, returns false if the threads could not be started
+  bool run(void *wr)
+  {
+    if (m_nthreads<2 || m_analyze) return false;
+
+    void *pending = LICE_WriteGIFBeginMem(m_w,m_h,m_scenes ? -1 : 0); // last changed frame, written when its delay is known
+    bool has_pending=false;
+    int accum_lat=0, x=0;
+    frameRec *rec;
+    while ((rec = getFrame(x)))
+    {
+      if (rec->changed)
+      {
+        if (has_pending)
+        {
+          if (accum_lat<1) accum_lat=1;
+          LICE_WriteGIFFrameFromMem(wr,pending,accum_lat);
+          m_frames_out++;
+        }
+        void *t = pending;
+        pending = rec->enc;
+        rec->enc = t;
+        has_pending=true;
+        accum_lat=0;
+      }
+      accum_lat += rec->delay_ms;
+      m_frames_in++;
+      releaseFrame(x++);
+    }
+    if (has_pending)
+    {
+      if (accum_lat<1) accum_lat=1;
+      LICE_WriteGIFFrameFromMem(wr,pending,accum_lat);
+      m_frames_out++;
+    }
+    LICE_WriteGIFEnd(pending);
+    return true;
+  }
+
+  // builds palettes from the changed pixels of all frames: one, or if maxscenes>1, one for each scene. a frame
+  // that changes much of the image starts a new scene, if the current scene is long enough that there can be
+  // no more than maxscenes. returns false if the threads could not be started
+  bool analyze(WDL_TypedBuf<lcf_gif_scene> *scenes, int maxscenes, int maxcolors)
+  {
+    scenes->Resize(0,false);
+    if (m_nthreads<2 || !m_analyze) return false;
+
+    void *hist = LICE_CreatePaletteHistogram();
+    if (!hist) return false;
+    const int min_scene_ms = maxscenes > 1 ? m_dec->GetLength() / maxscenes : 0;
+    int scene_ms=0, x=0;
+    frameRec *rec;
+    while ((rec = getFrame(x)))
+    {
+      if (rec->changed)
+      {
+        if (!x || (scenes->GetSize() < maxscenes && scene_ms >= min_scene_ms &&
+                   rec->histcnt >= m_w*(double)m_h*TRANSCODE_SCENE_CHANGE))
+        {
+          if (x) finishScene(scenes->Get()+scenes->GetSize()-1,hist,maxcolors);
+          lcf_gif_scene *scene = scenes->ResizeOK(scenes->GetSize()+1);
+          if (!scene) break;
+          scene[scenes->GetSize()-1].start = x;
+          LICE_ResetPaletteHistogram(hist);
+          scene_ms=0;
+        }
+        LICE_MergePaletteHistogram(hist,rec->hist);
+      }
+      scene_ms += rec->delay_ms;
+      m_frames_in++;
+      releaseFrame(x++);
+    }
+    if (scenes->GetSize()) finishScene(scenes->Get()+scenes->GetSize()-1,hist,maxcolors);
+    LICE_DestroyPaletteHistogram(hist);
+    return true;
+  }
+};
+
+// --tune-lcf: re-encodes the first maxframes frames of an LCF file with each tile size and interval (deflate
+// level 9, one thread, as CompressChunks() cost depends on the geometry), and reports the size and encode time
+static void tune_lcf(const char *fn, int maxframes)
+{
+  static const int tiles[][2] = { {64,16}, {128,16}, {256,16}, {128,8}, {128,32}, {64,64}, {256,32} };
+  static const int intervals[] = { 10, 20, 40 };
+  const int ntiles = sizeof(tiles)/sizeof(tiles[0]), nintervals = sizeof(intervals)/sizeof(intervals[0]);
+
+  LICECaptureDecompressor dec(fn,true);
+  if (!dec.IsOpen()) { printf("Error opening '%s'\n",fn); return; }
+  const int w = dec.GetWidth(), h = dec.GetHeight();
+
+  WDL_FastString tmpfn(fn);
+  tmpfn.Append(".tune.tmp");
+
+  printf("tuning %dx%d, up to %d frames:\n",w,h,maxframes);
+  printf("  tile     interval  size (KB)  vs 128x16/20  encode ms  ms/frame\n");
+  double refsize=0.0, bestsize=0.0, besttime=0.0;
+  int bestsize_cfg[3]={0,}, besttime_cfg[3]={0,};
+  int t, i;
+  for (t=0;t<ntiles && !g_done;t++) for (i=0;i<nintervals && !g_done;i++)
+  {
+    // the default geometry is first, the others are compared to it
+    const int ti = t==0 ? 1 : t==1 ? 0 : t, ii = i==0 ? 1 : i==1 ? 0 : i;
+    double enctime=0.0;
+    WDL_INT64 sz=0;
+    int nframes=0;
+    dec.Seek(0);
+    {
+      LICECaptureCompressor enc(tmpfn.Get(),w,h,intervals[ii],tiles[ti][0],tiles[ti][1]);
+      if (!enc.IsOpen()) { printf("Error writing '%s'\n",tmpfn.Get()); return; }
+      enc.SetStreaming(64<<20);
+      while (nframes < maxframes && !g_done)
+      {
+        LICE_IBitmap *bm = dec.GetCurrentFrame();
+        if (!bm) break;
+        const double st = time_precise();
+        enc.OnFrame(bm,dec.GetTimeToNextFrame());
+        enctime += time_precise()-st;
+        nframes++;
+        if (dec.NextFrame()) break;
+      }
+      const double st = time_precise();
+      enc.OnFrame(NULL,0);
+      enctime += time_precise()-st;
+      sz = enc.GetOutSize();
+    }
+    DeleteFile(tmpfn.Get());
+    if (!nframes) break;
+
+    if (refsize<=0.0) refsize = (double)sz;
+    printf("  %3dx%-3d  %8d  %9.1f  %11.1f%%  %9.1f  %8.2f\n",tiles[ti][0],tiles[ti][1],intervals[ii],
+      sz/1024.0,sz*100.0/refsize,enctime*1000.0,enctime*1000.0/nframes);
+
+    if (bestsize<=0.0 || sz < bestsize)
+    {
+      bestsize = (double)sz;
+      bestsize_cfg[0]=tiles[ti][0]; bestsize_cfg[1]=tiles[ti][1]; bestsize_cfg[2]=intervals[ii];
+    }
+    if (besttime<=0.0 || enctime < besttime)
+    {
+      besttime = enctime;
+      besttime_cfg[0]=tiles[ti][0]; besttime_cfg[1]=tiles[ti][1]; besttime_cfg[2]=intervals[ii];
+    }
+  }
+  if (bestsize>0.0)
+    printf("smallest: %dx%d/%d, fastest: %dx%d/%d (licecap -e file.lcf [maxfps] tilew tileh interval)\n",
+      bestsize_cfg[0],bestsize_cfg[1],bestsize_cfg[2],besttime_cfg[0],besttime_cfg[1],besttime_cfg[2]);
+}
+
+// -optimize: writes a kept frame as the rect that changed since the previous one (the whole first
+// frame). lastfr holds the previous frame, pixels that match it are encoded as transparent
+static void optimize_write_frame(void *wr, LICE_MemBitmap *lastfr, const FrameInfo *f, bool first)
+{
+  int coords[4]={0,0,f->bmp->getWidth(),f->bmp->getHeight()};
+  // kept frames always differ from the previous one unless only alpha changed, write a pixel for its delay
+  if (!first && !LICE_BitmapCmp(f->bmp,lastfr,coords)) coords[2]=coords[3]=1;
+  LICE_SubBitmap sub(f->bmp,coords[0],coords[1],coords[2],coords[3]);
+  LICE_WriteGIFFrame(wr,&sub,coords[0],coords[1],true,first && f->delay_ms<1 ? 1 : f->delay_ms);
+  LICE_Copy(lastfr,f->bmp);
+}
+
+// -optimize: re-encodes a GIF, dropping frames that are duplicates of the last kept frame (their
+// delays added to it), and writing each kept frame as its changed rect with unchanged pixels transparent.
+// Frames are decoded and deduplicated a chunk at a time, so memory use doesn't depend on the length of
+// the GIF: the last kept frame of a chunk is held back (its delay may still grow) and starts the next
+// chunk, which keeps the same frames as one RemoveDuplicateFrames() over the whole file would.
+static void optimize_gif(const char *infn, const char *outfn, double similarity, int nthreads)
+{
+  void *rd = LICE_GIF_LoadEx(infn);
+  if (!rd) { printf("Error opening '%s'\n",infn); return; }
+
+  if (nthreads<1) nthreads=LICE_GetNumCPUs();
+  const int chunk = wdl_max(nthreads*4,16); // new frames per RemoveDuplicateFramesParallel() call
+
+  DuplicateFrameRemovalSettings cfg; // keep first, sum delays
+  cfg.similarity_threshold = wdl_min(wdl_max(similarity,0.0),1.0);
+
+  WDL_PtrList<LICE_MemBitmap> bufs; // chunk+1 frames, the held back frame first
+  WDL_TypedBuf<FrameInfo> frames;
+  FrameInfo *fr = frames.Resize(chunk+1,false);
+  LICE_MemBitmap canvas, lastfr;
+  void *wr=NULL;
+  int nin=0, nout=0, n=0;
+  bool eof=false;
+  const double st = time_precise();
+
+  while (fr && !eof)
+  {
+    while (n <= chunk && !g_done)
+    {
+      const int del = LICE_GIF_UpdateFrame(rd,&canvas);
+      if (del<0) { eof=true; break; }
+      if (!wr)
+      {
+        wr=LICE_WriteGIFBeginNoFrame(outfn,canvas.getWidth(),canvas.getHeight(),-1,false);
+        if (!wr) { printf("error writing gif '%s'\n",outfn); LICE_GIF_Close(rd); return; }
+        LICE_WriteGIFSetThreads(wr,nthreads);
+      }
+      LICE_MemBitmap *bm = bufs.Get(n);
+      if (!bm) bufs.Add(bm = new LICE_MemBitmap);
+      LICE_Copy(bm,&canvas);
+      fr[n++] = FrameInfo(nin++,bm,del);
+    }
+    if (g_done) eof=true;
+    if (!n) break;
+
+    FrameArray kept;
+    RemoveDuplicateFramesParallel(fr,n,&kept,&cfg,NULL,nthreads);
+    const int nfinal = eof ? (int)kept.count : (int)kept.count-1;
+    for (int x=0;x<nfinal;x++) optimize_write_frame(wr,&lastfr,kept.frames+x,!nout++);
+
+    n=0;
+    if (!eof && kept.count)
+    {
+      // the held back frame moves to the first buffer
+      fr[0] = kept.frames[kept.count-1];
+      LICE_MemBitmap **list = bufs.GetList();
+      for (int x=0;x<bufs.GetSize();x++) if (list[x]==fr[0].bmp) { list[x]=list[0]; list[0]=(LICE_MemBitmap*)fr[0].bmp; break; }
+      n=1;
+    }
+    FrameArray_Free(&kept);
+  }
+
+  const unsigned int insize = LICE_GIF_GetFilePos(rd);
+  LICE_GIF_Close(rd);
+  bufs.Empty(true);
+  if (!wr) { printf("no frames in '%s'\n",infn); return; }
+
+  const unsigned int outsize = LICE_WriteGIFGetSize(wr);
+  LICE_WriteGIFEnd(wr);
+  double sec = time_precise()-st;
+  if (sec < 0.001) sec=0.001;
+  printf("%d frames (%d written) in %.2fs: %.1f frames/s, %.2fMB/s GIF in, %.2fMB -> %.2fMB (%.1f%% smaller)\n",
+    nin,nout,sec,nin/sec,insize/1024.0/1024.0/sec,insize/1024.0/1024.0,outsize/1024.0/1024.0,
+    insize ? 100.0 - outsize*100.0/insize : 0.0);
+}
+
 int main(int argc, char **argv)
 {
   printf("LICEcap CLI utility " LICECAP_VERSION "\nCopyright (C) 2010 Cockos Incorporated\n");
   signal(SIGINT,sigfuncint);
-  if (argc==4 && !strcmp(argv[1],"-d"))
+  if ((argc>=4&&argc<=5 && !strcmp(argv[1],"-d")) || (argc>=4&&argc<=6 && !strcmp(argv[1],"-g")))
   {
     LICECaptureDecompressor tc(argv[2],true);
     if (tc.IsOpen())
@@ -84,76 +553,96 @@ int main(int argc, char **argv)
 
       if (strstr(argv[3],".gif"))
       {
-        void *wr=LICE_WriteGIFBeginNoFrame(argv[3],tc.GetWidth(),tc.GetHeight(),0,true);
+        const bool useSinglePalette = argv[1][1]=='g';
+        void *wr=LICE_WriteGIFBeginNoFrame(argv[3],tc.GetWidth(),tc.GetHeight(),useSinglePalette ? -1 : 0,true);
 
         if (wr)
         {
-          bool useSinglePalette = false;
-          if (useSinglePalette) // create
+          const int nthreads = argc>=5 ? atoi(argv[4]) : 0;
+          WDL_TypedBuf<lcf_gif_scene> scenes;
+          if (useSinglePalette) // first pass: palettes from the changed pixels of every frame
           {
-            void *octree = LICE_CreateOctree(256);
-            if (octree)
+            printf("building palette...");
+            fflush(stdout);
+            tc.Seek(0);
+            const DWORD st = GetTickCount();
+            lcf_gif_transcoder pipe(&tc,nthreads,true);
+            if (pipe.analyze(&scenes,argc==6 ? atoi(argv[5]) : 1,255) && scenes.GetSize())
             {
-              printf("building palette...");
-              fflush(stdout);
-              for (x=0;!g_done;x++)
-              {
-                LICE_IBitmap *bm = tc.GetCurrentFrame();
-                if (!bm) break;
-                LICE_BuildOctree(octree, bm);
-                printf(".");
-                fflush(stdout);
-                tc.NextFrame();
-              }
-              LICE_SetGIFColorMapFromOctree(wr, octree, 256);
-              printf("done\n");
-              LICE_DestroyOctree(octree);
+              LICE_SetGIFColorMap(wr,scenes.Get()->pal,scenes.Get()->palsz,true,scenes.Get()->tab);
+              printf("%d frames, %d palette%s in %.2fs\n",pipe.m_frames_in,scenes.GetSize(),
+                scenes.GetSize()==1 ? "" : "s",(GetTickCount()-st)/1000.0);
             }
+            else printf("failed\n");
           }
 
-          LICE_MemBitmap lastfr(tc.GetWidth(),tc.GetHeight());
-          int lastfr_coords[4];
-          int accum_lat=0;
-          bool first=true;
+          bool piped=false;
+          if (!useSinglePalette || scenes.GetSize())
+          {
+            tc.Seek(0);
+            tc.m_bytes_read=0;
+            const double framebytes = tc.GetWidth()*(double)tc.GetHeight()*4.0;
+            const DWORD st = GetTickCount();
+            lcf_gif_transcoder pipe(&tc,nthreads,false,&scenes);
+            if ((piped = pipe.run(wr)))
+            {
+              double sec = (GetTickCount()-st) / 1000.0;
+              if (sec < 0.001) sec=0.001;
+              printf("%d frames (%d written) in %.2fs: %.1f frames/s, %.2fMB/s LCF, %.1fMB/s decoded, %.2fMB GIF\n",
+                pipe.m_frames_in,pipe.m_frames_out,sec,pipe.m_frames_in/sec,
+                tc.m_bytes_read/1024.0/1024.0/sec,
+                framebytes*pipe.m_frames_in/1024.0/1024.0/sec,
+                LICE_WriteGIFGetSize(wr)/1024.0/1024.0);
+            }
+          }
 
-          tc.Seek(0);
-          for (x=0;!g_done;x++)
+          if (!piped)
           {
-            LICE_IBitmap *bm = tc.GetCurrentFrame();
-            if (!bm) break;
-            int diffcoords[4]={0,0,tc.GetWidth(),tc.GetHeight()};
+            LICE_MemBitmap lastfr(tc.GetWidth(),tc.GetHeight());
+            int lastfr_coords[4];
+            int accum_lat=0;
+            bool first=true;
 
-            if (!first)
+            tc.Seek(0);
+            for (x=0;!g_done;x++)
             {
-              if (!LICE_BitmapCmp(bm,&lastfr,diffcoords))
+              LICE_IBitmap *bm = tc.GetCurrentFrame();
+              if (!bm) break;
+              int diffcoords[4]={0,0,tc.GetWidth(),tc.GetHeight()};
+
+              if (!first)
               {
-                accum_lat += tc.GetTimeToNextFrame();
-                tc.NextFrame();
-                continue;
+                if (!LICE_BitmapCmp(bm,&lastfr,diffcoords))
+                {
+                  accum_lat += tc.GetTimeToNextFrame();
+                  tc.NextFrame();
+                  continue;
+                }
+                LICE_SubBitmap bm(&lastfr,lastfr_coords[0],lastfr_coords[1],
+                  lastfr_coords[2],lastfr_coords[3]);
+
+                if (accum_lat<1) accum_lat=1;
+                LICE_WriteGIFFrame(wr,&bm,lastfr_coords[0],lastfr_coords[1],
+                                      !useSinglePalette,accum_lat);
+                accum_lat=0;
               }
+
+              first=false;
+              accum_lat += tc.GetTimeToNextFrame();
+
+              LICE_Copy(&lastfr,bm);
+              memcpy(lastfr_coords,diffcoords,sizeof(diffcoords));
+
+              tc.NextFrame();
+            }
+            if (!first) 
+            {
               LICE_SubBitmap bm(&lastfr,lastfr_coords[0],lastfr_coords[1],
                 lastfr_coords[2],lastfr_coords[3]);
-
               if (accum_lat<1) accum_lat=1;
-              LICE_WriteGIFFrame(wr,&bm,lastfr_coords[0],lastfr_coords[1],
-                                    !useSinglePalette,accum_lat);
-              accum_lat=0;
+              LICE_WriteGIFFrame(wr,&bm,lastfr_coords[0],lastfr_coords[1],!useSinglePalette,accum_lat);
             }
 
-            first=false;
-            accum_lat += tc.GetTimeToNextFrame();
-
-            LICE_Copy(&lastfr,bm);
-            memcpy(lastfr_coords,diffcoords,sizeof(diffcoords));
-
-            tc.NextFrame();
-          }
-          if (!first) 
-          {
-            LICE_SubBitmap bm(&lastfr,lastfr_coords[0],lastfr_coords[1],
-              lastfr_coords[2],lastfr_coords[3]);
-            if (accum_lat<1) accum_lat=1;
-            LICE_WriteGIFFrame(wr,&bm,lastfr_coords[0],lastfr_coords[1],!useSinglePalette,accum_lat);
           }
 
           LICE_WriteGIFEnd(wr);
@@ -184,10 +673,18 @@ int main(int argc, char **argv)
     }
     else printf("Error opening '%s'\n",argv[2]);
   }
-  else if ((argc==3||argc==4) && !strcmp(argv[1],"-e"))
+  else if ((argc==3||argc==4) && !strcmp(argv[1],"--tune-lcf"))
+  {
+    tune_lcf(argv[2],argc==4 ? atoi(argv[3]) : 200);
+  }
+  else if (argc>=4 && argc<=6 && !strcmp(argv[1],"-optimize"))
+  {
+    optimize_gif(argv[2],argv[3],argc>=5 ? atof(argv[4]) : 1.0,argc>=6 ? atoi(argv[5]) : 0);
+  }
+  else if (argc>=3 && argc<=7 && !strcmp(argv[1],"-e"))
   {
     DWORD st = GetTickCount();
-    double fr = argc==4 ? atof(argv[3]) : 5.0;
+    double fr = argc>=4 ? atof(argv[3]) : 5.0;
     if (fr < 1.0) fr=1.0;
     fr = 1000.0/fr;
 
@@ -207,7 +704,14 @@ int main(int argc, char **argv)
     LICECaptureCompressor *tc = NULL;
     void *gif_wr=NULL;
     
-    if (!gifMode&&!pngMode) tc = new LICECaptureCompressor(argv[2],r.right,r.bottom);
+    if (!gifMode&&!pngMode) 
+    {
+      const int tile_w = argc>=5 ? atoi(argv[4]) : 128, tile_h = argc>=6 ? atoi(argv[5]) : 16;
+      const int interval = argc>=7 ? atoi(argv[6]) : 20;
+      tc = new LICECaptureCompressor(argv[2],r.right,r.bottom,wdl_max(interval,1),wdl_max(tile_w,1),wdl_max(tile_h,1),LICE_LCF_LEVEL_ADAPTIVE);
+      tc->SetThreads(0);
+      tc->SetStreaming(64<<20); // keeps changed tiles rather than full frames
+    }
     if (gifMode||pngMode||tc->IsOpen())
     {
       printf("Encoding %dx%d target %.1f fps (press Ctrl+C to stop):\n",r.right,r.bottom,1000.0/fr);
@@ -309,8 +813,15 @@ int main(int argc, char **argv)
   else 
   {
     printf("usage: \n"
-           "  licecap -d file.lcf fnout[.gif|.png]]  ; converts lcf file to gif (or PNGs)\n"
-           "  licecap -e file.[lcf|gif|png] [maxfps] ; encodes full screen until Ctrl+C\n"
+           "  licecap -d file.lcf fnout[.gif|.png]] [threads] ; converts lcf file to gif (or PNGs)\n"
+           "  licecap -g file.lcf fnout.gif [threads] [scenes] ; converts lcf file to gif with a global palette\n"
+           "    (two passes), or with up to [scenes] palettes for scenes where most of the image changes\n"
+           "  licecap -e file.[lcf|gif|png] [maxfps] [tilew tileh [interval]] ; encodes full screen until Ctrl+C\n"
+           "    (lcf tiles default to 128x16, with 20 frames per block)\n"
+           "  licecap --tune-lcf file.lcf [frames] ; re-encodes frames with several lcf tile sizes and intervals,\n"
+           "    reporting the size and encode time of each\n"
+           "  licecap -optimize in.gif out.gif [similarity] [threads] ; re-encodes a gif, merging frames at least\n"
+           "    [similarity] (0..1, default 1=identical) similar to the last kept frame and writing only changed rects\n"
            "Note: if PNG specified, filenames will be file-XXX.png\n"
            );
   }
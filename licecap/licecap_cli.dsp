@@ -299,6 +299,10 @@ SOURCE=..\WDL\lice\lice_png_write.cpp
 # End Group
 # Begin Source File
 
+SOURCE=.\duplicate_frame_removal.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\licecap_cli.cpp
 # End Source File
 # End Group
@@ -307,6 +311,10 @@ SOURCE=.\licecap_cli.cpp
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=.\duplicate_frame_removal.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\licecap_version.h
 # End Source File
 # End Group
@@ -87,6 +87,69 @@ HINSTANCE g_hInst;
 
 
 
+#define GIF_TILE_SIZE 32
+
+// hash of one tile (masked), so that changed tiles can be found without reading the previous frame
+static WDL_UINT64 gif_tile_hash(const LICE_pixel *rd, int span, int w, int h, LICE_pixel mask)
+{
+  const WDL_UINT64 K = WDL_UINT64_CONST(0x9E3779B97F4A7C15);
+  const WDL_UINT64 m64 = (WDL_UINT64)mask | ((WDL_UINT64)mask<<32);
+  WDL_UINT64 h0=1, h1=2, h2=3, h3=4; // independent lanes, 2 pixels each
+#define GIF_TILE_MIX(hv,v) hv = (((hv<<23)|(hv>>41)) ^ (v)) * K
+  while (h-- > 0)
+  {
+    int x=0;
+    for (; x+8 <= w; x+=8)
+    {
+      WDL_UINT64 v[4];
+      memcpy(v,rd+x,sizeof(v));
+      GIF_TILE_MIX(h0,v[0]&m64);
+      GIF_TILE_MIX(h1,v[1]&m64);
+      GIF_TILE_MIX(h2,v[2]&m64);
+      GIF_TILE_MIX(h3,v[3]&m64);
+    }
+    for (; x < w; x++) GIF_TILE_MIX(h0,rd[x]&mask);
+    rd += span;
+  }
+  GIF_TILE_MIX(h0,h1);
+  GIF_TILE_MIX(h0,h2);
+  GIF_TILE_MIX(h0,h3);
+#undef GIF_TILE_MIX
+  return h0;
+}
+
+#define GIF_MAX_SUBRECTS 16 // max sub-images per frame
+#define GIF_SUBRECT_OVERHEAD 2048 // approximate cost of an extra image descriptor and LZW restart, in pixels
+#define GIF_SUBRECT_DELAY 20 // ms between sub-images. browsers treat shorter delays (including 0) as 100ms
+#define GIF_FINGERPRINT_MINAREA (256*256) // smaller changed regions are compared exactly, fingerprinting them isn't cheaper
+
+void union_diffs(int a[4], const int b[4]);
+
+// merges rectangles (x,y,w,h) while encoding the union is cheaper than encoding them separately, or while there are more than maxcnt
+static int gif_merge_rects(int (*r)[4], int n, int maxcnt)
+{
+  while (n > 1)
+  {
+    int bi=-1, bj=-1, bestcost=0;
+    for (int i = 0; i < n; i ++)
+    {
+      for (int j = i+1; j < n; j ++)
+      {
+        int u[4];
+        memcpy(u,r[i],sizeof(u));
+        union_diffs(u,r[j]);
+        const int cost = u[2]*u[3] - r[i][2]*r[i][3] - r[j][2]*r[j][3] - GIF_SUBRECT_OVERHEAD;
+        if (bi < 0 || cost < bestcost) { bi=i; bj=j; bestcost=cost; }
+      }
+    }
+    if (bestcost > 0 && n <= maxcnt) break;
+
+    union_diffs(r[bi],r[bj]);
+    memcpy(r[bj],r[--n],sizeof(r[0]));
+  }
+  return n;
+}
+
 class gif_encoder
 {
 
@@ -95,6 +158,9 @@ class gif_encoder
 
   int lastbm_coords[4]; // coordinates of previous frame which need to be updated, [2], [3] will always be >0 if in progress
   int lastbm_accumdelay; // delay of previous frame which is latent
+  int lastbm_rects[GIF_MAX_SUBRECTS][4], lastbm_nrects; // if lastbm_nrects>1, regions of lastbm_coords to write as separate sub-images
+  int cmp_rects[GIF_MAX_SUBRECTS][4], cmp_nrects; // changed regions found by frame_compare()
+  int max_subrects;
   int loopcnt;
   LICE_pixel trans_mask;
 
@@ -102,6 +168,101 @@ class gif_encoder
   bool dup_remove_enable;
   DuplicateFrameRemovalSettings dup_cfg;
 
+  // per-tile hashes of lastbm, GIF_TILE_SIZE square, tiles_w*tiles_h
+  WDL_TypedBuf<WDL_UINT64> tile_hash, tile_newhash;
+  WDL_TypedBuf<unsigned char> tile_dirty;
+  WDL_TypedBuf<int> tile_stack, tile_rects;
+  int tiles_w, tiles_h;
+  LICE_pixel hash_mask; // superset of trans_mask and the duplicate removal channel mask
+
+  void hash_tiles(LICE_IBitmap *bm, int tx, int ty, int tx2, int ty2, WDL_UINT64 *out)
+  {
+    const int bw = bm->getWidth(), bh = bm->getHeight();
+    const LICE_pixel *bits = bm->getBits();
+    int span = bm->getRowSpan();
+    if (bm->isFlipped())
+    {
+      bits += span*(bh-1);
+      span = -span;
+    }
+    for (int y = ty; y < ty2; y ++)
+    {
+      const int py = y*GIF_TILE_SIZE, ph = wdl_min(GIF_TILE_SIZE, bh-py);
+      for (int x = tx; x < tx2; x ++)
+      {
+        const int px = x*GIF_TILE_SIZE;
+        out[y*tiles_w+x] = gif_tile_hash(bits + py*span + px, span, wdl_min(GIF_TILE_SIZE, bw-px), ph, hash_mask);
+      }
+    }
+  }
+
+  // rehash the tiles of lastbm touched by a rectangle
+  void update_tile_hashes(int x, int y, int w, int h)
+  {
+    if (!lastbm || w < 1 || h < 1) return;
+    const int tx2 = wdl_min((x+w+GIF_TILE_SIZE-1)/GIF_TILE_SIZE, tiles_w);
+    const int ty2 = wdl_min((y+h+GIF_TILE_SIZE-1)/GIF_TILE_SIZE, tiles_h);
+    hash_tiles(lastbm, wdl_max(x,0)/GIF_TILE_SIZE, wdl_max(y,0)/GIF_TILE_SIZE, tx2, ty2, tile_hash.Get());
+  }
+
+  // groups the dirty tiles into 8-connected clusters, fills cmp_rects with their merged bounding boxes (in pixels).
+  // returns false if there are too many clusters to bother with
+  bool find_dirty_clusters(LICE_IBitmap *bm, int bw, int bh)
+  {
+    unsigned char *dirty = tile_dirty.Get();
+    int *stack = tile_stack.ResizeOK(tiles_w*tiles_h,false);
+    if (!stack) return false;
+    tile_rects.Resize(0,false);
+
+    for (int i = 0; i < tiles_w*tiles_h; i ++)
+    {
+      if (dirty[i] != 1) continue;
+      if (tile_rects.GetSize() >= 64*4) return false;
+
+      int tx=tiles_w, ty=tiles_h, tx2=0, ty2=0, sp=0;
+      stack[sp++] = i;
+      dirty[i] = 2;
+      while (sp > 0)
+      {
+        const int idx = stack[--sp], x = idx % tiles_w, y = idx / tiles_w;
+        if (x < tx) tx=x;
+        if (x >= tx2) tx2=x+1;
+        if (y < ty) ty=y;
+        if (y >= ty2) ty2=y+1;
+        for (int ny = wdl_max(y-1,0); ny <= wdl_min(y+1,tiles_h-1); ny ++)
+          for (int nx = wdl_max(x-1,0); nx <= wdl_min(x+1,tiles_w-1); nx ++)
+            if (dirty[ny*tiles_w+nx] == 1)
+            {
+              dirty[ny*tiles_w+nx] = 2;
+              stack[sp++] = ny*tiles_w+nx;
+            }
+      }
+      const int r[4] = { tx*GIF_TILE_SIZE, ty*GIF_TILE_SIZE,
+                         wdl_min(tx2*GIF_TILE_SIZE,bw) - tx*GIF_TILE_SIZE, wdl_min(ty2*GIF_TILE_SIZE,bh) - ty*GIF_TILE_SIZE };
+      tile_rects.Add(r,4);
+    }
+
+    int (*rects)[4] = (int (*)[4])tile_rects.Get();
+    int n = gif_merge_rects(rects, tile_rects.GetSize()/4, max_subrects);
+
+    // shrink each cluster to its exact changed area
+    cmp_nrects=0;
+    for (int x = 0; x < n; x ++)
+    {
+      LICE_SubBitmap s1(lastbm, rects[x][0], rects[x][1], rects[x][2], rects[x][3]);
+      LICE_SubBitmap s2(bm, rects[x][0], rects[x][1], rects[x][2], rects[x][3]);
+      int *r = cmp_rects[cmp_nrects];
+      if (LICE_BitmapCmpEx(&s1, &s2, trans_mask, r))
+      {
+        r[0] += rects[x][0];
+        r[1] += rects[x][1];
+        cmp_nrects++;
+      }
+    }
+    cmp_nrects = gif_merge_rects(cmp_rects, cmp_nrects, max_subrects);
+    return true;
+  }
+
 public:
 
 
@@ -110,6 +271,7 @@ public:
     lastbm = NULL;
     memset(lastbm_coords,0,sizeof(lastbm_coords));
     lastbm_accumdelay = 0;
+    lastbm_nrects = cmp_nrects = 0;
     ctx=gifctx;
     loopcnt=use_loopcnt;
     trans_mask = LICE_RGBA(trans_chan_mask,trans_chan_mask,trans_chan_mask,0);
@@ -119,6 +281,12 @@ public:
     extern DuplicateFrameRemovalSettings g_dupremoval_cfg;
     dup_remove_enable = g_dupremoval_enable;
     dup_cfg = g_dupremoval_cfg;
+
+    tiles_w = tiles_h = 0;
+    hash_mask = trans_mask | (dup_remove_enable ? dup_cfg.channel_mask : 0);
+
+    extern int g_gif_subrects;
+    max_subrects = wdl_clamp(g_gif_subrects, 1, GIF_MAX_SUBRECTS);
   }
   ~gif_encoder()
   {
@@ -130,48 +298,136 @@ public:
   
   bool frame_compare(LICE_IBitmap *bm, int diffs[4])
   {
+    const int bw = bm->getWidth(), bh = bm->getHeight();
     diffs[0]=diffs[1]=0;
-    diffs[2]=bm->getWidth();
-    diffs[3]=bm->getHeight();
+    diffs[2]=bw;
+    diffs[3]=bh;
+    cmp_nrects = 0;
 
     // If we don't have history yet, force a new frame
     if (!lastbm) return true;
 
-    if (!dup_remove_enable)
+    // hash the new frame per tile, only tiles whose hash changed need to be looked at
+    WDL_UINT64 *nh = tile_newhash.Get();
+    const WDL_UINT64 *oh = tile_hash.Get();
+    unsigned char *dirty = tile_dirty.Get();
+    hash_tiles(bm, 0, 0, tiles_w, tiles_h, nh);
+
+    int tx=tiles_w, ty=tiles_h, tx2=0, ty2=0, ndirty=0;
+    for (int y = 0; y < tiles_h; y ++)
     {
-      // Backwards-compatible behavior using exact diff with mask
-      return LICE_BitmapCmpEx(lastbm, bm, trans_mask, diffs) ? true : false;
+      for (int x = 0; x < tiles_w; x ++)
+      {
+        const int idx = y*tiles_w+x;
+        if ((dirty[idx] = (nh[idx] != oh[idx]))!=0)
+        {
+          ndirty++;
+          if (x < tx) tx=x;
+          if (x >= tx2) tx2=x+1;
+          if (y < ty) ty=y;
+          if (y >= ty2) ty2=y+1;
+        }
+      }
+    }
+    if (!ndirty) return false;
+
+    RECT r = { tx*GIF_TILE_SIZE, ty*GIF_TILE_SIZE, wdl_min(tx2*GIF_TILE_SIZE,bw), wdl_min(ty2*GIF_TILE_SIZE,bh) };
+
+    LICE_SubBitmap s1(lastbm, r.left, r.top, r.right-r.left, r.bottom-r.top);
+    LICE_SubBitmap s2(bm, r.left, r.top, r.right-r.left, r.bottom-r.top);
+
+    // everything outside r is known to match, so only r needs looking at
+    const double total = (double)bw*bh, area = (double)(r.right-r.left)*(r.bottom-r.top);
+
+    // whether this is a duplicate, if known without a pixel compare: 1 yes, 0 no, -1 unknown
+    int dup_known = -1;
+    if (dup_remove_enable)
+    {
+      if (1.0 - area/total >= dup_cfg.similarity_threshold)
+        dup_known = 1; // even if all of r changed
+      else if (area >= GIF_FINGERPRINT_MINAREA)
+        dup_known = FingerprintPrefilter(ComputeFrameFingerprint(lastbm, &r), ComputeFrameFingerprint(bm, &r), &dup_cfg);
     }
 
-    // Use similarity-based duplicate detection. If similar enough, treat as duplicate.
-    double sim = CalculateSimilarity(lastbm, bm, NULL, &dup_cfg);
-    if (sim >= dup_cfg.similarity_threshold)
+    // exact duplicate detection with the transparency mask gets the changed pixel count and the
+    // bounding box from a single pass, everything else needs a separate bounding box scan
+    const bool fused = dup_known < 0 && dup_remove_enable && dup_cfg.per_channel_tolerance <= 0 &&
+                       dup_cfg.sample_step_x <= 1 && dup_cfg.sample_step_y <= 1 &&
+                       dup_cfg.channel_mask == trans_mask;
+    int ndiff = -1;
+    if (fused) ndiff = LICE_BitmapCmpCount(&s1, &s2, trans_mask, diffs);
+
+    if (dup_known != 0 && dup_remove_enable)
     {
-      // Duplicate detected. If keeping last, update history with current frame content.
-      if (dup_cfg.keep_mode == kDuplicateKeepLast)
+      double sim = 1.0;
+      if (fused)
+      {
+        sim = 1.0 - ndiff / total;
+      }
+      else if (dup_known < 0)
       {
-        // Copy full frame into lastbm so the eventual kept frame reflects most recent content.
-        LICE_Copy(lastbm, bm);
+        // scale the threshold so that early-out in r is equivalent to early-out over the whole frame
+        DuplicateFrameRemovalSettings cfg = dup_cfg;
+        cfg.similarity_threshold = 1.0 - (1.0-dup_cfg.similarity_threshold)*total/area;
+        if (cfg.similarity_threshold < 0.0) cfg.similarity_threshold = 0.0;
+
+        sim = 1.0 - (1.0 - CalculateSimilarity(lastbm, bm, &r, &cfg)) * area/total;
+      }
+      if (sim >= dup_cfg.similarity_threshold)
+      {
+        // Duplicate detected. If keeping last, update history with current frame content.
+        if (dup_cfg.keep_mode == kDuplicateKeepLast)
+        {
+          LICE_Blit(lastbm, bm, r.left, r.top, r.left, r.top, r.right-r.left, r.bottom-r.top, 1.0f, LICE_BLIT_MODE_COPY);
+          memcpy(tile_hash.Get(), nh, tiles_w*tiles_h*sizeof(WDL_UINT64));
+        }
+        return false; // no new frame needed
       }
-      return false; // no new frame needed
     }
 
-    // Otherwise, frames differ: compute bounding box for changed region via LICE_BitmapCmpEx
-    return LICE_BitmapCmpEx(lastbm, bm, trans_mask, diffs) ? true : false;
+    if (max_subrects > 1 && ndirty > 1 && find_dirty_clusters(bm, bw, bh))
+    {
+      if (!cmp_nrects) return false;
+      memcpy(diffs, cmp_rects[0], 4*sizeof(int));
+      for (int x = 1; x < cmp_nrects; x ++) union_diffs(diffs, cmp_rects[x]);
+      if (cmp_nrects < 2) cmp_nrects = 0;
+      return true;
+    }
+
+    // the exact bounding box within the changed tiles
+    if (fused ? ndiff <= 0 : !LICE_BitmapCmpEx(&s1, &s2, trans_mask, diffs)) return false;
+    diffs[0] += r.left;
+    diffs[1] += r.top;
+    return true;
   }
   
   void frame_finish()
   {
     if (ctx && lastbm && lastbm_coords[2] > 0 && lastbm_coords[3] > 0)
     {
-      LICE_SubBitmap bm(lastbm, lastbm_coords[0],lastbm_coords[1], lastbm_coords[2],lastbm_coords[3]);
-      
       int del = lastbm_accumdelay;
       if (del<1) del=1;
-      LICE_WriteGIFFrame(ctx,&bm,lastbm_coords[0],lastbm_coords[1],true,del,loopcnt);
+
+      if (lastbm_nrects > 1 && del >= GIF_SUBRECT_DELAY*lastbm_nrects)
+      {
+        // disjoint regions as separate sub-images, all but the last shown only briefly
+        for (int x = 0; x < lastbm_nrects; x ++)
+        {
+          const int *r = lastbm_rects[x];
+          LICE_SubBitmap bm(lastbm, r[0],r[1],r[2],r[3]);
+          const int d = x < lastbm_nrects-1 ? GIF_SUBRECT_DELAY : del - GIF_SUBRECT_DELAY*(lastbm_nrects-1);
+          LICE_WriteGIFFrame(ctx,&bm,r[0],r[1],true,d,loopcnt);
+        }
+      }
+      else
+      {
+        LICE_SubBitmap bm(lastbm, lastbm_coords[0],lastbm_coords[1], lastbm_coords[2],lastbm_coords[3]);
+        LICE_WriteGIFFrame(ctx,&bm,lastbm_coords[0],lastbm_coords[1],true,del,loopcnt);
+      }
     }
     lastbm_accumdelay=0;
     lastbm_coords[2]=lastbm_coords[3]=0;
+    lastbm_nrects=0;
   }
   
   void frame_advancetime(int amt)
@@ -179,7 +435,8 @@ public:
     lastbm_accumdelay+=amt;
   }
   
-  void frame_new(LICE_IBitmap *ref, int x, int y, int w, int h)
+  // rects/nrects optionally list the disjoint changed regions (from get_changed_rects()) within x,y,w,h
+  void frame_new(LICE_IBitmap *ref, int x, int y, int w, int h, const int (*rects)[4]=NULL, int nrects=0)
   {
     if (w > 0 && h > 0)
     {
@@ -189,11 +446,50 @@ public:
       lastbm_coords[1]=y;
       lastbm_coords[2]=w;
       lastbm_coords[3]=h;
+
+      lastbm_nrects=0;
+      if (rects && nrects > 1 && lastbm)
+      {
+        memcpy(lastbm_rects,rects,wdl_min(nrects,GIF_MAX_SUBRECTS)*sizeof(lastbm_rects[0]));
+        lastbm_nrects = gif_merge_rects(lastbm_rects, wdl_min(nrects,GIF_MAX_SUBRECTS), max_subrects);
+      }
     
-      if (!lastbm) lastbm = LICE_CreateMemBitmap(ref->getWidth(), ref->getHeight());
-      LICE_Blit(lastbm, ref, x, y, x,y, w,h, 1.0f, LICE_BLIT_MODE_COPY);
+      if (!lastbm)
+      {
+        lastbm = LICE_CreateMemBitmap(ref->getWidth(), ref->getHeight());
+        tiles_w = (ref->getWidth()+GIF_TILE_SIZE-1)/GIF_TILE_SIZE;
+        tiles_h = (ref->getHeight()+GIF_TILE_SIZE-1)/GIF_TILE_SIZE;
+        const int nt = tiles_w*tiles_h;
+        memset(tile_hash.ResizeOK(nt,false),0,nt*sizeof(WDL_UINT64));
+        tile_newhash.Resize(nt,false);
+        tile_dirty.Resize(nt,false);
+        if (x != 0 || y != 0 || w != ref->getWidth() || h != ref->getHeight())
+          update_tile_hashes(0,0,ref->getWidth(),ref->getHeight());
+      }
+
+      if (lastbm_nrects > 1)
+      {
+        for (int i = 0; i < lastbm_nrects; i ++)
+        {
+          const int *r = lastbm_rects[i];
+          LICE_Blit(lastbm, ref, r[0], r[1], r[0], r[1], r[2], r[3], 1.0f, LICE_BLIT_MODE_COPY);
+          update_tile_hashes(r[0],r[1],r[2],r[3]);
+        }
+      }
+      else
+      {
+        LICE_Blit(lastbm, ref, x, y, x,y, w,h, 1.0f, LICE_BLIT_MODE_COPY);
+        update_tile_hashes(x,y,w,h);
+      }
     }
   }
+
+  // after frame_compare() returned true: the disjoint changed regions, or 0 if the single diffs rectangle should be used
+  int get_changed_rects(int (*rects)[4]) const
+  {
+    if (cmp_nrects > 1) memcpy(rects,cmp_rects,cmp_nrects*sizeof(cmp_rects[0]));
+    return cmp_nrects > 1 ? cmp_nrects : 0;
+  }
   
   void clear_history() // forces next frame to be a fully new frame
   {
@@ -212,6 +508,15 @@ int g_stop_after_msec;
 
 int g_gif_loopcount=0;
 int g_max_fps=8;  
+int g_gif_subrects=4; // max disjoint sub-images per frame, 1 always uses a single bounding rectangle
+int g_gif_palette_reuse=0; // >0: keep a global palette, only write a local one when the RMS error per channel exceeds this
+int g_lcf_level=-1; // LCF deflate level 0-9, -1=adaptive (keeps compression within the capture's real-time budget)
+int g_lcf_codec=0; // 0=deflate, 1=fast LZ (larger files, needs a reader that supports LCF version 3)
+int g_lcf_tiledelta=0; // 1=store changed LCF tiles as residuals against the previous frame when cheaper (LCF version 3)
+int g_lcf_bpp=16; // 16=RGB565, 24/32=lossless RGB
+int g_lcf_tile_w=128, g_lcf_tile_h=16; // LCF tile size, see licecap_cli --tune-lcf
+int g_lcf_interval=20; // LCF frames per block
+int g_lcf_maxmem=64; // MB of changed LCF tiles kept while compressing, rather than two blocks of full frames. 0=keep full frames
 
 // ----------------------------------------------------------------------
 // Duplicate frame removal globals (INI-configurable; default disabled)
@@ -227,6 +532,8 @@ static const char* kIniDupSy     = "dup_sample_y";
 static const char* kIniDupTol    = "dup_tolerance";   // per-channel tolerance
 static const char* kIniDupChan   = "dup_channel_mask"; // integer mask (LICE_RGBA)
 static const char* kIniDupEarly  = "dup_early_out";    // 0/1
+static const char* kIniDupFpDup  = "dup_fp_dup_bits";  // fingerprint prefilter, -1=off
+static const char* kIniDupFpNew  = "dup_fp_new_bits";  // fingerprint prefilter, 0=off
 
 char g_last_fn[2048];
 WDL_String g_ini_file;
@@ -503,6 +810,252 @@ gif_encoder  *g_cap_gif2,*g_cap_gif3; // only used if TEST_MULTIPLE_MODES define
 int g_cap_gif_lastsec_written;
 
 
+// runs on the encode thread (or the UI thread when there is no pipeline)
+static void EncodeGIFFrame(LICE_IBitmap *bm, int delta_ms, int frame_time_in_seconds, bool dotime)
+{
+  const int bw = bm->getWidth();
+  const int bh = bm->getHeight();
+
+  // draw old time display for frame_compare(), so that it finds the portion other than the time display that changes
+  int old_time_coords[4]={0,};
+  if (dotime && g_cap_gif_lastsec_written>=0)
+    draw_timedisp(bm,g_cap_gif_lastsec_written,old_time_coords,bw,bh);
+
+  g_cap_gif->frame_advancetime(delta_ms);
+#ifdef TEST_MULTIPLE_MODES
+  if (g_cap_gif2) g_cap_gif2->frame_advancetime(delta_ms);
+  if (g_cap_gif3) g_cap_gif3->frame_advancetime(delta_ms);
+#endif
+
+  int diffs[4];
+  int rects[GIF_MAX_SUBRECTS+1][4]; // +1 for the time display
+
+  if (g_cap_gif->frame_compare(bm,diffs))
+  {
+    int nrects = g_cap_gif->get_changed_rects(rects);
+
+    g_cap_gif->frame_finish();
+#ifdef TEST_MULTIPLE_MODES
+    if (g_cap_gif2) g_cap_gif2->frame_finish();
+    if (g_cap_gif3) g_cap_gif3->frame_finish();
+#endif
+
+    if (dotime && frame_time_in_seconds != g_cap_gif_lastsec_written)
+    {
+      int pos[4];
+      draw_timedisp(NULL,frame_time_in_seconds,pos,bw,bh);
+
+      union_diffs(pos, old_time_coords);
+
+      // with multiple regions the time display is just one more region
+      if (nrects > 0 || (diffs[0]+diffs[2] >= pos[0] && diffs[1]+diffs[3] >= pos[1]))
+      {
+        union_diffs(diffs, pos); // add pos into diffs for display update
+        if (nrects > 0)
+        {
+          memcpy(rects[nrects++],pos,sizeof(pos));
+          if (nrects > GIF_MAX_SUBRECTS) nrects = gif_merge_rects(rects,nrects,GIF_MAX_SUBRECTS);
+        }
+
+        draw_timedisp(bm,frame_time_in_seconds,pos,bw,bh);
+        g_cap_gif_lastsec_written = frame_time_in_seconds;
+      }
+    }
+
+    g_cap_gif->frame_new(bm,diffs[0],diffs[1],diffs[2],diffs[3],rects,nrects);
+#ifdef TEST_MULTIPLE_MODES
+    if (g_cap_gif2) g_cap_gif2->frame_new(bm,diffs[0],diffs[1],diffs[2],diffs[3],rects,nrects);
+    if (g_cap_gif3) g_cap_gif3->frame_new(bm,diffs[0],diffs[1],diffs[2],diffs[3],rects,nrects);
+#endif
+  }
+
+  if (dotime && frame_time_in_seconds != g_cap_gif_lastsec_written)
+  {
+    // time changed and wasn't previously included, so include as a dedicated frame
+    g_cap_gif->frame_finish();
+#ifdef TEST_MULTIPLE_MODES
+    if (g_cap_gif2) g_cap_gif2->frame_finish();
+    if (g_cap_gif3) g_cap_gif3->frame_finish();
+#endif
+
+    int pos[4];
+    draw_timedisp(bm,frame_time_in_seconds,pos,bw,bh);
+    union_diffs(pos, old_time_coords);
+
+    g_cap_gif_lastsec_written = frame_time_in_seconds;
+    g_cap_gif->frame_new(bm,pos[0],pos[1],pos[2],pos[3]);
+#ifdef TEST_MULTIPLE_MODES
+    if (g_cap_gif2) g_cap_gif2->frame_new(bm,pos[0],pos[1],pos[2],pos[3]);
+    if (g_cap_gif3) g_cap_gif3->frame_new(bm,pos[0],pos[1],pos[2],pos[3]);
+#endif
+  }
+}
+
+
+#define CAPTURE_PIPELINE_FRAMES 8
+
+// Hands frames captured by the WM_TIMER handler to a worker thread, which does
+// the frame_compare()/quantize/LZW work of EncodeGIFFrame(). Frames are copied
+// into a fixed ring of preallocated bitmaps; if the encoder falls behind and the
+// ring is full, the frame is dropped and its time is given to the next frame.
+class capture_pipeline
+{
+  struct frameRec
+  {
+    LICE_IBitmap *bm;
+    int delta_ms;
+    int time_sec;
+    bool dotime;
+  };
+
+  frameRec frames[CAPTURE_PIPELINE_FRAMES];
+  int rdpos, cnt;
+  bool busy; // set while the worker is encoding a frame it has removed from the ring
+  int dropped_delay; // time of dropped frames, not yet given to a queued frame
+
+  WDL_Mutex mutex;
+  HANDLE thread;
+  bool kill;
+
+  static unsigned WINAPI threadProc(void *p)
+  {
+    capture_pipeline *_this = (capture_pipeline *)p;
+    for (;;)
+    {
+      frameRec *rec = NULL;
+      _this->mutex.Enter();
+      if (_this->cnt > 0)
+      {
+        rec = &_this->frames[_this->rdpos];
+        _this->busy = true;
+      }
+      const bool kill = _this->kill;
+      _this->mutex.Leave();
+
+      if (!rec)
+      {
+        if (kill) break;
+        Sleep(1);
+        continue;
+      }
+
+      EncodeGIFFrame(rec->bm,rec->delta_ms,rec->time_sec,rec->dotime);
+
+      _this->mutex.Enter();
+      _this->rdpos = (_this->rdpos+1) % CAPTURE_PIPELINE_FRAMES;
+      _this->cnt--;
+      _this->busy = false;
+      _this->mutex.Leave();
+    }
+    return 0;
+  }
+
+  // gives the time of frames dropped since the last queued frame to the frame in progress, once the worker is idle
+  void apply_dropped_delay()
+  {
+    if (dropped_delay>0 && g_cap_gif)
+    {
+      g_cap_gif->frame_advancetime(dropped_delay);
+#ifdef TEST_MULTIPLE_MODES
+      if (g_cap_gif2) g_cap_gif2->frame_advancetime(dropped_delay);
+      if (g_cap_gif3) g_cap_gif3->frame_advancetime(dropped_delay);
+#endif
+      dropped_delay=0;
+    }
+  }
+
+public:
+  int dropped; // frames dropped due to backpressure, for display
+
+  capture_pipeline(int w, int h)
+  {
+    int x;
+    for (x=0;x<CAPTURE_PIPELINE_FRAMES;x++)
+    {
+      memset(&frames[x],0,sizeof(frames[x]));
+      frames[x].bm = LICE_CreateMemBitmap(w,h);
+    }
+    rdpos=cnt=0;
+    busy=false;
+    dropped_delay=0;
+    dropped=0;
+    kill=false;
+
+    unsigned id;
+    thread = (HANDLE)_beginthreadex(NULL,0,threadProc,this,0,&id);
+  }
+  ~capture_pipeline()
+  {
+    // the worker drains any queued frames before exiting
+    mutex.Enter();
+    kill=true;
+    mutex.Leave();
+    if (thread)
+    {
+      WaitForSingleObject(thread,INFINITE);
+      CloseHandle(thread);
+    }
+    apply_dropped_delay(); // frames dropped after the last queued one
+
+    int x;
+    for (x=0;x<CAPTURE_PIPELINE_FRAMES;x++) delete frames[x].bm;
+  }
+
+  // called from the UI thread. returns false if the frame was dropped
+  bool add_frame(LICE_IBitmap *src, int delta_ms, int time_sec, bool dotime)
+  {
+    if (!thread)
+    {
+      // no worker, encode synchronously
+      EncodeGIFFrame(src,delta_ms,time_sec,dotime);
+      return true;
+    }
+
+    // rdpos and cnt are read together, as the worker advances both when it finishes a frame
+    mutex.Enter();
+    const int c = cnt, slot = (rdpos+cnt) % CAPTURE_PIPELINE_FRAMES;
+    mutex.Leave();
+
+    if (c >= CAPTURE_PIPELINE_FRAMES)
+    {
+      dropped_delay += delta_ms;
+      dropped++;
+      return false;
+    }
+
+    // the slot at rdpos+cnt is not touched by the worker until cnt is incremented
+    frameRec *rec = &frames[slot];
+    LICE_Copy(rec->bm,src);
+    rec->delta_ms = delta_ms + dropped_delay;
+    rec->time_sec = time_sec;
+    rec->dotime = dotime;
+    dropped_delay=0;
+
+    mutex.Enter();
+    cnt++;
+    mutex.Leave();
+    return true;
+  }
+
+  // called from the UI thread, waits until all queued frames have been encoded.
+  // after this returns, g_cap_gif can be used from the UI thread until the next add_frame()
+  void sync()
+  {
+    while (thread)
+    {
+      mutex.Enter();
+      const bool idle = !cnt && !busy;
+      mutex.Leave();
+      if (idle) break;
+      Sleep(1);
+    }
+    apply_dropped_delay();
+  }
+};
+
+capture_pipeline *g_cap_pipe;
+
+
 
 int g_titlems=1750;
 char g_title[4096];
@@ -640,6 +1193,10 @@ void UpdateStatusText(HWND hwndDlg)
   {   
     snprintf_append(buf,sizeof(buf)," @ %.1ffps" ,g_frate_avg);
   }
+  if (g_cap_pipe && g_cap_pipe->dropped)
+  {
+    snprintf_append(buf,sizeof(buf)," (%d dropped)",g_cap_pipe->dropped);
+  }
 
   GetDlgItemText(hwndDlg,IDC_STATUS,oldtext,sizeof(oldtext));
   if (strcmp(buf,oldtext))
@@ -756,6 +1313,9 @@ void Capture_Finish(HWND hwndDlg)
   delete g_cap_video;
   g_cap_video=0;
 #endif
+  delete g_cap_pipe; // finishes encoding any queued frames, and adds the time of frames dropped after them
+  g_cap_pipe=0;
+
   if (g_cap_gif)
   {
     delete g_cap_gif;
@@ -1044,6 +1604,8 @@ void WriteTextFrame(const char* str, int ms, bool isTitle, int w, int h, double
     }
   }
 
+  if (g_cap_pipe) g_cap_pipe->sync();
+
 #ifdef TEST_MULTIPLE_MODES
   if (g_cap_gif2)
   {
@@ -1182,6 +1744,26 @@ void SaveConfig(HWND hwndDlg)
   WritePrivateProfileString("licecap","gifloopcnt",buf,g_ini_file.Get());
   sprintf(buf, "%d", g_stop_after_msec);
   WritePrivateProfileString("licecap","stopafter",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_gif_subrects);
+  WritePrivateProfileString("licecap","gifsubrects",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_gif_palette_reuse);
+  WritePrivateProfileString("licecap","gifpalettereuse",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_level);
+  WritePrivateProfileString("licecap","lcflevel",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_codec);
+  WritePrivateProfileString("licecap","lcfcodec",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_tiledelta);
+  WritePrivateProfileString("licecap","lcftiledelta",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_bpp);
+  WritePrivateProfileString("licecap","lcfbpp",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_tile_w);
+  WritePrivateProfileString("licecap","lcftilew",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_tile_h);
+  WritePrivateProfileString("licecap","lcftileh",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_interval);
+  WritePrivateProfileString("licecap","lcfinterval",buf,g_ini_file.Get());
+  sprintf(buf, "%d", g_lcf_maxmem);
+  WritePrivateProfileString("licecap","lcfmaxmem",buf,g_ini_file.Get());
   
   
 
@@ -1209,6 +1791,10 @@ void SaveConfig(HWND hwndDlg)
   snprintf(buf, sizeof(buf), "%u", (unsigned)g_dupremoval_cfg.channel_mask);
   WritePrivateProfileString("licecap", kIniDupChan, buf, g_ini_file.Get());
   WritePrivateProfileString("licecap", kIniDupEarly, g_dupremoval_cfg.enable_early_out?"1":"0", g_ini_file.Get());
+  snprintf(buf, sizeof(buf), "%d", g_dupremoval_cfg.fingerprint_dup_bits);
+  WritePrivateProfileString("licecap", kIniDupFpDup, buf, g_ini_file.Get());
+  snprintf(buf, sizeof(buf), "%d", g_dupremoval_cfg.fingerprint_new_bits);
+  WritePrivateProfileString("licecap", kIniDupFpNew, buf, g_ini_file.Get());
 
 }
 
@@ -1286,6 +1872,16 @@ static WDL_DLGRET liceCapMainProc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
       g_prefs = GetPrivateProfileInt("licecap", "prefs", g_prefs, g_ini_file.Get());
       g_titlems = GetPrivateProfileInt("licecap", "titlems", g_titlems, g_ini_file.Get());
       g_stop_after_msec = GetPrivateProfileInt("licecap", "stopafter", g_stop_after_msec, g_ini_file.Get());
+      g_gif_subrects = GetPrivateProfileInt("licecap", "gifsubrects", g_gif_subrects, g_ini_file.Get());
+      g_gif_palette_reuse = GetPrivateProfileInt("licecap", "gifpalettereuse", g_gif_palette_reuse, g_ini_file.Get());
+      g_lcf_level = GetPrivateProfileInt("licecap", "lcflevel", g_lcf_level, g_ini_file.Get());
+      g_lcf_codec = GetPrivateProfileInt("licecap", "lcfcodec", g_lcf_codec, g_ini_file.Get());
+      g_lcf_tiledelta = GetPrivateProfileInt("licecap", "lcftiledelta", g_lcf_tiledelta, g_ini_file.Get());
+      g_lcf_bpp = GetPrivateProfileInt("licecap", "lcfbpp", g_lcf_bpp, g_ini_file.Get());
+      g_lcf_tile_w = wdl_max(GetPrivateProfileInt("licecap", "lcftilew", g_lcf_tile_w, g_ini_file.Get()),1);
+      g_lcf_tile_h = wdl_max(GetPrivateProfileInt("licecap", "lcftileh", g_lcf_tile_h, g_ini_file.Get()),1);
+      g_lcf_interval = wdl_max(GetPrivateProfileInt("licecap", "lcfinterval", g_lcf_interval, g_ini_file.Get()),1);
+      g_lcf_maxmem = GetPrivateProfileInt("licecap", "lcfmaxmem", g_lcf_maxmem, g_ini_file.Get());
 
       GetPrivateProfileString("licecap","title","",g_title,sizeof(g_title),g_ini_file.Get());
 
@@ -1320,6 +1916,8 @@ static WDL_DLGRET liceCapMainProc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
         }
       }
       g_dupremoval_cfg.enable_early_out = !!GetPrivateProfileInt("licecap", kIniDupEarly, g_dupremoval_cfg.enable_early_out?1:0, g_ini_file.Get());
+      g_dupremoval_cfg.fingerprint_dup_bits = wdl_clamp(GetPrivateProfileInt("licecap", kIniDupFpDup, g_dupremoval_cfg.fingerprint_dup_bits, g_ini_file.Get()), -1, 64);
+      g_dupremoval_cfg.fingerprint_new_bits = wdl_clamp(GetPrivateProfileInt("licecap", kIniDupFpNew, g_dupremoval_cfg.fingerprint_new_bits, g_ini_file.Get()), 0, 65);
 
     return 1;
     case WM_DESTROY:
@@ -1417,70 +2015,10 @@ static WDL_DLGRET liceCapMainProc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
 
               if (g_cap_gif)
               {
-                // draw old time display for frame_compare(), so that it finds the portion other than the time display that changes
-                int old_time_coords[4]={0,};
-                if (dotime && g_cap_gif_lastsec_written>=0)
-                  draw_timedisp(g_cap_bm,g_cap_gif_lastsec_written,old_time_coords,bw,bh);
-            
-                g_cap_gif->frame_advancetime(now-g_last_frame_capture_time);
-#ifdef TEST_MULTIPLE_MODES
-                if (g_cap_gif2) g_cap_gif2->frame_advancetime(now-g_last_frame_capture_time);
-                if (g_cap_gif3) g_cap_gif3->frame_advancetime(now-g_last_frame_capture_time);
-#endif
-
-                int diffs[4];
-                
-                if (g_cap_gif->frame_compare(g_cap_bm,diffs))
-                {
-                  g_cap_gif->frame_finish();
-#ifdef TEST_MULTIPLE_MODES
-                  if (g_cap_gif2) g_cap_gif2->frame_finish();
-                  if (g_cap_gif3) g_cap_gif3->frame_finish();
-#endif
-
-                  if (dotime && frame_time_in_seconds != g_cap_gif_lastsec_written)
-                  {
-                    int pos[4];
-                    draw_timedisp(NULL,frame_time_in_seconds,pos,bw,bh);
-
-                    union_diffs(pos, old_time_coords);
-
-                    if (diffs[0]+diffs[2] >= pos[0] && diffs[1]+diffs[3] >= pos[1])
-                    {
-                      union_diffs(diffs, pos); // add pos into diffs for display update
-
-                      draw_timedisp(g_cap_bm,frame_time_in_seconds,pos,bw,bh);
-                      g_cap_gif_lastsec_written = frame_time_in_seconds;
-                    }
-                  }
-
-                  g_cap_gif->frame_new(g_cap_bm,diffs[0],diffs[1],diffs[2],diffs[3]);
-#ifdef TEST_MULTIPLE_MODES
-                  if (g_cap_gif2) g_cap_gif2->frame_new(g_cap_bm,diffs[0],diffs[1],diffs[2],diffs[3]);
-                  if (g_cap_gif3) g_cap_gif3->frame_new(g_cap_bm,diffs[0],diffs[1],diffs[2],diffs[3]);
-#endif
-                }
-
-                if (dotime && frame_time_in_seconds != g_cap_gif_lastsec_written)
-                {
-                  // time changed and wasn't previously included, so include as a dedicated frame
-                  g_cap_gif->frame_finish();
-#ifdef TEST_MULTIPLE_MODES
-                  if (g_cap_gif2) g_cap_gif2->frame_finish();
-                  if (g_cap_gif3) g_cap_gif3->frame_finish();
-#endif
-
-                  int pos[4];
-                  draw_timedisp(g_cap_bm,frame_time_in_seconds,pos,bw,bh);
-                  union_diffs(pos, old_time_coords);
-
-                  g_cap_gif_lastsec_written = frame_time_in_seconds;
-                  g_cap_gif->frame_new(g_cap_bm,pos[0],pos[1],pos[2],pos[3]);
-#ifdef TEST_MULTIPLE_MODES
-                  if (g_cap_gif2) g_cap_gif2->frame_new(g_cap_bm,pos[0],pos[1],pos[2],pos[3]);
-                  if (g_cap_gif3) g_cap_gif3->frame_new(g_cap_bm,pos[0],pos[1],pos[2],pos[3]);
-#endif
-                }
+                if (g_cap_pipe)
+                  g_cap_pipe->add_frame(g_cap_bm,now-g_last_frame_capture_time,frame_time_in_seconds,dotime);
+                else
+                  EncodeGIFFrame(g_cap_bm,now-g_last_frame_capture_time,frame_time_in_seconds,dotime);
               }
 
               double fr = 1000.0 / (double) (now - g_last_frame_capture_time);
@@ -1750,6 +2288,10 @@ static WDL_DLGRET liceCapMainProc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
               if (strlen(g_last_fn)>4 && !stricmp(g_last_fn+strlen(g_last_fn)-4,".gif"))
               {
                 void *ctx = LICE_WriteGIFBeginNoFrame(g_last_fn,w,h,(g_prefs&32) ? (-1)&~7 : 0,true);
+#ifndef REAPER_LICECAP
+                if (ctx) LICE_WriteGIFSetThreads(ctx,0); // large frames are encoded in parallel bands
+                if (ctx && g_gif_palette_reuse>0) LICE_WriteGIFSetPaletteReuse(ctx,g_gif_palette_reuse);
+#endif
                 if (ctx) g_cap_gif = new gif_encoder(ctx,g_gif_loopcount,0xf8);
                 g_cap_gif_lastsec_written = -1;
 
@@ -1764,6 +2306,7 @@ static WDL_DLGRET liceCapMainProc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
                 if (ctx) g_cap_gif3 = new gif_encoder(ctx,g_gif_loopcount,0xf8);
 #endif
 
+                if (g_cap_gif) g_cap_pipe = new capture_pipeline(w,h);
               }
 #ifdef VIDEO_ENCODER_SUPPORT
               if (strlen(g_last_fn)>5 && !stricmp(g_last_fn+strlen(g_last_fn)-5,".webm"))
@@ -1812,7 +2355,12 @@ static WDL_DLGRET liceCapMainProc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
 #ifndef NO_LCF_SUPPORT
               if (strlen(g_last_fn)>4 && !stricmp(g_last_fn+strlen(g_last_fn)-4,".lcf"))
               {
-                g_cap_lcf = new LICECaptureCompressor(g_last_fn,w,h);
+                g_cap_lcf = new LICECaptureCompressor(g_last_fn,w,h,g_lcf_interval,g_lcf_tile_w,g_lcf_tile_h,g_lcf_level);
+                g_cap_lcf->SetThreads(0); // tile groups are deflated in parallel
+                g_cap_lcf->SetCodec(g_lcf_codec);
+                g_cap_lcf->SetTileDelta(!!g_lcf_tiledelta);
+                g_cap_lcf->SetBitDepth(g_lcf_bpp);
+                if (g_lcf_maxmem>0) g_cap_lcf->SetStreaming(wdl_min(g_lcf_maxmem,2047)<<20);
                 if (!g_cap_lcf->IsOpen())
                 {
                   delete g_cap_lcf;
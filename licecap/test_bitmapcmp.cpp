@@ -0,0 +1,225 @@
+// licecap/test_bitmapcmp.cpp
+//
+// Correctness check and microbenchmark for LICE_BitmapCmpEx and LICE_BitmapCmpCount.
+//
+// Build (add -mavx2 to test the AVX2 path, NEON is used automatically on ARM):
+//   c++ -std=c++11 -O2 -D_LICE_NO_SYSBITMAPS_ -I WDL \
+//       licecap/test_bitmapcmp.cpp WDL/lice/lice.cpp \
+//       -o test_bitmapcmp
+//
+// The results are compared against a copy of the original scalar implementation,
+// which is also timed so the per-frame savings can be read directly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "lice/lice.h"
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double ms_since(Clock::time_point t0)
+{
+  return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(Clock::now() - t0).count();
+}
+
+// ------------------------------------------------------------
+// Reference: the scalar coordsOut path of LICE_BitmapCmpEx
+
+static int ref_cmp(LICE_IBitmap *a, LICE_IBitmap *b, LICE_pixel mask, int *coordsOut)
+{
+  const int aw = a->getWidth(), ah = a->getHeight();
+  const LICE_pixel *px1 = a->getBits(), *px2 = b->getBits();
+  int span1 = a->getRowSpan(), span2 = b->getRowSpan();
+  int x, y;
+  for (y=0; y < ah; y ++)
+  {
+    for (x=0;x<aw && !((px1[x]^px2[x])&mask);x++);
+    if (x < aw) break;
+    px1+=span1;
+    px2+=span2;
+  }
+  if (y>=ah)
+  {
+    memset(coordsOut,0,4*sizeof(int));
+    return 0;
+  }
+  int miny=y, minx=x;
+  for (x=aw-1;x>minx && !((px1[x]^px2[x])&mask);x--);
+  int maxx=x;
+  px1+=span1 * (ah-1-y);
+  px2+=span2 * (ah-1-y);
+  for (y = ah-1; y > miny; y --)
+  {
+    for (x=0;x<aw && !((px1[x]^px2[x])&mask);x++);
+    if (x < aw)
+    {
+      if (x < minx) minx=x;
+      break;
+    }
+    px1-=span1;
+    px2-=span2;
+  }
+  int maxy=y;
+  if (y > miny)
+  {
+    for (x=aw-1;x>maxx && !((px1[x]^px2[x])&mask);x--);
+    maxx=x;
+  }
+  px1+=span1 * (miny+1-y);
+  px2+=span2 * (miny+1-y);
+  for (y=miny+1;y<maxy && (minx>0 || maxx<aw-1);y++)
+  {
+    for (x=0;x<minx && !((px1[x]^px2[x])&mask);x++);
+    minx=x;
+    for (x=aw-1;x>maxx && !((px1[x]^px2[x])&mask);x--);
+    maxx=x;
+    px1+=span1;
+    px2+=span2;
+  }
+  coordsOut[0]=minx;
+  coordsOut[1]=miny;
+  coordsOut[2]=maxx-minx+1;
+  coordsOut[3]=maxy-miny+1;
+  return 1;
+}
+
+// Reference for LICE_BitmapCmpCount: the bounding box scan, followed by a second pass counting pixels
+static int ref_count(LICE_IBitmap *a, LICE_IBitmap *b, LICE_pixel mask, int *coordsOut)
+{
+  if (!ref_cmp(a,b,mask,coordsOut)) return 0;
+  int cnt = 0;
+  for (int y = coordsOut[1]; y < coordsOut[1]+coordsOut[3]; y ++)
+  {
+    const LICE_pixel *px1 = a->getBits() + y*a->getRowSpan(), *px2 = b->getBits() + y*b->getRowSpan();
+    for (int x = coordsOut[0]; x < coordsOut[0]+coordsOut[2]; x ++) if ((px1[x]^px2[x])&mask) cnt++;
+  }
+  return cnt;
+}
+
+static void fill_random(LICE_IBitmap *bm)
+{
+  LICE_pixel *p = bm->getBits();
+  const int n = bm->getRowSpan()*bm->getHeight();
+  for (int i = 0; i < n; i ++) p[i] = (LICE_pixel)rand() ^ ((LICE_pixel)rand()<<16);
+}
+
+static void poke(LICE_IBitmap *bm, int x, int y, LICE_pixel xorv)
+{
+  bm->getBits()[y*bm->getRowSpan()+x] ^= xorv;
+}
+
+// ------------------------------------------------------------
+
+static int test_correctness()
+{
+  static const LICE_pixel masks[] = { 0xffffffff, 0x00ffffff, 0x00f8f8f8, 0xff000000 };
+  int fails = 0, runs = 0;
+  srand(1);
+  for (int iter = 0; iter < 4000; iter ++)
+  {
+    const int w = 1 + rand()%97, h = 1 + rand()%37;
+    LICE_MemBitmap a(w,h), b(w,h);
+    fill_random(&a);
+    LICE_Blit(&b,&a,0,0,0,0,w,h,1.0f,LICE_BLIT_MODE_COPY);
+
+    const int npoke = rand()%4 ? rand()%5 : rand()%(w*h);
+    for (int k = 0; k < npoke; k ++)
+      poke(&b, rand()%w, rand()%h, (LICE_pixel)1 << (rand()%32));
+
+    const LICE_pixel mask = masks[rand()%4];
+    int c1[4], c2[4];
+    const int r1 = LICE_BitmapCmpEx(&a,&b,mask,c1);
+    const int r2 = ref_cmp(&a,&b,mask,c2);
+    const int r3 = LICE_BitmapCmpEx(&a,&b,mask,NULL);
+    runs++;
+    if (r1 != r2 || memcmp(c1,c2,sizeof(c1)) || (!r3) != (!r2))
+    {
+      if (fails++ < 10)
+        printf("FAIL %dx%d mask=%08x: got %d (%d,%d,%d,%d) expected %d (%d,%d,%d,%d)\n",w,h,mask,
+               r1,c1[0],c1[1],c1[2],c1[3],r2,c2[0],c2[1],c2[2],c2[3]);
+    }
+
+    const int n1 = LICE_BitmapCmpCount(&a,&b,mask,c1);
+    const int n2 = ref_count(&a,&b,mask,c2);
+    runs++;
+    if (n1 != n2 || memcmp(c1,c2,sizeof(c1)) || LICE_BitmapCmpCount(&a,&b,mask) != n2)
+    {
+      if (fails++ < 10)
+        printf("FAIL count %dx%d mask=%08x: got %d (%d,%d,%d,%d) expected %d (%d,%d,%d,%d)\n",w,h,mask,
+               n1,c1[0],c1[1],c1[2],c1[3],n2,c2[0],c2[1],c2[2],c2[3]);
+    }
+  }
+  printf("correctness: %d/%d passed\n",runs-fails,runs);
+  return fails;
+}
+
+struct Res { const char *name; int w, h; };
+static volatile int g_sink; // keeps the timed loops from being optimized away
+
+static void bench()
+{
+  static const Res res[] = { {"640x480",640,480}, {"1280x720",1280,720}, {"1920x1080",1920,1080}, {"2560x1440",2560,1440}, {"3840x2160",3840,2160} };
+  printf("\n%-10s %-12s %10s %10s %8s\n","size","case","scalar ms","lice ms","speedup");
+  for (size_t r = 0; r < sizeof(res)/sizeof(res[0]); r ++)
+  {
+    const int w = res[r].w, h = res[r].h;
+    LICE_MemBitmap a(w,h), b(w,h);
+    fill_random(&a);
+
+    for (int c = 0; c < 3; c ++)
+    {
+      LICE_Blit(&b,&a,0,0,0,0,w,h,1.0f,LICE_BLIT_MODE_COPY);
+      const char *cname = "identical";
+      if (c == 1) { cname = "cursor"; poke(&b,w/2,h/2,0xff); poke(&b,w/2+8,h/2+16,0xff); }
+      else if (c == 2) { cname = "corners"; poke(&b,1,1,0xff); poke(&b,w-2,h-2,0xff); }
+
+      const int n = 100000000 / (w*h) + 4;
+      int coords[4], s = 0;
+      Clock::time_point t0 = Clock::now();
+      for (int i = 0; i < n; i ++) s += ref_cmp(&a,&b,0xffffff,coords) + coords[2];
+      const double tref = ms_since(t0) / n;
+      t0 = Clock::now();
+      for (int i = 0; i < n; i ++) s += LICE_BitmapCmpEx(&a,&b,0xffffff,coords) + coords[2];
+      const double tnew = ms_since(t0) / n;
+      g_sink += s;
+      printf("%-10s %-12s %10.3f %10.3f %7.2fx\n",res[r].name,cname,tref,tnew,tnew > 0.0 ? tref/tnew : 0.0);
+    }
+  }
+
+  // the changed pixel count and the bounding box, as two scans vs LICE_BitmapCmpCount
+  printf("\n%-10s %-12s %10s %10s %8s\n","size","case","2-pass ms","count ms","speedup");
+  for (size_t r = 0; r < sizeof(res)/sizeof(res[0]); r ++)
+  {
+    const int w = res[r].w, h = res[r].h;
+    LICE_MemBitmap a(w,h), b(w,h);
+    fill_random(&a);
+
+    for (int c = 0; c < 3; c ++)
+    {
+      LICE_Blit(&b,&a,0,0,0,0,w,h,1.0f,LICE_BLIT_MODE_COPY);
+      const char *cname = "identical";
+      if (c == 1) { cname = "corners"; poke(&b,1,1,0xff); poke(&b,w-2,h-2,0xff); }
+      else if (c == 2) { cname = "1% changed"; for (int i = 0; i < w*h/100; i ++) poke(&b,rand()%w,rand()%h,0xff); }
+
+      const int n = 100000000 / (w*h) + 4;
+      int coords[4], s = 0;
+      Clock::time_point t0 = Clock::now();
+      for (int i = 0; i < n; i ++) s += ref_count(&a,&b,0xffffff,coords) + coords[2];
+      const double tref = ms_since(t0) / n;
+      t0 = Clock::now();
+      for (int i = 0; i < n; i ++) s += LICE_BitmapCmpCount(&a,&b,0xffffff,coords) + coords[2];
+      const double tnew = ms_since(t0) / n;
+      g_sink += s;
+      printf("%-10s %-12s %10.3f %10.3f %7.2fx\n",res[r].name,cname,tref,tnew,tnew > 0.0 ? tref/tnew : 0.0);
+    }
+  }
+}
+
+int main()
+{
+  const int fails = test_correctness();
+  bench();
+  return fails ? 1 : 0;
+}
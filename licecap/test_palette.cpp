@@ -0,0 +1,275 @@
+// licecap/test_palette.cpp
+//
+// Checks and benchmarks LICE_BuildPaletteEx: octree vs histogram median cut vs k-means,
+// comparing build time and PSNR on synthetic screen-capture content. Also checks the
+// accumulated histograms (LICE_*PaletteHistogram) used for multi-frame palettes.
+//
+// Build:
+//   c++ -std=c++11 -O2 -D_LICE_NO_SYSBITMAPS_ -I WDL \
+//       licecap/test_palette.cpp WDL/lice/lice.cpp WDL/lice/lice_palette.cpp \
+//       -o test_palette -lpthread
+//
+// PSNR is measured after mapping every pixel to its nearest palette entry, so it
+// reflects palette quality rather than the lookup method of a particular encoder.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include "lice/lice.h"
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double ms_since(Clock::time_point t0)
+{
+  return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(Clock::now() - t0).count();
+}
+
+// ------------------------------------------------------------
+// synthetic screen content: desktop gradient, windows with title bars,
+// antialiased "text", icons and a photo-like region
+
+static unsigned int g_seed = 1;
+static int rnd(int n) { g_seed = g_seed*1103515245 + 12345; return (int)((g_seed>>8) % (unsigned int)n); }
+
+static void make_screen(LICE_IBitmap *bm, int variant)
+{
+  const int w = bm->getWidth(), h = bm->getHeight();
+  g_seed = 1 + variant;
+  LICE_pixel *p = bm->getBits();
+  const int span = bm->getRowSpan();
+  for (int y = 0; y < h; y ++)
+    for (int x = 0; x < w; x ++)
+      p[y*span+x] = LICE_RGBA(20 + 40*y/h, 60 + 80*x/w, 120 + 100*y/h, 255);
+
+  for (int win = 0; win < 6; win ++)
+  {
+    const int ww = w/4 + rnd(w/3), wh = h/4 + rnd(h/3);
+    const int wx = rnd(w-ww), wy = rnd(h-wh);
+    const LICE_pixel bg = win&1 ? LICE_RGBA(245,245,245,255) : LICE_RGBA(30,30,34,255);
+    const LICE_pixel fg = win&1 ? LICE_RGBA(20,20,20,255) : LICE_RGBA(220,220,210,255);
+    LICE_FillRect(bm, wx, wy, ww, wh, bg, 1.0f, LICE_BLIT_MODE_COPY);
+    LICE_FillRect(bm, wx, wy, ww, 24, LICE_RGBA(40+rnd(60),90+rnd(60),180+rnd(60),255), 1.0f, LICE_BLIT_MODE_COPY);
+
+    // lines of text: short strokes with antialiased edges
+    for (int ty = wy+32; ty + 12 < wy+wh; ty += 16)
+    {
+      int tx = wx+8;
+      while (tx + 8 < wx+ww)
+      {
+        const int len = 2 + rnd(8);
+        for (int c = 0; c < len && tx + 8 < wx+ww; c ++, tx += 7)
+          for (int k = 0; k < 4; k ++)
+          {
+            const int gx = tx + rnd(5), gy = ty + rnd(10);
+            LICE_PutPixel(bm, gx, gy, fg, 1.0f, LICE_BLIT_MODE_COPY);
+            LICE_PutPixel(bm, gx+1, gy, fg, 0.5f, LICE_BLIT_MODE_COPY);
+            LICE_PutPixel(bm, gx, gy+1, fg, 0.25f, LICE_BLIT_MODE_COPY);
+          }
+        tx += 7;
+      }
+    }
+  }
+
+  for (int i = 0; i < 24; i ++) // icons
+  {
+    const int ix = rnd(w-32), iy = rnd(h-32);
+    for (int y = 0; y < 32; y ++)
+      for (int x = 0; x < 32; x ++)
+        p[(iy+y)*span+ix+x] = LICE_RGBA(128+4*x-4*y+rnd(3), 64+6*y, 200-5*x, 255);
+  }
+
+  // photo-like region
+  const int px0 = w/2, py0 = h/2, pw = w/3, ph = h/3;
+  for (int y = 0; y < ph; y ++)
+    for (int x = 0; x < pw; x ++)
+    {
+      const double v = sin(x*0.05+variant)*cos(y*0.07)*60.0;
+      p[(py0+y)*span+px0+x] = LICE_RGBA(lice_max(0,lice_min(255,(int)(120+v)+rnd(12))),
+                                        lice_max(0,lice_min(255,(int)(100-v*0.5)+rnd(12))),
+                                        lice_max(0,lice_min(255,(int)(80+v*0.3)+rnd(12))), 255);
+    }
+}
+
+// ------------------------------------------------------------
+
+static double psnr(LICE_IBitmap *bm, const LICE_pixel *pal, int npal)
+{
+  // nearest-entry memo per 24-bit color, screen content has few unique colors
+  static unsigned short *memo;
+  if (!memo) memo = (unsigned short *)malloc(sizeof(unsigned short)<<24);
+  memset(memo, 0xff, sizeof(unsigned short)<<24);
+
+  double sse = 0.0;
+  const int w = bm->getWidth(), h = bm->getHeight(), span = bm->getRowSpan();
+  for (int y = 0; y < h; y ++)
+  {
+    const LICE_pixel *px = bm->getBits() + y*span;
+    for (int x = 0; x < w; x ++)
+    {
+      const LICE_pixel c = px[x] & LICE_RGBA(255,255,255,0);
+      int err;
+      if (memo[c] == 0xffff)
+      {
+        int best = 0, besterr = 1<<30;
+        for (int i = 0; i < npal; i ++)
+        {
+          const int dr = (int)LICE_GETR(c)-(int)LICE_GETR(pal[i]);
+          const int dg = (int)LICE_GETG(c)-(int)LICE_GETG(pal[i]);
+          const int db = (int)LICE_GETB(c)-(int)LICE_GETB(pal[i]);
+          const int e = dr*dr+dg*dg+db*db;
+          if (e < besterr) { besterr = e; best = i; }
+        }
+        memo[c] = (unsigned short)best;
+      }
+      const LICE_pixel m = pal[memo[c]];
+      const int dr = (int)LICE_GETR(c)-(int)LICE_GETR(m);
+      const int dg = (int)LICE_GETG(c)-(int)LICE_GETG(m);
+      const int db = (int)LICE_GETB(c)-(int)LICE_GETB(m);
+      err = dr*dr+dg*dg+db*db;
+      sse += err;
+    }
+  }
+  const double mse = sse / (3.0*w*h);
+  return mse > 0.0 ? 10.0*log10(255.0*255.0/mse) : 99.0;
+}
+
+static int test_correctness()
+{
+  int fails = 0;
+  LICE_MemBitmap a(333,197), b(333,197);
+  LICE_pixel pal[256], pal2[256];
+
+  // fewer distinct colors than entries, each in its own 15-bit cell: must be exact
+  g_seed = 5;
+  for (int y = 0; y < 197; y ++)
+    for (int x = 0; x < 333; x ++)
+      a.getBits()[y*a.getRowSpan()+x] = LICE_RGBA(8*rnd(4)+3, 64*rnd(4), 200, 255);
+  for (int mode = 1; mode <= 2; mode ++)
+  {
+    const int n = LICE_BuildPaletteEx(&a, pal, 255, mode);
+    if (n != 16 || psnr(&a, pal, n) < 98.0) { printf("FAIL exact mode=%d n=%d\n", mode, n); fails++; }
+  }
+
+  // diff/alpha pixel counts match the octree variants, threads don't change the result
+  make_screen(&a, 0);
+  LICE_Blit(&b, &a, 0, 0, 0, 0, 333, 197, 1.0f, LICE_BLIT_MODE_COPY);
+  LICE_FillRect(&b, 10, 10, 50, 40, LICE_RGBA(1,2,3,255), 1.0f, LICE_BLIT_MODE_COPY);
+  for (int y = 0; y < 197; y ++)
+    for (int x = y%7; x < 333; x += 7)
+      a.getBits()[y*a.getRowSpan()+x] &= LICE_RGBA(255,255,255,0);
+
+  int c0, c1, c2;
+  LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_OCTREE, &b, LICE_RGBA(255,255,255,0), 0, &c0);
+  int n1 = LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_MEDIANCUT, &b, LICE_RGBA(255,255,255,0), 0, &c1, 1);
+  int n2 = LICE_BuildPaletteEx(&a, pal2, 255, LICE_PALETTE_MEDIANCUT, &b, LICE_RGBA(255,255,255,0), 0, &c2, 4);
+  if (c0 != c1 || c1 != c2 || n1 != n2 || memcmp(pal, pal2, n1*sizeof(LICE_pixel)))
+  {
+    printf("FAIL diff: octree %d hist %d/%d pixels\n", c0, c1, c2);
+    fails++;
+  }
+
+  LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_OCTREE, NULL, 0, 128, &c0);
+  LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_KMEANS, NULL, 0, 128, &c1);
+  if (c0 != c1)
+  {
+    printf("FAIL alpha: octree %d hist %d pixels\n", c0, c1);
+    fails++;
+  }
+
+  // both filters at once: every engine uses the pixels that pass both
+  LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_OCTREE, &b, LICE_RGBA(255,255,255,0), 128, &c0);
+  LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_MEDIANCUT, &b, LICE_RGBA(255,255,255,0), 128, &c1);
+  LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_OCTREE, &b, LICE_RGBA(255,255,255,0), 0, &c2);
+  if (c0 != c1 || c0 >= c2)
+  {
+    printf("FAIL diff+alpha: octree %d hist %d pixels (%d without alpha)\n", c0, c1, c2);
+    fails++;
+  }
+
+  // accumulated histograms: one image matches LICE_BuildPaletteEx(), merging matches adding
+  void *h1 = LICE_CreatePaletteHistogram(), *h2 = LICE_CreatePaletteHistogram(), *h3 = LICE_CreatePaletteHistogram();
+  LICE_BuildPaletteEx(&a, pal, 255, LICE_PALETTE_KMEANS, &b, LICE_RGBA(255,255,255,0), 0, &c0);
+  c1 = LICE_AddToPaletteHistogram(h1, &a, &b, LICE_RGBA(255,255,255,0), 0, 4);
+  n1 = LICE_BuildPaletteFromHistogram(h1, pal2, 255, LICE_PALETTE_KMEANS);
+  if (c0 != c1 || memcmp(pal, pal2, n1*sizeof(LICE_pixel)))
+  {
+    printf("FAIL histogram: %d/%d pixels\n", c0, c1);
+    fails++;
+  }
+  LICE_AddToPaletteHistogram(h1, &b);
+  LICE_AddToPaletteHistogram(h2, &a, &b);
+  LICE_AddToPaletteHistogram(h3, &b);
+  LICE_MergePaletteHistogram(h2, h3);
+  n1 = LICE_BuildPaletteFromHistogram(h1, pal, 255, LICE_PALETTE_MEDIANCUT);
+  n2 = LICE_BuildPaletteFromHistogram(h2, pal2, 255, LICE_PALETTE_MEDIANCUT);
+  if (n1 != n2 || memcmp(pal, pal2, n1*sizeof(LICE_pixel)))
+  {
+    printf("FAIL histogram merge\n");
+    fails++;
+  }
+  LICE_DestroyPaletteHistogram(h1);
+  LICE_DestroyPaletteHistogram(h2);
+  LICE_DestroyPaletteHistogram(h3);
+
+  static unsigned char tab[32*32*32];
+  LICE_GeneratePaletteLookupTable(pal, n1, tab);
+  for (int i = 0; i < 32*32*32; i ++) // entries are nearest to the center of their cell
+  {
+    const int r = ((i>>10)<<3)|4, g = (((i>>5)&31)<<3)|4, bl = ((i&31)<<3)|4;
+    int besterr = 1<<30, taberr = 0;
+    for (int k = 0; k < n1; k ++)
+    {
+      const int dr = r-(int)LICE_GETR(pal[k]), dg = g-(int)LICE_GETG(pal[k]), db = bl-(int)LICE_GETB(pal[k]);
+      const int e = dr*dr+dg*dg+db*db;
+      if (e < besterr) besterr = e;
+      if (k == tab[i]) taberr = e;
+    }
+    if (taberr != besterr) { printf("FAIL lookup table %d\n", i); fails++; break; }
+  }
+
+  printf("correctness: %s\n", fails ? "FAILED" : "ok");
+  return fails;
+}
+
+struct Res { const char *name; int w, h; };
+
+static void bench()
+{
+  static const Res res[] = { {"640x480",640,480}, {"1280x720",1280,720}, {"1920x1080",1920,1080} };
+  static const char *modes[] = { "octree", "mediancut", "kmeans" };
+  printf("\n%-10s %-10s %7s %10s %9s\n", "size", "engine", "colors", "build ms", "PSNR dB");
+  for (size_t r = 0; r < sizeof(res)/sizeof(res[0]); r ++)
+  {
+    LICE_MemBitmap bm(res[r].w, res[r].h);
+    make_screen(&bm, (int)r);
+    for (int mode = 0; mode < 3; mode ++)
+    {
+      for (int nt = 1; nt <= (mode ? 4 : 1); nt *= 4)
+      {
+        LICE_pixel pal[256];
+        int n = 0;
+        double best = 1.0e9;
+        for (int k = 0; k < 7; k ++)
+        {
+          Clock::time_point t0 = Clock::now();
+          n = LICE_BuildPaletteEx(&bm, pal, 255, mode, NULL, 0, 0, NULL, nt);
+          const double t = ms_since(t0);
+          if (t < best) best = t;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), mode ? "%s/%d" : "%s", modes[mode], nt);
+        printf("%-10s %-10s %7d %10.2f %9.2f\n", res[r].name, name, n, best, psnr(&bm, pal, n));
+      }
+    }
+  }
+}
+
+int main()
+{
+  const int fails = test_correctness();
+  bench();
+  return fails ? 1 : 0;
+}
@@ -5,11 +5,11 @@
 // Build:
 //   c++ -std=c++11 -O2 -I . -I WDL \
 //       licecap/test_performance.cpp licecap/duplicate_frame_removal.cpp \
-//       -o test_performance
+//       -o test_performance -lpthread
 //
 // This program does not depend on any GUI framework and avoids linking
 // WDL .cpp files by:
-//  - Providing a minimal LICE_BitmapCmpEx implementation locally
+//  - Providing a minimal LICE_BitmapCmpCount implementation locally
 //  - Using a simple LICE_IBitmap implementation (SimpleBitmap)
 
 #include <stdio.h>
@@ -26,6 +26,7 @@
 #include <sstream>
 
 #include "duplicate_frame_removal.h"
+#include "../WDL/lice/lice_parallel.h" // LICE_GetNumCPUs
 
 using Clock = std::chrono::high_resolution_clock;
 using std::cout;
@@ -97,43 +98,31 @@ private:
   std::vector<LICE_pixel> data_;
 };
 
-// Lightweight LICE_BitmapCmpEx for linking CalculateSimilarity fast path.
-int LICE_BitmapCmpEx(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coordsOut)
+// Lightweight LICE_BitmapCmpCount for linking CalculateSimilarity fast path.
+int LICE_BitmapCmpCount(LICE_IBitmap* a, LICE_IBitmap* b, LICE_pixel mask, int *coordsOut)
 {
-  if (!a || !b) {
-    if (coordsOut) { coordsOut[0]=coordsOut[1]=coordsOut[2]=coordsOut[3]=0; }
-    return 1;
-  }
+  if (coordsOut) { coordsOut[0]=coordsOut[1]=coordsOut[2]=coordsOut[3]=0; }
+  if (!a || !b) return -1;
   const int aw=a->getWidth(), ah=a->getHeight();
-  const int bw=b->getWidth(), bh=b->getHeight();
-  if (aw!=bw || ah!=bh) {
-    if (coordsOut) { coordsOut[0]=0; coordsOut[1]=0; coordsOut[2]= (aw>bw?aw:bw); coordsOut[3]= (ah>bh?ah:bh); }
-    return 1;
-  }
+  if (aw!=b->getWidth() || ah!=b->getHeight()) return -1;
   const LICE_pixel* p1=a->getBits();
   const LICE_pixel* p2=b->getBits();
   const int rs1=a->getRowSpan();
   const int rs2=b->getRowSpan();
-  if (!p1 || !p2 || aw<=0 || ah<=0) {
-    if (coordsOut) { coordsOut[0]=coordsOut[1]=coordsOut[2]=coordsOut[3]=0; }
-    return 0;
-  }
-  int minx=aw, miny=ah, maxx=-1, maxy=-1;
+  if (!p1 || !p2 || aw<=0 || ah<=0) return 0;
+  int cnt=0, minx=aw, miny=ah, maxx=-1, maxy=-1;
   for (int y=0;y<ah;++y) {
     const LICE_pixel* r1=p1 + y*rs1;
     const LICE_pixel* r2=p2 + y*rs2;
     for (int x=0;x<aw;++x) {
       if (((r1[x]^r2[x]) & mask) != 0) {
+        cnt++;
         if (x<minx) minx=x; if (y<miny) miny=y; if (x>maxx) maxx=x; if (y>maxy) maxy=y;
       }
     }
   }
-  if (maxx < minx || maxy < miny) {
-    if (coordsOut) { coordsOut[0]=coordsOut[1]=coordsOut[2]=coordsOut[3]=0; }
-    return 0;
-  }
-  if (coordsOut) { coordsOut[0]=minx; coordsOut[1]=miny; coordsOut[2]=maxx-minx+1; coordsOut[3]=maxy-miny+1; }
-  return 1;
+  if (cnt && coordsOut) { coordsOut[0]=minx; coordsOut[1]=miny; coordsOut[2]=maxx-minx+1; coordsOut[3]=maxy-miny+1; }
+  return cnt;
 }
 
 // Simple RAII owner to track memory usage of bitmaps used in tests.
@@ -212,11 +201,11 @@ static PerfResult bench_similarity_once(int w, int h, int step, bool early_out,
 
   // warmup
   double last = 0.0;
-  for (int i=0;i<3;i++) last += CalculateSimilarity(A.bmp, B.bmp, nullptr, cfg);
+  for (int i=0;i<3;i++) last += CalculateSimilarity(A.bmp, B.bmp, nullptr, &cfg);
 
   Timer t; t.start();
   double acc = 0.0;
-  for (int i=0;i<iters;i++) acc += CalculateSimilarity(A.bmp, B.bmp, nullptr, cfg);
+  for (int i=0;i<iters;i++) acc += CalculateSimilarity(A.bmp, B.bmp, nullptr, &cfg);
   double ms = t.ms();
   double per = ms / (double)iters;
   double fps = 1000.0 / per;
@@ -241,15 +230,15 @@ static PerfResult bench_early_out_delta(int w, int h, int step, double threshold
   make_opposite_pair(w,h,A,B); // very different
 
   // warmup
-  (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, cfg_no);
-  (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, cfg_yes);
+  (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, &cfg_no);
+  (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, &cfg_yes);
 
   Timer t; t.start();
-  for (int i=0;i<iters;i++) (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, cfg_no);
+  for (int i=0;i<iters;i++) (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, &cfg_no);
   double ms_no = t.ms();
 
   t.start();
-  for (int i=0;i<iters;i++) (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, cfg_yes);
+  for (int i=0;i<iters;i++) (void)CalculateSimilarity(A.bmp, B.bmp, nullptr, &cfg_yes);
   double ms_yes = t.ms();
 
   PerfResult r{w,h,step,true,threshold,(ms_yes/iters),1000.0/ (ms_yes/iters)};
@@ -326,14 +315,23 @@ static void gen_sim_frames(int w, int h, int count, int change_epoch,
   }
 }
 
+// nthreads: 0 for RemoveDuplicateFrames, else RemoveDuplicateFramesParallel with that many threads.
+// output/removed are freed unless returned through out/out_removed (which the caller then frees)
 static SimResult bench_duplicate_removal(const std::vector<FrameInfo>& frames,
-                                         const DuplicateFrameRemovalSettings& cfg) {
+                                         const DuplicateFrameRemovalSettings& cfg,
+                                         int nthreads = 0,
+                                         FrameArray* out = nullptr,
+                                         IndexArray* out_removed = nullptr) {
   Timer t; t.start();
-  std::vector<FrameInfo> output;
-  std::vector<size_t> removed;
-  const size_t removed_count = RemoveDuplicateFrames(frames, output, cfg, &removed);
+  FrameArray output;
+  IndexArray removed;
+  const size_t removed_count = nthreads > 0 ?
+    RemoveDuplicateFramesParallel(frames.data(), frames.size(), &output, &cfg, &removed, nthreads) :
+    RemoveDuplicateFrames(frames.data(), frames.size(), &output, &cfg, &removed);
   const double ms = t.ms();
-  SimResult r{frames.size(), output.size(), removed_count, ms, frames.empty()?0.0: (1000.0 * (double)frames.size()/ms)};
+  SimResult r{frames.size(), output.count, removed_count, ms, frames.empty()?0.0: (1000.0 * (double)frames.size()/ms)};
+  if (out) *out = output; else FrameArray_Free(&output);
+  if (out_removed) *out_removed = removed; else IndexArray_Free(&removed);
   return r;
 }
 
@@ -359,6 +357,116 @@ static void bench_pipeline_compare(const std::vector<FrameInfo>& frames,
   (void)checksum;
 }
 
+// ------------------------------------------------------------
+// Parallel removal: identical output to the serial version, and scaling
+
+static bool same_result(const FrameArray& a, const IndexArray& ra, const FrameArray& b, const IndexArray& rb) {
+  if (a.count != b.count || ra.count != rb.count) return false;
+  for (size_t i=0;i<a.count;i++)
+    if (a.frames[i].index != b.frames[i].index || a.frames[i].delay_ms != b.frames[i].delay_ms) return false;
+  for (size_t i=0;i<ra.count;i++)
+    if (ra.indices[i] != rb.indices[i]) return false;
+  return true;
+}
+
+// A quarter of the screen is redrawn at varying intervals, so that runs of 1 to 12 duplicates
+// alternate with real changes. Within a run, a moving cursor changes every third frame, the
+// other frames are exact repeats.
+static void gen_scene_frames(int w, int h, int count, std::vector<BitmapOwner>& pool, std::vector<FrameInfo>& frames) {
+  pool.clear(); frames.clear();
+  pool.reserve(count);
+  frames.reserve(count);
+
+  BitmapOwner bg(w,h);
+  fill_noise(bg.bmp, 0xCAFEBABEu);
+  SimpleBitmap region(w/2,h/2);
+  uint32_t s = 0x9E3779B9u;
+  int scene = 0, next_change = 0, cursor_x = 0;
+
+  for (int i=0;i<count;i++) {
+    pool.emplace_back(w,h);
+    auto& bm = pool.back();
+    const bool new_scene = i == next_change;
+    if (new_scene) {
+      s^=s<<13; s^=s>>17; s^=s<<5;
+      next_change = i + 1 + (int)(s % 12);
+      fill_noise(&region, 0x51ED0000u + (uint32_t)++scene);
+    }
+    if (i > 0 && !new_scene && (i % 3)) {
+      bm.bmp->blitFrom(*pool[i-1].bmp);
+    } else {
+      bm.bmp->blitFrom(*bg.bmp);
+      for (int y=0;y<h/2;y++)
+        memcpy(bm.bmp->getBits() + (y+h/4)*w + w/4, region.getBits() + y*(w/2), (w/2)*sizeof(LICE_pixel));
+      bm.bmp->fillRect(cursor_x % (w-10), h/8, 10, 10, LICE_RGBA(255,255,0,255));
+      cursor_x += 7;
+    }
+    frames.push_back(FrameInfo(i, bm.bmp, 20));
+  }
+}
+
+static bool bench_parallel_scaling(int w, int h, int count) {
+  std::vector<BitmapOwner> pool;
+  std::vector<FrameInfo> frames;
+  gen_scene_frames(w,h,count, pool, frames);
+
+  bool ok = true;
+  for (int keep=0; keep<2; keep++) {
+    DuplicateFrameRemovalSettings cfg;
+    cfg.similarity_threshold = 0.995;
+    cfg.keep_mode = keep ? kDuplicateKeepLast : kDuplicateKeepFirst;
+
+    FrameArray ref; IndexArray ref_removed;
+    const auto base = bench_duplicate_removal(frames, cfg, 0, &ref, &ref_removed);
+    cout << "  " << (keep ? "keep last" : "keep first") << ", " << w << "x" << h << ", " << count << " frames -> "
+         << ref.count << " (serial " << std::fixed << std::setprecision(1) << base.ms_total << " ms)" << endl;
+
+    // thread counts beyond the number of CPUs only measure overhead, 2 always runs to check the output
+    const int nt[] = {1,2,4,8,16,32,64};
+    for (int t : nt) {
+      if (t > 2 && t > LICE_GetNumCPUs()) break;
+      FrameArray out; IndexArray removed;
+      const auto r = bench_duplicate_removal(frames, cfg, t, &out, &removed);
+      const bool same = same_result(ref, ref_removed, out, removed);
+      ok = ok && same;
+      cout << "    threads=" << std::setw(2) << t << ": " << std::fixed << std::setprecision(1) << std::setw(8) << r.ms_total << " ms  "
+           << std::setw(7) << r.fps << " frames/sec  x" << std::setprecision(2) << (r.ms_total>0 ? base.ms_total/r.ms_total : 0.0)
+           << (same ? "" : "  OUTPUT DIFFERS") << endl;
+      FrameArray_Free(&out); IndexArray_Free(&removed);
+    }
+    FrameArray_Free(&ref); IndexArray_Free(&ref_removed);
+  }
+  return ok;
+}
+
+// output identity under other settings, on small frames
+static bool check_parallel_variants() {
+  std::vector<BitmapOwner> pool;
+  std::vector<FrameInfo> frames;
+  gen_scene_frames(320,240,300, pool, frames);
+  for (size_t i=100;i<200;i++) { frames[i].x = 40; frames[i].y = 30; frames[i].w = 200; frames[i].h = 150; } // some frames with an ROI
+
+  bool ok = true;
+  for (int v=0; v<8; v++) {
+    DuplicateFrameRemovalSettings cfg;
+    cfg.similarity_threshold = 0.97;
+    cfg.keep_mode = (v&1) ? kDuplicateKeepLast : kDuplicateKeepFirst;
+    if (v&2) cfg.per_channel_tolerance = 3;
+    if (v&4) { cfg.sample_step_x = cfg.sample_step_y = 2; cfg.fingerprint_dup_bits = 0; cfg.fingerprint_new_bits = 20; }
+
+    FrameArray ref, out; IndexArray ref_removed, removed;
+    bench_duplicate_removal(frames, cfg, 0, &ref, &ref_removed);
+    bench_duplicate_removal(frames, cfg, 3, &out, &removed);
+    if (!same_result(ref, ref_removed, out, removed)) {
+      cout << "  variant " << v << ": OUTPUT DIFFERS (" << ref.count << " vs " << out.count << " frames)" << endl;
+      ok = false;
+    }
+    FrameArray_Free(&ref); IndexArray_Free(&ref_removed);
+    FrameArray_Free(&out); IndexArray_Free(&removed);
+  }
+  return ok;
+}
+
 // ------------------------------------------------------------
 // Memory/stability tests
 
@@ -466,7 +574,13 @@ int main() {
     cout << "  Tracked bitmap memory: " << human_bytes((double)BitmapOwner::live_bytes) << " (live objects: " << BitmapOwner::live_count << ")" << endl;
   }
 
-  // 5) Memory usage tests
+  // 5) Parallel batch removal
+  section("Parallel Removal Scaling");
+  cout << "  " << LICE_GetNumCPUs() << " CPUs" << endl;
+  const bool parallel_ok = bench_parallel_scaling(1280,720,150) && check_parallel_variants();
+  cout << "  Result: " << (parallel_ok ? "OK (identical to serial)" : "FAIL (differs from serial)") << endl;
+
+  // 6) Memory usage tests
   section("Memory & Stability");
   cout << "  Running long-run stability loops..." << endl;
   bool stable = memory_stability_test(640,480, /*loops*/20, /*frames_per_loop*/100);
@@ -475,5 +589,5 @@ int main() {
 
   line();
   cout << "Done." << endl;
-  return stable ? 0 : 1;
+  return stable && parallel_ok ? 0 : 1;
 }
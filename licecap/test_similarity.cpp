@@ -0,0 +1,282 @@
+// licecap/test_similarity.cpp
+//
+// Correctness check and microbenchmark for CalculateSimilarity, and sanity
+// checks and timing of the fingerprint prefilter.
+//
+// Build (NEON is used automatically on ARM):
+//   c++ -std=c++11 -O2 -D_LICE_NO_SYSBITMAPS_ -I WDL licecap/test_similarity.cpp
+//       licecap/duplicate_frame_removal.cpp WDL/lice/lice.cpp -o test_similarity -lpthread
+//
+// The results are compared against a copy of the original per-sample implementation,
+// which must match exactly (including where early-out stops), and is also timed.
+// The exact full-frame case must match it with early-out disabled.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "lice/lice.h"
+#include "../licecap/duplicate_frame_removal.h"
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double ms_since(Clock::time_point t0)
+{
+  return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(Clock::now() - t0).count();
+}
+
+// ------------------------------------------------------------
+// Reference: the original sampled scan of CalculateSimilarity
+
+static bool ref_pixels_equal(LICE_pixel p1, LICE_pixel p2, const DuplicateFrameRemovalSettings* cfg)
+{
+  if (cfg->per_channel_tolerance <= 0) return ((p1 ^ p2) & cfg->channel_mask) == 0;
+  const int tol = cfg->per_channel_tolerance;
+  if (cfg->channel_mask & LICE_RGBA(255,0,0,0)) { int d = (int)LICE_GETR(p1) - (int)LICE_GETR(p2); if (d < 0) d = -d; if (d > tol) return false; }
+  if (cfg->channel_mask & LICE_RGBA(0,255,0,0)) { int d = (int)LICE_GETG(p1) - (int)LICE_GETG(p2); if (d < 0) d = -d; if (d > tol) return false; }
+  if (cfg->channel_mask & LICE_RGBA(0,0,255,0)) { int d = (int)LICE_GETB(p1) - (int)LICE_GETB(p2); if (d < 0) d = -d; if (d > tol) return false; }
+  if (cfg->channel_mask & LICE_RGBA(0,0,0,255)) { int d = (int)LICE_GETA(p1) - (int)LICE_GETA(p2); if (d < 0) d = -d; if (d > tol) return false; }
+  return true;
+}
+
+// r must be within both bitmaps and non-empty
+static double ref_similarity(LICE_IBitmap* a, LICE_IBitmap* b, const RECT& r, const DuplicateFrameRemovalSettings* cfg)
+{
+  const LICE_pixel* p1 = a->getBits();
+  const LICE_pixel* p2 = b->getBits();
+  const int span1 = a->getRowSpan(), span2 = b->getRowSpan();
+  const int sX = cfg->sample_step_x > 0 ? cfg->sample_step_x : 1;
+  const int sY = cfg->sample_step_y > 0 ? cfg->sample_step_y : 1;
+  const long total_samples = (long)((r.right - r.left + sX - 1) / sX) * (long)((r.bottom - r.top + sY - 1) / sY);
+
+  long equal_count = 0, processed = 0;
+  for (int yy = r.top; yy < r.bottom; yy += sY)
+  {
+    for (int xx = r.left; xx < r.right; xx += sX)
+    {
+      if (ref_pixels_equal(p1[yy*span1+xx], p2[yy*span2+xx], cfg)) ++equal_count;
+      ++processed;
+      if (cfg->enable_early_out)
+      {
+        const long best_case_equal = equal_count + total_samples - processed;
+        if ((double)best_case_equal / (double)total_samples < cfg->similarity_threshold)
+          return (double)equal_count / (double)total_samples;
+      }
+    }
+  }
+  return (double)equal_count / (double)total_samples;
+}
+
+static void fill_random(LICE_IBitmap *bm)
+{
+  LICE_pixel *p = bm->getBits();
+  const int n = bm->getRowSpan()*bm->getHeight();
+  for (int i = 0; i < n; i ++) p[i] = (LICE_pixel)rand() ^ ((LICE_pixel)rand()<<16);
+}
+
+// changes some pixels of b, by small amounts (around typical tolerances) or randomly
+static void perturb(LICE_IBitmap *bm, int cnt)
+{
+  const int w = bm->getWidth(), h = bm->getHeight();
+  for (int k = 0; k < cnt; k ++)
+  {
+    LICE_pixel *p = bm->getBits() + (rand()%h)*bm->getRowSpan() + rand()%w;
+    if (rand()&1) *p ^= (LICE_pixel)rand() ^ ((LICE_pixel)rand()<<16);
+    else
+    {
+      const int sh = (rand()%4)*8, d = rand()%9 - 4;
+      int v = (int)((*p >> sh) & 0xff) + d;
+      if (v < 0) v = 0; else if (v > 255) v = 255;
+      *p = (*p & ~((LICE_pixel)0xff << sh)) | ((LICE_pixel)v << sh);
+    }
+  }
+}
+
+// ------------------------------------------------------------
+
+static int test_correctness()
+{
+  static const LICE_pixel masks[] = { (LICE_pixel)LICE_RGBA(255,255,255,0), 0xffffffff, 0x00f8f8f8, (LICE_pixel)LICE_RGBA(0,255,0,255), 0 };
+  static const int tols[] = { 0, 0, 1, 2, 3, 16, 255, 300 };
+  static const double thresholds[] = { 0.0, 0.5, 0.9, 0.95, 0.99, 0.999, 1.0, 1.5 };
+  int fails = 0, runs = 0;
+  srand(1);
+  for (int iter = 0; iter < 20000; iter ++)
+  {
+    const int w = 1 + rand()%61, h = 1 + rand()%23;
+    LICE_MemBitmap a(w,h), b(w,h);
+    fill_random(&a);
+    LICE_Blit(&b,&a,0,0,0,0,w,h,1.0f,LICE_BLIT_MODE_COPY);
+    perturb(&b, rand()%(w*h/2+2));
+
+    DuplicateFrameRemovalSettings cfg;
+    cfg.channel_mask = masks[rand()%5];
+    cfg.per_channel_tolerance = tols[rand()%8];
+    cfg.similarity_threshold = thresholds[rand()%8];
+    cfg.enable_early_out = (rand()%4) != 0;
+    cfg.sample_step_x = rand()%3 ? 1 : 1 + rand()%4;
+    cfg.sample_step_y = rand()%3 ? 1 : 1 + rand()%3;
+
+    RECT r;
+    r.left = rand()%w; r.top = rand()%h;
+    r.right = r.left + 1 + rand()%(w-r.left); r.bottom = r.top + 1 + rand()%(h-r.top);
+    if (rand()%4 == 0) { r.left = r.top = 0; r.right = w; r.bottom = h; }
+
+    const double s1 = CalculateSimilarity(&a,&b,&r,&cfg);
+    double s2;
+    // the exact full-frame case counts with LICE_BitmapCmpCount, which doesn't stop early
+    if (cfg.per_channel_tolerance <= 0 && cfg.sample_step_x == 1 && cfg.sample_step_y == 1 &&
+        r.left == 0 && r.top == 0 && r.right == w && r.bottom == h)
+    {
+      DuplicateFrameRemovalSettings full = cfg;
+      full.enable_early_out = false;
+      s2 = ref_similarity(&a,&b,r,&full);
+    }
+    else
+      s2 = ref_similarity(&a,&b,r,&cfg);
+    runs++;
+    if (s1 != s2)
+    {
+      if (fails++ < 10)
+        printf("FAIL %dx%d roi=(%d,%d,%d,%d) mask=%08x tol=%d thr=%g step=%dx%d early=%d: got %.17g expected %.17g\n",
+               w,h,(int)r.left,(int)r.top,(int)r.right,(int)r.bottom,cfg.channel_mask,cfg.per_channel_tolerance,
+               cfg.similarity_threshold,cfg.sample_step_x,cfg.sample_step_y,cfg.enable_early_out?1:0,s1,s2);
+    }
+  }
+  printf("correctness: %d/%d passed\n",runs-fails,runs);
+  return fails;
+}
+
+// ------------------------------------------------------------
+// fingerprints
+
+// something screen-like: gradients, boxes and some text-sized noise
+static void draw_scene(LICE_IBitmap *bm, int seed)
+{
+  const int w = bm->getWidth(), h = bm->getHeight();
+  srand(seed);
+  LICE_GradRect(bm,0,0,w,h,(rand()%100)/100.0f,0.3f,0.5f,1.0f,0.0001f*(rand()%10),0.0f,0.0f,0.0f,0.0f,0.0002f,0.0f,0.0f,LICE_BLIT_MODE_COPY);
+  for (int i = 0; i < 12; i ++)
+  {
+    const int x = rand()%w, y = rand()%h;
+    LICE_FillRect(bm,x,y,w/8+rand()%(w/4),h/16+rand()%(h/4),LICE_RGBA(rand()%256,rand()%256,rand()%256,255),1.0f,LICE_BLIT_MODE_COPY);
+  }
+  for (int i = 0; i < w*h/50; i ++) bm->getBits()[(rand()%h)*bm->getRowSpan()+rand()%w] = LICE_RGBA(0,0,0,255);
+}
+
+static int test_fingerprint()
+{
+  int fails = 0;
+  const int w = 800, h = 600;
+  LICE_MemBitmap a(w,h), b(w,h), c(w,h);
+  draw_scene(&a,1);
+  LICE_Blit(&b,&a,0,0,0,0,w,h,1.0f,LICE_BLIT_MODE_COPY);
+  LICE_FillRect(&b,w/2,h/2,16,24,LICE_RGBA(255,255,255,255),1.0f,LICE_BLIT_MODE_COPY); // cursor
+  draw_scene(&c,2);
+
+  const WDL_UINT64 fa = ComputeFrameFingerprint(&a,NULL), fb = ComputeFrameFingerprint(&b,NULL), fc = ComputeFrameFingerprint(&c,NULL);
+  const int d_same = FingerprintDistance(fa,ComputeFrameFingerprint(&a,NULL)), d_cursor = FingerprintDistance(fa,fb), d_scene = FingerprintDistance(fa,fc);
+  printf("fingerprint distance: identical %d, cursor %d, scene change %d\n",d_same,d_cursor,d_scene);
+  if (d_same != 0 || d_cursor > 2 || d_scene < 16) { printf("FAIL fingerprint distances\n"); fails++; }
+
+  DuplicateFrameRemovalSettings cfg;
+  if (FingerprintPrefilter(fa,fc,&cfg) != -1) { printf("FAIL prefilter not disabled by default\n"); fails++; }
+  cfg.fingerprint_dup_bits = 0;
+  cfg.fingerprint_new_bits = 16;
+  if (FingerprintPrefilter(fa,fa,&cfg) != 1 || FingerprintPrefilter(fa,fc,&cfg) != 0) { printf("FAIL prefilter\n"); fails++; }
+
+  // a sequence of duplicates and scene changes collapses the same with and without the prefilter
+  LICE_IBitmap *seq[] = { &a, &a, &b, &c, &c, &a, &b, &b, &c };
+  const int n = sizeof(seq)/sizeof(seq[0]);
+  FrameInfo in[n];
+  for (int i = 0; i < n; i ++) in[i] = FrameInfo(i,seq[i],100);
+  for (int keep = 0; keep < 2; keep ++)
+  {
+    DuplicateFrameRemovalSettings c1, c2 = cfg;
+    c1.keep_mode = c2.keep_mode = keep ? kDuplicateKeepLast : kDuplicateKeepFirst;
+    FrameArray o1, o2;
+    const size_t r1 = RemoveDuplicateFrames(in,n,&o1,&c1,NULL), r2 = RemoveDuplicateFrames(in,n,&o2,&c2,NULL);
+    bool same = r1 == r2 && o1.count == o2.count;
+    for (size_t i = 0; same && i < o1.count; i ++)
+      same = o1.frames[i].index == o2.frames[i].index && o1.frames[i].delay_ms == o2.frames[i].delay_ms;
+    if (!same || o1.count != 4) { printf("FAIL RemoveDuplicateFrames with prefilter, keep mode %d: %d/%d frames\n",keep,(int)o1.count,(int)o2.count); fails++; }
+    FrameArray_Free(&o1);
+    FrameArray_Free(&o2);
+  }
+  return fails;
+}
+
+struct Res { const char *name; int w, h; };
+static volatile double g_sink; // keeps the timed loops from being optimized away
+
+typedef double (*simfunc)(LICE_IBitmap*, LICE_IBitmap*, const RECT*, const DuplicateFrameRemovalSettings*);
+static double ref_similarity_p(LICE_IBitmap* a, LICE_IBitmap* b, const RECT* r, const DuplicateFrameRemovalSettings* cfg)
+{
+  return ref_similarity(a,b,*r,cfg);
+}
+// called through volatile pointers so that repeated calls can't be hoisted
+static simfunc volatile g_ref = ref_similarity_p, g_new = CalculateSimilarity;
+
+static void bench()
+{
+  static const Res res[] = { {"640x480",640,480}, {"1920x1080",1920,1080}, {"3840x2160",3840,2160} };
+  printf("\n%-10s %-16s %10s %10s %8s\n","size","case","scalar ms","new ms","speedup");
+  for (size_t i = 0; i < sizeof(res)/sizeof(res[0]); i ++)
+  {
+    const int w = res[i].w, h = res[i].h;
+    LICE_MemBitmap a(w,h), b(w,h);
+    fill_random(&a);
+    LICE_Blit(&b,&a,0,0,0,0,w,h,1.0f,LICE_BLIT_MODE_COPY);
+    perturb(&b, w*h/200); // 0.5% changed, a likely duplicate at the default threshold
+    const RECT r = { 0, 0, w, h-1 }; // not full-frame, so the exact case also scans
+
+    for (int c = 0; c < 3; c ++)
+    {
+      DuplicateFrameRemovalSettings cfg;
+      const char *cname = "exact";
+      if (c == 1) { cname = "tolerance 2"; cfg.per_channel_tolerance = 2; }
+      else if (c == 2) { cname = "tolerance, step2"; cfg.per_channel_tolerance = 2; cfg.sample_step_x = cfg.sample_step_y = 2; }
+
+      const int n = 50000000 / (w*h) + 4;
+      double s = 0.0;
+      Clock::time_point t0 = Clock::now();
+      for (int k = 0; k < n; k ++) s += g_ref(&a,&b,&r,&cfg);
+      const double tref = ms_since(t0) / n;
+      t0 = Clock::now();
+      for (int k = 0; k < n; k ++) s += g_new(&a,&b,&r,&cfg);
+      const double tnew = ms_since(t0) / n;
+      g_sink += s;
+      printf("%-10s %-16s %10.3f %10.3f %7.2fx\n",res[i].name,cname,tref,tnew,tnew > 0.0 ? tref/tnew : 0.0);
+    }
+  }
+
+  printf("\n%-10s %14s %14s\n","size","similarity ms","fingerprint ms");
+  for (size_t i = 0; i < sizeof(res)/sizeof(res[0]); i ++)
+  {
+    const int w = res[i].w, h = res[i].h;
+    LICE_MemBitmap a(w,h), b(w,h);
+    fill_random(&a);
+    LICE_Blit(&b,&a,0,0,0,0,w,h,1.0f,LICE_BLIT_MODE_COPY);
+    perturb(&b, w*h/200);
+    DuplicateFrameRemovalSettings cfg;
+
+    const int n = 50000000 / (w*h) + 4;
+    double s = 0.0;
+    Clock::time_point t0 = Clock::now();
+    for (int k = 0; k < n; k ++) s += g_new(&a,&b,NULL,&cfg);
+    const double tsim = ms_since(t0) / n;
+    t0 = Clock::now();
+    for (int k = 0; k < n; k ++) s += (double)ComputeFrameFingerprint(k&1 ? &a : &b,NULL);
+    const double tfp = ms_since(t0) / n;
+    g_sink += s;
+    printf("%-10s %14.3f %14.3f\n",res[i].name,tsim,tfp);
+  }
+}
+
+int main()
+{
+  const int fails = test_correctness() + test_fingerprint();
+  bench();
+  return fails ? 1 : 0;
+}